@@ -0,0 +1,103 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/*
+ * Slab arena of fixed-width records addressed by 32-bit indices.
+ *
+ * Slab k holds (1<<(SLAB_BITS+k)) records, so the slab directory has a
+ * fixed size and records never move once allocated. Index 0 is reserved
+ * as the null reference. Records are zero-filled on allocation and all
+ * slabs are released at once when the arena is dropped.
+ */
+template<class R> class Arena {
+
+	static const unsigned SLAB_BITS = 10;
+	static const unsigned MAX_SLABS = 32 - SLAB_BITS;
+
+	R* slab [MAX_SLABS];
+
+	unsigned width;
+	unsigned top;
+
+	std::vector<unsigned> recycled;
+
+	Arena (const Arena&);
+	Arena& operator = (const Arena&);
+
+public:
+	Arena (unsigned w=1) : width(w), top(1) {
+		memset (slab, 0, sizeof(slab));
+	}
+
+	~Arena () {clear();}
+
+	R* at ( unsigned i ) const {
+		unsigned j = i + (1u<<SLAB_BITS);
+		unsigned k = 31 - __builtin_clz (j);
+		return slab [k-SLAB_BITS] + (size_t)(j - (1u<<k)) * width;
+	}
+
+	unsigned alloc () {
+		if ( ! recycled.empty() ) {
+			unsigned i = recycled.back();
+			recycled.pop_back();
+			memset (at(i), 0, width*sizeof(R));
+			return i;
+		}
+
+		if ( top >= ~0u - (1u<<SLAB_BITS) )
+			throw std::runtime_error ("** CRITICAL ERROR - Arena index space exhausted.");
+
+		unsigned j = top + (1u<<SLAB_BITS);
+		unsigned k = 31 - __builtin_clz (j) - SLAB_BITS;
+		if ( slab[k] == 0 ) {
+			slab[k] = (R*) calloc ((size_t)width<<(SLAB_BITS+k), sizeof(R));
+			if ( slab[k] == 0 )
+				throw std::runtime_error ("** CRITICAL ERROR - Unable to allocate arena slab.");
+		}
+		return top++;
+	}
+
+	void release ( unsigned i ) {recycled.push_back (i);}
+
+	/* drops every record at once */
+	void clear () {
+		for (unsigned k=0; k<MAX_SLABS; ++k) {
+			free (slab[k]);
+			slab[k] = 0;
+		}
+		recycled.clear();
+		top = 1;
+	}
+
+	/* upper bound of indices handed out so far */
+	unsigned end () const {return top;}
+
+	unsigned get_width () const {return width;}
+};
+
+#endif
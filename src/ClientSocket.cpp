@@ -21,20 +21,27 @@
 #include <iostream>
 #include <stdexcept>
 
-ClientSocket::ClientSocket ( std::string host, int port ) {
+ClientSocket::ClientSocket ( std::string host, int port ) : binary(false) {
   if ( ! Socket::create() )
       throw std::runtime_error ( "Could not create client socket." );
   while (!Socket::connect ( host.c_str(), port ));
 }
 
+ClientSocket::ClientSocket ( std::string host, int port, int timeout_ms ) : binary(false) {
+	if ( ! Socket::create() )
+		throw std::runtime_error ( "Could not create client socket." );
+	if ( ! Socket::connect ( host.c_str(), port, timeout_ms ) )
+		throw std::runtime_error ( "Could not connect client socket." );
+}
+
 const ClientSocket& ClientSocket::operator << ( const std::string& s ) const {
-	if ( ! Socket::send ( s ) )
+	if ( ! ( Socket::is_framed() ? Socket::send_frame ( s ) : Socket::send ( s ) ) )
 		throw std::runtime_error ( "Could not write to socket." );
 	return *this;
 }
 
 const ClientSocket& ClientSocket::operator >> ( std::string& s ) const {
-	if ( ! Socket::recv (s) )
+	if ( ! ( Socket::is_framed() ? Socket::recv_frame (s) : Socket::recv (s) ) )
 		throw std::runtime_error ( "Could not read from socket." );
 	return *this;
 }
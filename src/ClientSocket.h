@@ -24,12 +24,18 @@
 
 class ClientSocket : public Socket {
 
-	ClientSocket (Socket& cs) : Socket(cs) {}
+	/* the peer takes binary tuples, as agreed on connecting */
+	bool binary;
+
+	ClientSocket (Socket& cs) : Socket(cs), binary(false) {}
 
 public:
 
-	ClientSocket() {}
+	ClientSocket() : binary(false) {}
 	ClientSocket ( std::string, int );
+
+	/* gives up connecting after timeout_ms */
+	ClientSocket ( std::string, int, int timeout_ms );
 	~ClientSocket(){};
 
 	const ClientSocket& operator << ( const std::string& ) const;
@@ -37,6 +43,9 @@ public:
 
 	bool open () { return Socket::open();}
 	void close () { return Socket::close();}
+
+	void set_binary ( const bool b ) { binary = b; }
+	bool is_binary () const { return binary; }
 };
 
 #endif
@@ -0,0 +1,171 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+/*
+ * Keys cross the wire either as text, formatted and parsed with
+ * to_chars and from_chars, or in binary between peers that agreed on it.
+ * A binary message is its type, BINARY_TAG and its fields: keys as raw
+ * little-endian coordinates and values prefixed by their length in 32
+ * bits. No text message has BINARY_TAG as its second byte.
+ */
+const char BINARY_TAG = '\x01';
+
+/* longest text of a coordinate */
+#define MAXDIGITS 64
+
+inline bool is_binary ( const std::string& msg ) {
+	return msg.size() > 1 && msg[1] == BINARY_TAG;
+}
+
+/*** text ***/
+
+template<class T> static void put_text ( std::ostream& out, T x ) {
+	char buf [MAXDIGITS];
+	std::to_chars_result res = std::to_chars (buf, buf+MAXDIGITS, x);
+	out.write (buf, res.ptr-buf);
+}
+
+template<> inline void put_text<char> ( std::ostream& out, char x ) {
+	out << x;
+}
+
+/* skips blanks straight on the buffer of in, returns the next character or EOF */
+inline int skip_blanks ( std::istream& in ) {
+	std::streambuf* sb = in.rdbuf();
+	int c;
+	while ((c = sb->sgetc()) != EOF && isspace (c))
+		sb->sbumpc();
+	return c;
+}
+
+template<class T> static void get_text ( std::istream& in, T& x ) {
+	char buf [MAXDIGITS];
+	int len = 0;
+
+	std::streambuf* sb = in.rdbuf();
+	if (::skip_blanks (in) == '+')
+		sb->sbumpc();
+
+	/* a coordinate is made of digits, signs, points, exponents, or inf and nan */
+	for (int c; (c = sb->sgetc()) != EOF && (isalnum (c) || c == '.' || c == '-' || c == '+'); sb->sbumpc()) {
+		if (len == MAXDIGITS)
+			throw std::runtime_error (" Bad request message. Coordinate too long.\n");
+		buf[len++] = c;
+	}
+
+	std::from_chars_result res = std::from_chars (buf, buf+len, x);
+	if (len == 0 || res.ec != std::errc() || res.ptr != buf+len)
+		throw std::runtime_error (" Bad request message. Coordinate expected.\n");
+}
+
+template<> inline void get_text<char> ( std::istream& in, char& x ) {
+	in >> x;
+}
+
+template<class T> static void stream2vec (std::istream& in,
+					void* vec,
+					int dims,
+					char delimiter) {
+	for (int j = 0; j < dims; ++j) {
+		::get_text<T> (in, reinterpret_cast<T*> (vec)[j]);
+
+		if (delimiter != '\n' && delimiter != '\r' && delimiter != '\t' && delimiter != ' ') {
+			if (j < dims - 1) {
+				if (::skip_blanks (in) != delimiter)
+					throw std::runtime_error(std::string (" Bad request message. Expected ") + delimiter);
+				in.rdbuf()->sbumpc();
+			}
+		}
+	}
+}
+
+template<class T> static void vec2stream (std::ostream& out,
+					void* vec,
+					int dims,
+					char delimiter) {
+	for (int j = 0; j < dims; ++j) {
+		::put_text<T> (out, reinterpret_cast<T*> (vec)[j]);
+
+		if (j < dims - 1)
+			out << delimiter;
+	}
+}
+
+/*** binary ***/
+
+/* copies n bytes in little-endian order whatever the order of the host */
+inline void copy_le ( char* dst, const char* src, size_t n ) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	for (size_t i = 0; i < n; ++i)
+		dst[i] = src[n-1-i];
+#else
+	memcpy (dst, src, n);
+#endif
+}
+
+template<class T> static void put_key ( std::string& out, const T* key, int dims ) {
+	size_t at = out.size();
+	out.resize (at + dims*sizeof(T));
+	for (int j = 0; j < dims; ++j)
+		::copy_le (&out[at + j*sizeof(T)], reinterpret_cast<const char*> (key+j), sizeof(T));
+}
+
+inline void put_value ( std::string& out, const char* val, size_t len ) {
+	char prefix [4];
+	uint32_t n = len;
+	::copy_le (prefix, reinterpret_cast<const char*> (&n), 4);
+	out.append (prefix, 4);
+	out.append (val, len);
+}
+
+/* reads a key at pos of msg and moves pos past it */
+template<class T> static void get_key ( const std::string& msg, size_t& pos, T* key, int dims ) {
+	if (msg.size() - pos < dims*sizeof(T))
+		throw std::runtime_error (" Bad binary message. Key truncated.\n");
+	for (int j = 0; j < dims; ++j)
+		::copy_le (reinterpret_cast<char*> (key+j), msg.data() + pos + j*sizeof(T), sizeof(T));
+	pos += dims*sizeof(T);
+}
+
+inline void get_value ( const std::string& msg, size_t& pos, std::string& val ) {
+	uint32_t n;
+	if (msg.size() - pos < 4)
+		throw std::runtime_error (" Bad binary message. Value truncated.\n");
+	::copy_le (reinterpret_cast<char*> (&n), msg.data() + pos, 4);
+	pos += 4;
+	if (msg.size() - pos < n)
+		throw std::runtime_error (" Bad binary message. Value truncated.\n");
+	val.assign (msg, pos, n);
+	pos += n;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+
+#include "ConnectionCache.h"
+#include <sys/time.h>
+#include <stdexcept>
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+ConnectionCache::ConnectionCache ( unsigned cap, double idle_secs, int timeout )
+	: size(0), capacity(cap), idle_seconds(idle_secs), timeout_ms(timeout), last_sweep(0) {
+	pthread_mutex_init (&lock, 0);
+}
+
+ConnectionCache::~ConnectionCache () {
+	clear ();
+	pthread_mutex_destroy (&lock);
+}
+
+bool ConnectionCache::deliver ( const std::string& host, int port, const std::string& msg ) {
+	Key key (host, port);
+
+	/* a warm connection may have been dropped by the requester meanwhile, then a new one is tried */
+	for (ClientSocket* sock = acquire (key); ; sock = 0) {
+		bool fresh = sock == 0;
+		try {
+			if (fresh)
+				sock = new ClientSocket (host, port, timeout_ms);
+			*sock << msg;
+			release (key, sock);
+			return true;
+		} catch (std::exception& e) {
+			delete sock;
+			if (fresh)
+				return false;
+		}
+	}
+}
+
+void ConnectionCache::clear () {
+	pthread_mutex_lock (&lock);
+	for (std::map<Key, std::vector<Entry> >::iterator mi=idle.begin(); mi!=idle.end(); ++mi)
+		for (unsigned i=0; i<mi->second.size(); ++i)
+			delete mi->second[i].sock;
+	idle.clear ();
+	size = 0;
+	pthread_mutex_unlock (&lock);
+}
+
+ClientSocket* ConnectionCache::acquire ( const Key& key ) {
+	ClientSocket* sock = 0;
+
+	pthread_mutex_lock (&lock);
+	sweep (now ());
+	std::map<Key, std::vector<Entry> >::iterator mi = idle.find (key);
+	while (sock == 0 && mi != idle.end() && !mi->second.empty()) {
+		sock = mi->second.back().sock;
+		mi->second.pop_back ();
+		--size;
+		if (!sock->is_alive ()) {
+			delete sock;
+			sock = 0;
+		}
+	}
+	if (mi != idle.end() && mi->second.empty())
+		idle.erase (mi);
+	pthread_mutex_unlock (&lock);
+	return sock;
+}
+
+void ConnectionCache::release ( const Key& key, ClientSocket* sock ) {
+	Entry entry;
+	entry.sock = sock;
+	entry.last_used = now ();
+
+	pthread_mutex_lock (&lock);
+	if (size >= capacity)
+		evict ();
+	if (capacity > 0) {
+		idle[key].push_back (entry);
+		++size;
+	}else{
+		delete sock;
+	}
+	pthread_mutex_unlock (&lock);
+}
+
+void ConnectionCache::sweep ( double t ) {
+	/* at most once a second, and only past the idle time of a connection */
+	if (t - last_sweep < 1)
+		return;
+	last_sweep = t;
+
+	for (std::map<Key, std::vector<Entry> >::iterator mi=idle.begin(); mi!=idle.end(); ) {
+		std::vector<Entry>& entries = mi->second;
+		unsigned kept = 0;
+		for (unsigned i=0; i<entries.size(); ++i) {
+			if (t - entries[i].last_used > idle_seconds) {
+				delete entries[i].sock;
+				--size;
+			}else{
+				entries[kept++] = entries[i];
+			}
+		}
+		entries.resize (kept);
+
+		if (entries.empty())
+			idle.erase (mi++);
+		else
+			++mi;
+	}
+}
+
+void ConnectionCache::evict () {
+	std::map<Key, std::vector<Entry> >::iterator oldest = idle.end();
+	for (std::map<Key, std::vector<Entry> >::iterator mi=idle.begin(); mi!=idle.end(); ++mi)
+		if (oldest == idle.end() || mi->second.front().last_used < oldest->second.front().last_used)
+			oldest = mi;
+
+	if (oldest == idle.end())
+		return;
+
+	/* entries of a key are released in time order, so the front is the oldest */
+	delete oldest->second.front().sock;
+	oldest->second.erase (oldest->second.begin());
+	--size;
+	if (oldest->second.empty())
+		idle.erase (oldest);
+}
@@ -0,0 +1,80 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+
+#ifndef CONNECTIONCACHE_H_
+#define CONNECTIONCACHE_H_
+
+#include "ClientSocket.h"
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Connections to requesters kept open between answers, keyed by host and
+ * port. A connection is taken out while a message is sent on it and put
+ * back afterwards, so concurrent senders to one requester hold one each.
+ * At most capacity connections stay idle, the least recently used going
+ * first, and none for longer than idle seconds.
+ */
+class ConnectionCache {
+	typedef std::pair<std::string,int> Key;
+
+	struct Entry {
+		ClientSocket* sock;
+		double last_used;
+	};
+
+	std::map<Key, std::vector<Entry> > idle;
+	unsigned size;
+
+	unsigned capacity;
+	double idle_seconds;
+	int timeout_ms;
+	double last_sweep;
+
+	pthread_mutex_t lock;
+
+	ConnectionCache (const ConnectionCache&);
+	ConnectionCache& operator = (const ConnectionCache&);
+
+public:
+	ConnectionCache ( unsigned cap=64, double idle_secs=30, int timeout=1000 );
+	~ConnectionCache ();
+
+	/* sends msg to host:port on a warm connection if any, returns whether it left */
+	bool deliver ( const std::string& host, int port, const std::string& msg );
+
+	/* closes every idle connection */
+	void clear ();
+
+private:
+	/* returns an idle connection to key that is still alive, or 0 */
+	ClientSocket* acquire ( const Key& key );
+	void release ( const Key& key, ClientSocket* sock );
+
+	/* closes the connections idle for too long, the lock held */
+	void sweep ( double now );
+
+	/* closes the least recently used connection, the lock held */
+	void evict ();
+};
+
+#endif
@@ -19,286 +19,908 @@
 
 #include "Dtree.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cfloat>
 #include <cmath>
+#include <functional>
 #include <iostream>
-#include <typeinfo>
-
-template<class T> bool TreeNode<T>::operator == ( T *nd_key ) const {
-	for (int j=0; j<dims ; ++j)
-		if (key[j] != nd_key[j])
-			return false;
-	return true;
+#include <limits>
+#include <queue>
+#include <unistd.h>
+
+/* groups smaller than this are not worth a thread of their own */
+#define BULK_LOAD_GRAIN 32768
+
+template<class T, int D> struct BulkLoadTask {
+	Dtree<T,D>* tree;
+	std::pair<T*,Value*>* data;
+	unsigned lo;
+	unsigned hi;
+	int depth;
+	int threads;
+	unsigned subtree;
+};
+
+template<class T, int D> void* bulk_load_worker ( void* args ) {
+	BulkLoadTask<T,D>* task = static_cast<BulkLoadTask<T,D>*> (args);
+	task->subtree = task->tree->bulk_load ( task->data, task->lo, task->hi, task->depth, task->threads );
+	return 0;
 }
 
-template<class T> inline bool TreeNode<T>::operator != ( T *nd_key ) const {
-	return !(*this == nd_key);
-}
+template<class T> class key_comparison {
+	int dim;
+public:
+	key_comparison ( int d ) : dim(d) {}
+
+	bool operator () ( const std::pair<T*,Value*>& left, const std::pair<T*,Value*>& right ) const {
+		return left.first[dim] < right.first[dim];
+	}
+};
 
-template<class T> inline bool TreeNode<T>::operator >= ( T *nd_key ) const {
-	for (int j=0; j<dims ; ++j)
-		if (key[j] < nd_key[j])
+template<class T, int D> inline bool Dtree<T,D>::dominates ( const T *pt, const T *key ) const {
+	for (int j=0; j<dimensions() ; ++j)
+		if (pt[j] < key[j])
 			return false;
 	return true;
 }
 
-template<class T> inline bool TreeNode<T>::operator <= ( T *nd_key ) const {
-	for (int j=0; j<dims ; ++j)
-		if (key[j] > nd_key[j])
+template<class T, int D> inline bool Dtree<T,D>::dominated ( const T *pt, const T *key ) const {
+	for (int j=0; j<dimensions() ; ++j)
+		if (pt[j] > key[j])
 			return false;
 	return true;
 }
 
-template<class T> double TreeNode<T>::dist ( T *nd_key ) const {
-	double dist = 0.0;
-
-	assert (sizeof(char)==1);
-	char *key_hack=reinterpret_cast<char*>(key);
-	char *nd_key_hack=reinterpret_cast<char*>(nd_key);
-
-	for (int j=0; j<dims ; ++j)
-		if ( typeid (T) == typeid (char) ||
-			typeid (T) == typeid (short int) ||
-			typeid (T) == typeid (unsigned short int) ||
-			typeid (T) == typeid (int) ||
-			typeid (T) == typeid (unsigned int) ||
-			typeid (T) == typeid (long int) ||
-			typeid (T) == typeid (unsigned long int) ||
-			typeid (T) == typeid (float) ||
-			typeid (T) == typeid (double) ) {
-			dist += pow ( *(double*)(key_hack+j*sizeof(T)) - *(double*)(nd_key_hack+j*sizeof(T)), 2);
-		}else
-			return 0;
 
-	return sqrt (dist);
+/*
+ * returns balance
+ */
+template<class T, int D> inline orthant_t Dtree<T,D>::orthant ( const T *pt, const T *key ) const {
+	orthant_t cmp = 0;
+
+	for (int j=0; j<dimensions(); ++j)
+		if ( key [j] >= pt [j] )
+			cmp |= (1ull<<j);
+	return cmp;
+}
+
+template<class T, int D> inline void Dtree<T,D>::gather ( unsigned nd, unsigned slot, T *key ) const {
+	for (int j=0; j<dimensions(); ++j)
+		key[j] = column(nd,j)[slot];
 }
 
+template<class T, int D> inline unsigned Dtree<T,D>::find ( unsigned nd, const T *key ) const {
+	unsigned first;
+	unsigned count = snapshot ( nd, first );
+	for (unsigned slot=0; slot<count; ++slot) {
+		if ( load (values.at(nd)[slot]) == 0 )
+			continue;
+
+		int j = 0;
+		while ( j<dimensions() && column(nd,j)[slot] == key[j] )
+			++j;
+		if ( j == dimensions() )
+			return slot;
+	}
+	return bucket;
+}
 
 /*
- * returns balance
+ * Sons hang from their parent in a digital search tree that branches on
+ * orthant bit #k at depth k, so a son is found within dims steps.
  */
-template<class T> inline int TreeNode<T>::operator % ( T *nd_key ) const {
-	int cmp = 0;
-	int offset = 1;
-
-	for (int j=0; j<dims; ++j) {
-		if ( nd_key [j] >= key [j] )
-			cmp += offset;
-		offset = (offset<<1);
+template<class T, int D> inline unsigned* Dtree<T,D>::locate ( unsigned* link, orthant_t pos ) const {
+	for (int bit=0; load (*link) != 0 && node(load (*link)).pos != pos; ++bit)
+		link = &node(load (*link)).sibling [ (pos>>bit) & 1 ];
+	return link;
+}
+
+/*
+ * A spill publishes the sons before it drops the count to 1, so the count
+ * is loaded first: once it reads 1 the sons are visible as well, while a
+ * count still above 1 is served by the bucket columns, which a spill
+ * leaves untouched, and its sons are not followed.
+ */
+template<class T, int D> inline unsigned Dtree<T,D>::snapshot ( unsigned nd, unsigned& first ) const {
+	unsigned count = load (node(nd).count);
+	first = count == 1 ? load (node(nd).son) : 0;
+	return count;
+}
+
+template<class T, int D> inline unsigned Dtree<T,D>::son ( unsigned nd, orthant_t pos ) const {
+	return load ( *locate ( &node(nd).son, pos ) );
+}
+
+template<class T, int D> void Dtree<T,D>::sons ( unsigned nd, std::vector<unsigned>& ans ) const {
+	siblings ( load (node(nd).son), ans );
+}
+
+template<class T, int D> void Dtree<T,D>::siblings ( unsigned first, std::vector<unsigned>& ans ) const {
+	unsigned start = ans.size();
+	if ( first != 0 )
+		ans.push_back ( first );
+
+	for (unsigned i=start; i<ans.size(); ++i)
+		for (int j=0; j<2; ++j)
+			if ( load (node(ans[i]).sibling[j]) != 0 )
+				ans.push_back ( load (node(ans[i]).sibling[j]) );
+}
+
+/* the arenas are always allocated together, so they hand out equal indices */
+template<class T, int D> unsigned Dtree<T,D>::alloc_node () {
+	pthread_mutex_lock (&alloc_lock);
+	unsigned nd = nodes.alloc ();
+	pivots.alloc ();
+	columns.alloc ();
+	values.alloc ();
+	boxes.alloc ();
+	sums.alloc ();
+	pthread_mutex_unlock (&alloc_lock);
+	return nd;
+}
+
+template<class T, int D> inline void Dtree<T,D>::release_node ( unsigned nd ) {
+	memset ( &node(nd), 0, sizeof(TreeNode<T>) );
+	nodes.release (nd);
+	pivots.release (nd);
+	columns.release (nd);
+	values.release (nd);
+	boxes.release (nd);
+	sums.release (nd);
+}
+
+/* the box is set before the total lets readers trust it */
+template<class T, int D> inline void Dtree<T,D>::enclose ( unsigned nd, const T *key ) {
+	unsigned total = node(nd).total;
+	for (int j=0; j<dimensions(); ++j) {
+		if ( total == 0 || key[j] < box_lo(nd)[j] )
+			publish ( box_lo(nd)[j], key[j] );
+		if ( total == 0 || key[j] > box_hi(nd)[j] )
+			publish ( box_hi(nd)[j], key[j] );
+		publish ( sum(nd)[j], total == 0 ? (double) key[j] : sum(nd)[j] + key[j] );
 	}
-	return cmp;
+	publish ( node(nd).total, total + 1 );
 }
 
-template<class T> inline bool TreeNode<T>::isCompatible ( TreeNode &nd ) const {
-	for (int j=0; j<sons; ++j)
-		if ( this->son[j] != 0 && nd % this->son[j]->key != j )
-			return false;
-	return true;
+/*
+ * a box only shrinks if the key lay on its border, and an ancestor only
+ * if the box of its son shrank, so the walk up stops early
+ */
+template<class T, int D> void Dtree<T,D>::retract ( const T *key ) {
+	bool shrinking = true;
+	for (unsigned i=path.size(); i-- > 0; ) {
+		unsigned nd = path[i];
+		unsigned total = node(nd).total - 1;
+		for (int j=0; j<dimensions(); ++j)
+			publish ( sum(nd)[j], total == 0 ? 0.0 : sum(nd)[j] - key[j] );
+		publish ( node(nd).total, total );
+
+		if ( ! shrinking || total == 0 )
+			continue;
+
+		bool border = false;
+		for (int j=0; j<dimensions() && !border; ++j)
+			border = key[j] == box_lo(nd)[j] || key[j] == box_hi(nd)[j];
+		shrinking = border && shrink (nd);
+	}
 }
 
-template<class T> Dtree<T>::~Dtree<T>() {
-	if ( root != 0 )
-		dropTree ( *root );
+template<class T, int D> bool Dtree<T,D>::shrink ( unsigned nd ) {
+	T lo [MAXDIMS];
+	T hi [MAXDIMS];
+	for (int j=0; j<dimensions(); ++j) {
+		lo[j] = std::numeric_limits<T>::max();
+		hi[j] = std::numeric_limits<T>::lowest();
+	}
+
+	for (unsigned s=0; s<node(nd).count; ++s) {
+		if ( values.at(nd)[s] == 0 )
+			continue;
+		for (int j=0; j<dimensions(); ++j) {
+			lo[j] = std::min (lo[j], column(nd,j)[s]);
+			hi[j] = std::max (hi[j], column(nd,j)[s]);
+		}
+	}
+
+	std::vector<unsigned> children;
+	sons ( nd, children );
+	for (unsigned i=0; i<children.size(); ++i) {
+		if ( node(children[i]).total == 0 )
+			continue;
+		for (int j=0; j<dimensions(); ++j) {
+			lo[j] = std::min (lo[j], box_lo(children[i])[j]);
+			hi[j] = std::max (hi[j], box_hi(children[i])[j]);
+		}
+	}
+
+	bool changed = false;
+	for (int j=0; j<dimensions(); ++j) {
+		if ( lo[j] != box_lo(nd)[j] ) {
+			publish ( box_lo(nd)[j], lo[j] );
+			changed = true;
+		}
+		if ( hi[j] != box_hi(nd)[j] ) {
+			publish ( box_hi(nd)[j], hi[j] );
+			changed = true;
+		}
+	}
+	return changed;
 }
 
-template<class T> inline void Dtree<T>::dropTree( TreeNode<T> &nd ) const {
-	for (int j=0; j<sons; ++j)
-		if ( nd.son[j] != 0 )
-			dropTree ( *nd.son[j] );
+/* tree-nodes off the tree only, as the summary is built up from zero */
+template<class T, int D> void Dtree<T,D>::summarize ( unsigned nd ) {
+	T key [MAXDIMS];
+	for (unsigned s=0; s<node(nd).count; ++s) {
+		if ( values.at(nd)[s] == 0 )
+			continue;
+		gather ( nd, s, key );
+		enclose ( nd, key );
+	}
+
+	std::vector<unsigned> children;
+	sons ( nd, children );
+	for (unsigned i=0; i<children.size(); ++i) {
+		unsigned son = children[i];
+		if ( node(son).total == 0 )
+			continue;
+
+		for (int j=0; j<dimensions(); ++j) {
+			if ( node(nd).total == 0 || box_lo(son)[j] < box_lo(nd)[j] )
+				box_lo(nd)[j] = box_lo(son)[j];
+			if ( node(nd).total == 0 || box_hi(son)[j] > box_hi(nd)[j] )
+				box_hi(nd)[j] = box_hi(son)[j];
+			sum(nd)[j] += sum(son)[j];
+		}
+		node(nd).total += node(son).total;
+	}
+}
+
+/* the slot is filled before the count lets readers see it */
+template<class T, int D> inline void Dtree<T,D>::append ( unsigned nd, const T *key, Value* val ) {
+	unsigned slot = node(nd).count;
+	for (int j=0; j<dimensions(); ++j)
+		column(nd,j)[slot] = key[j];
+	values.at(nd)[slot] = val;
+
+	if ( slot == 0 )
+		memcpy ( pivot(nd), key, dimensions()*sizeof(T) );
+	publish ( node(nd).count, slot + 1 );
+}
+
+/*
+ * the sons are built off the tree and published at once, so readers see
+ * either the whole bucket without sons or the pivot along with them
+ */
+template<class T, int D> void Dtree<T,D>::spill ( unsigned nd ) {
+	T key [MAXDIMS];
+	unsigned first = 0;
+
+	for (unsigned i=1; i<node(nd).count; ++i) {
+		/* tombstones past the pivot are dropped on the way */
+		if ( values.at(nd)[i] == 0 ) {
+			publish ( tombstones, tombstones - 1 );
+			continue;
+		}
+
+		gather ( nd, i, key );
+		orthant_t pos = orthant ( pivot(nd), key );
+		unsigned* link = locate ( &first, pos );
+		if ( *link == 0 ) {
+			unsigned leaf = alloc_node ();
+			node(leaf).pos = pos;
+			*link = leaf;
+		}
+		enclose ( *link, key );
+		append ( *link, key, values.at(nd)[i] );
+	}
+
+	publish ( node(nd).son, first );
+	publish ( node(nd).count, 1u );
+}
 
-	delete &nd;
+template<class T, int D> Dtree<T,D>::~Dtree () {
+	dropTree ();
+	pthread_mutex_destroy (&alloc_lock);
 }
 
-template<class T> TreeNode<T>* Dtree<T>::search ( T* query ) const {
-	if ( root == 0 )
+/* releases every value with a linear scan of the arena, then its slabs */
+template<class T, int D> inline void Dtree<T,D>::dropTree() {
+	for (unsigned i=1; i<nodes.end(); ++i)
+		for (unsigned j=0; j<node(i).count; ++j)
+			ValueStore::release ( values.at(i)[j] );
+	release ();
+}
+
+template<class T, int D> void Dtree<T,D>::release () {
+	nodes.clear ();
+	pivots.clear ();
+	columns.clear ();
+	values.clear ();
+	boxes.clear ();
+	sums.clear ();
+	root = 0;
+	node_counter = 0;
+	tombstones = 0;
+}
+
+template<class T, int D> void Dtree<T,D>::bulk_load ( TupleArray<T>& data ) {
+	scan (data);
+	release ();
+
+	if ( data.size() == 0 )
+		return;
+
+	std::vector<std::pair<T*,Value*> > tuples (data.size());
+	for (unsigned i=0; i<data.size(); ++i)
+		tuples[i] = std::pair<T*,Value*> (data.key(i), data.val(i));
+
+	node_counter = tuples.size();
+
+	int threads = tuples.size() > BULK_LOAD_GRAIN ? sysconf (_SC_NPROCESSORS_ONLN) : 1;
+	root = bulk_load ( &tuples[0], 0, tuples.size(), 0, threads < 1 ? 1 : threads );
+}
+
+/* returns the root of a tree holding data[lo..hi) */
+template<class T, int D> unsigned Dtree<T,D>::bulk_load ( std::pair<T*,Value*>* data, unsigned lo, unsigned hi, int depth, int threads ) {
+	if ( lo == hi )
 		return 0;
 
-	for (TreeNode<T>*ptr = root; ptr != 0; ptr = ptr->son[ *ptr % query ])
-		if ( *ptr == query )
-			return ptr;
-	return 0;
+	unsigned subtree = alloc_node ();
+
+	/* groups that fit a bucket become leaves */
+	if ( hi - lo <= bucket ) {
+		for (unsigned i=lo; i<hi; ++i)
+			append ( subtree, data[i].first, data[i].second );
+		summarize ( subtree );
+		return subtree;
+	}
+
+	key_comparison<T> cmp ( depth % dimensions() );
+	std::nth_element ( data + lo, data + lo + (hi-lo)/2, data + hi, cmp );
+	std::swap ( data[lo], data[lo + (hi-lo)/2] );
+
+	append ( subtree, data[lo].first, data[lo].second );
+
+	std::vector<std::pair<pthread_t,void*> > workers;
+	bulk_load ( data, lo+1, hi, depth+1, threads, subtree, 0, hi-lo, workers );
+
+	for (unsigned j=0; j<workers.size(); ++j) {
+		BulkLoadTask<T,D>* task = static_cast<BulkLoadTask<T,D>*> (workers[j].second);
+		pthread_join ( workers[j].first, 0 );
+		adopt ( subtree, task->subtree );
+		delete task;
+	}
+	summarize ( subtree );
+	return subtree;
 }
 
-template<class T> void Dtree<T>::push ( T *new_key , char* val) {
-	TreeNode<T> *new_node = new TreeNode<T> ( dims, new_key, val );
+/*
+ * partitions data[lo..hi) by orthant bit #bit of the parent's key and builds
+ * a son for each group of equal orthant, large groups on a thread of their own
+ */
+template<class T, int D> void Dtree<T,D>::bulk_load ( std::pair<T*,Value*>* data, unsigned lo, unsigned hi, int depth, int threads,
+		unsigned parent, int bit, unsigned total, std::vector<std::pair<pthread_t,void*> >& workers ) {
 
-	++node_counter;
+	if ( lo == hi )
+		return;
+
+	if ( bit < dimensions() && hi - lo > 1 ) {
+		T pivot = this->pivot(parent)[bit];
+		unsigned mid = lo;
+		for (unsigned i=lo; i<hi; ++i)
+			if ( data[i].first[bit] < pivot )
+				std::swap ( data[i], data[mid++] );
 
-	if (root == 0) {
-		root = new_node;
+		bulk_load ( data, lo, mid, depth, threads, parent, bit+1, total, workers );
+		bulk_load ( data, mid, hi, depth, threads, parent, bit+1, total, workers );
 		return;
 	}
 
-	TreeNode<T> *ptr=root;
-	int cmp = *ptr % new_key;
+	int share = (int) ((unsigned long long) threads * (hi-lo) / total);
+	if ( share >= 1 && hi - lo > BULK_LOAD_GRAIN ) {
+		BulkLoadTask<T,D>* task = new BulkLoadTask<T,D>;
+		task->tree = this;
+		task->data = data;
+		task->lo = lo;
+		task->hi = hi;
+		task->depth = depth;
+		task->threads = share;
+		task->subtree = 0;
+
+		pthread_t thread;
+		if ( pthread_create ( &thread, 0, bulk_load_worker<T,D>, task ) == 0 ) {
+			workers.push_back ( std::pair<pthread_t,void*> (thread, task) );
+			return;
+		}
+		delete task;
+	}
+	adopt ( parent, bulk_load ( data, lo, hi, depth, 1 ) );
+}
+
+/*
+ * counts tuples and tombstones of every subtree bottom-up, then rebuilds
+ * top-down the first subtrees found degraded on each path
+ */
+template<class T, int D> void Dtree<T,D>::compact ( double ratio, std::vector<unsigned>& retired ) {
+	if ( root == 0 || tombstones == 0 )
+		return;
 
-	while ( ptr -> son [cmp] != 0 ) {
-		ptr = ptr -> son [cmp];
-		cmp = *ptr % new_key;
+	std::vector<unsigned> order (1, root);
+	std::vector<unsigned> parent (1, 0);
+	for (unsigned i=0; i<order.size(); ++i) {
+		sons ( order[i], order );
+		parent.resize ( order.size(), order[i] );
 	}
 
-	new_node -> parent = ptr;
-	ptr -> son [cmp] = new_node;
+	std::vector<unsigned> total (nodes.end(), 0);
+	std::vector<unsigned> dead (nodes.end(), 0);
+	for (unsigned i=order.size(); i-- > 0; ) {
+		unsigned nd = order[i];
+		total[nd] += node(nd).count;
+		for (unsigned j=0; j<node(nd).count; ++j)
+			if ( values.at(nd)[j] == 0 )
+				++dead[nd];
+
+		total[parent[i]] += total[nd];
+		dead[parent[i]] += dead[nd];
+	}
+
+	compact ( &root, ratio, total, dead, retired );
 }
 
-template<class T> char* Dtree<T>::pop ( T *query ) {
-	TreeNode<T>* nd = search ( query );
+/* siblings come first, since the links to them go away along with nd */
+template<class T, int D> void Dtree<T,D>::compact ( unsigned* link, double ratio, const std::vector<unsigned>& total,
+		const std::vector<unsigned>& dead, std::vector<unsigned>& retired ) {
+
+	unsigned nd = *link;
 	if ( nd == 0 )
-		return 0;
+		return;
 
-	char* ret_val = nd->val;
+	compact ( &node(nd).sibling[0], ratio, total, dead, retired );
+	compact ( &node(nd).sibling[1], ratio, total, dead, retired );
+
+	if ( dead[nd] > 0 && dead[nd] >= ratio * total[nd] )
+		rebuild ( link, retired );
+	else
+		compact ( &node(nd).son, ratio, total, dead, retired );
+}
 
-	TreeNode<T>* substitute = min_leaf ( nd->son[sons-1] );
-	if ( substitute == 0 || !nd->isCompatible(*substitute) )
-		for (int j=sons-2; j>=0; --j) {
-			substitute =  max_leaf ( nd->son[j] );
-			if ( substitute != 0 && nd->isCompatible(*substitute) )
-				break;
+/*
+ * the live tuples lie in the orthant of nd, so their median may take its
+ * place among the siblings; an empty leaf keeps the place of an emptied
+ * subtree, and readers still inside the old one find it intact
+ */
+template<class T, int D> void Dtree<T,D>::rebuild ( unsigned* link, std::vector<unsigned>& retired ) {
+	unsigned nd = *link;
+
+	std::vector<unsigned> subtree (1, nd);
+	for (unsigned i=0; i<subtree.size(); ++i)
+		sons ( subtree[i], subtree );
+
+	TupleArray<T> data (dimensions());
+	T key [MAXDIMS];
+	for (unsigned i=0; i<subtree.size(); ++i)
+		for (unsigned j=0; j<node(subtree[i]).count; ++j) {
+			if ( values.at(subtree[i])[j] == 0 ) {
+				publish ( tombstones, tombstones - 1 );
+				continue;
+			}
+			gather ( subtree[i], j, key );
+			data ( key, values.at(subtree[i])[j] );
 		}
+	retired.insert ( retired.end(), subtree.begin(), subtree.end() );
 
-	if ( substitute != 0 ) {
-		for (int j=0; j<dims; ++j)
-			nd->key[j] = substitute->key[j];
+	unsigned top;
+	if ( data.size() > 0 ) {
+		std::vector<std::pair<T*,Value*> > tuples (data.size());
+		for (unsigned i=0; i<data.size(); ++i)
+			tuples[i] = std::pair<T*,Value*> (data.key(i), data.val(i));
 
-		for (int j=0; j<sons; ++j)
-			if ( substitute->parent->son[j] == substitute ) {
-				substitute->parent->son[j] = 0;
-				break;
-			}
-		//substitute->parent->son [ *substitute->parent % substitute->key ] = 0;
-		delete substitute;
+		top = bulk_load ( &tuples[0], 0, tuples.size(), 0, 1 );
 	}else{
-		if ( nd == root ) {
-			root = 0;
-		}else{
-			for (int j=0; j<sons; ++j)
-				if (nd->parent->son[j] == nd) {
-					nd->parent->son[j] = 0;
-					break;
-				}
-			//nd->parent->son [ *nd->parent % query ] = 0;
-		}
-		delete nd;
+		top = alloc_node ();
+		memcpy ( pivot(top), pivot(nd), dimensions()*sizeof(T) );
 	}
-	--node_counter;
-	return ret_val;
+
+	node(top).pos = node(nd).pos;
+	node(top).sibling[0] = node(nd).sibling[0];
+	node(top).sibling[1] = node(nd).sibling[1];
+	publish ( *link, top );
+}
+
+template<class T, int D> inline void Dtree<T,D>::adopt ( unsigned parent, unsigned subtree ) {
+	node(subtree).pos = orthant ( pivot(parent), pivot(subtree) );
+	*locate ( &node(parent).son, node(subtree).pos ) = subtree;
 }
 
-template<class T> void Dtree<T>::range ( T *lo, T *hi, std::vector<std::pair<T*,char*>*>& ans ) const {
-	if ( root != 0 )
-		range ( lo, hi, ans, *root );
+/* the pivot of a leaf is left alone, an emptied one may be taking a new pivot */
+template<class T, int D> Value** Dtree<T,D>::search ( T* query ) const {
+	for (unsigned ptr = load (root); ptr != 0; ptr = son ( ptr, orthant ( pivot(ptr), query ) )) {
+		unsigned slot = find ( ptr, query );
+		if ( slot < bucket )
+			return values.at(ptr) + slot;
+		if ( load (node(ptr).son) == 0 )
+			break;
+	}
+	return 0;
 }
 
-template<class T> inline void Dtree<T>::range ( T *lo, T *hi, std::vector<std::pair<T*,char*>*>& ans, TreeNode<T>& subtree ) const {
-	if ( subtree >= lo && subtree <= hi )
-		ans.push_back( new std::pair<T*,char*> ( subtree.key, subtree.val ) );
+template<class T, int D> void Dtree<T,D>::push ( T *new_key , Value* val) {
+	publish ( node_counter, node_counter + 1 );
+
+	orthant_t pos = 0;
+	unsigned* link = &root;
+	while ( *link != 0 ) {
+		unsigned nd = *link;
+		enclose ( nd, new_key );
 
-	for (int j = subtree % lo; j <= subtree % hi; ++j)
-		if ( subtree.son[j] != 0 )
-			range ( lo, hi, ans, *subtree.son[j]);
+		if ( node(nd).son == 0 && node(nd).count < bucket ) {
+			append ( nd, new_key, val );
+			return;
+		}
+		if ( node(nd).son == 0 && bucket > 1 )
+			spill ( nd );
+
+		pos = orthant ( pivot(nd), new_key );
+		link = locate ( &node(nd).son, pos );
+	}
+
+	unsigned new_node = alloc_node ();
+	node(new_node).pos = pos;
+	enclose ( new_node, new_key );
+	append ( new_node, new_key, val );
+	publish ( *link, new_node );
 }
 
-template<class T> double Dtree<T>::nearest ( T *center, unsigned K, double radius, std::vector<std::pair<double,std::pair<T*,char*>*>*> &ans ) const {
-	if ( root == 0 )
-		return radius;
+/*
+ * the path of push is the path of search, so the key is met on the way if
+ * indexed; the summaries along the path are updated once it is known new
+ */
+template<class T, int D> Value** Dtree<T,D>::insert ( T *new_key , Value* val) {
+	path.clear ();
+
+	orthant_t pos = 0;
+	unsigned* link = &root;
+	while ( *link != 0 ) {
+		unsigned nd = *link;
+		path.push_back (nd);
+
+		unsigned slot = find ( nd, new_key );
+		if ( slot < bucket )
+			return values.at(nd) + slot;
+
+		if ( node(nd).son == 0 && node(nd).count < bucket ) {
+			publish ( node_counter, node_counter + 1 );
+			for (unsigned i=0; i<path.size(); ++i)
+				enclose ( path[i], new_key );
+			append ( nd, new_key, val );
+			return 0;
+		}
+		if ( node(nd).son == 0 && bucket > 1 )
+			spill ( nd );
 
-	std::priority_queue<std::pair<double,std::pair<T*,char*>*>*, std::vector<std::pair<double,std::pair<T*,char*>*>*>, dist_comparison<T> > sorted ( dist_comparison<T>(false) );
+		pos = orthant ( pivot(nd), new_key );
+		link = locate ( &node(nd).son, pos );
+	}
 
-	nearest ( center, K, radius, sorted, *root );  // recursive
+	publish ( node_counter, node_counter + 1 );
+	unsigned new_node = alloc_node ();
+	node(new_node).pos = pos;
+	path.push_back (new_node);
+	for (unsigned i=0; i<path.size(); ++i)
+		enclose ( path[i], new_key );
+	append ( new_node, new_key, val );
+	publish ( *link, new_node );
+	return 0;
+}
 
-	if ( sorted.empty() )
-		return radius;
+/* the descent of search, recording the path whose summaries lose the key */
+template<class T, int D> Value* Dtree<T,D>::erase ( T *query ) {
+	path.clear ();
+	for (unsigned ptr = root; ptr != 0; ptr = son ( ptr, orthant ( pivot(ptr), query ) )) {
+		path.push_back (ptr);
+
+		unsigned slot = find ( ptr, query );
+		if ( slot < bucket ) {
+			Value* ret_val = values.at(ptr)[slot];
+			publish ( values.at(ptr)[slot], (Value*) 0 );
+			retract ( query );
+
+			publish ( node_counter, node_counter - 1 );
+			publish ( tombstones, tombstones + 1 );
+			return ret_val;
+		}
+		if ( node(ptr).son == 0 )
+			break;
+	}
+	return 0;
+}
+
+template<class T, int D> template<class V> void Dtree<T,D>::range ( T *lo, T *hi, V& visitor ) const {
+	unsigned top = load (root);
+	if ( top != 0 )
+		range ( lo, hi, visitor, top );
+}
 
-	double Rmax = 0;
+/* the total is loaded first, as writers set the box before publishing it */
+template<class T, int D> bool Dtree<T,D>::summarized ( Aggregate<T>& acc, unsigned subtree, const T *lo, const T *hi ) const {
+	unsigned total = load (node(subtree).total);
+	if ( total == 0 )
+		return true;
+
+	T box [2*MAXDIMS];
+	bool enclosed = true;
+	for (int j=0; j<dimensions(); ++j) {
+		box[j] = load (box_lo(subtree)[j]);
+		box[dimensions()+j] = load (box_hi(subtree)[j]);
+		if ( box[j] > hi[j] || box[dimensions()+j] < lo[j] )
+			return true;
+		if ( box[j] < lo[j] || box[dimensions()+j] > hi[j] )
+			enclosed = false;
+	}
+	if ( ! enclosed )
+		return false;
 
-	while ( ! sorted.empty() ) {
-		ans.push_back( new std::pair<double,std::pair<T*,char*>*> ( sorted.top()->first, sorted.top()->second ) );
+	double sums [MAXDIMS];
+	for (int j=0; j<dimensions(); ++j)
+		sums[j] = load (sum(subtree)[j]);
+	acc.merge ( total, sums, box, box + dimensions() );
+	return true;
+}
 
-		if ( sorted.top()->first > Rmax )
-			Rmax =  sorted.top()->first;
+/* buckets are filtered a column at a time, keys of the hits gathered afterwards */
+template<class T, int D> template<class V> inline void Dtree<T,D>::range ( T *lo, T *hi, V& visitor, unsigned subtree ) const {
+	if ( summarized ( visitor, subtree, lo, hi ) )
+		return;
 
-		sorted.pop();
+	unsigned first;
+	unsigned count = snapshot ( subtree, first );
+	const T* pvt = pivot(subtree);
+
+	if ( count == 1 ) {
+		Value* val = load (values.at(subtree)[0]);
+		if ( val != 0 && dominates ( pvt, lo ) && dominated ( pvt, hi ) )
+			visitor ( pivot(subtree), val );
+	}else if ( count > 1 ) {
+		unsigned char hit [count];
+		memset ( hit, 1, count );
+		for (int j=0; j<dimensions(); ++j)
+			in_range_column ( column(subtree,j), lo[j], hi[j], hit, count );
+
+		T key [dimensions()];
+		for (unsigned s=0; s<count; ++s) {
+			Value* val = hit[s] ? load (values.at(subtree)[s]) : 0;
+			if ( val != 0 ) {
+				gather ( subtree, s, key );
+				visitor ( key, val );
+			}
+		}
 	}
 
-	return Rmax;
+	if ( first != 0 )
+		range ( lo, hi, visitor, first, 0, orthant ( pvt, lo ), orthant ( pvt, hi ) );
 }
 
-template<class T> void Dtree<T>::nearest ( T *center,
-					unsigned K,
-					double radius,
-					std::priority_queue <std::pair<double,std::pair<T*,char*>*>*,std::vector<std::pair<double,std::pair<T*,char*>*>*>,dist_comparison<T> >& sorted,
-					TreeNode<T>& subtree ) const {
+/*
+ * a son overlaps the range iff its orthant has every bit of lo_pos
+ * and no bit outside hi_pos, which also prunes branches of siblings
+ */
+template<class T, int D> template<class V> void Dtree<T,D>::range ( T *lo, T *hi, V& visitor,
+		unsigned sibling, int bit, orthant_t lo_pos, orthant_t hi_pos ) const {
+
+	for (; sibling != 0; ++bit) {
+		const TreeNode<T>& nd = node(sibling);
+		if ( (nd.pos & lo_pos) == lo_pos && (nd.pos & ~hi_pos) == 0 )
+			range ( lo, hi, visitor, sibling );
 
-	bool is_node_qualified = false;
-	double node_distance = subtree.dist ( center );
+		if ( bit >= dimensions() )
+			break;
 
-	if ( node_distance <= radius ) {
-		if ( sorted.size() < K ) {
-			sorted.push ( new std::pair <double,std::pair<T*,char*>*> ( node_distance, new std::pair<T*,char*> ( subtree.key, subtree.val ) ) );
-			is_node_qualified = true;
-		}else if ( ! sorted.empty() && node_distance < sorted.top()->first ) {
-			sorted.pop ();
-			sorted.push ( new std::pair <double,std::pair<T*,char*>*> ( node_distance, new std::pair<T*,char*> ( subtree.key, subtree.val ) ) );
-			is_node_qualified = true;
+		bool lo_side = ! ((lo_pos>>bit) & 1);
+		bool hi_side = (hi_pos>>bit) & 1;
+
+		if ( lo_side && hi_side )
+			range ( lo, hi, visitor, load (nd.sibling[1]), bit+1, lo_pos, hi_pos );
+		sibling = lo_side ? load (nd.sibling[0]) : (hi_side ? load (nd.sibling[1]) : 0);
+	}
+}
+
+/* a walk down the links, as unlinked tree-nodes may linger in the arena */
+template<class T, int D> template<class V> void Dtree<T,D>::scan ( V& visitor ) const {
+	T key [dimensions()];
+	std::vector<unsigned> stack;
+	if ( load (root) != 0 )
+		stack.push_back ( load (root) );
+
+	while ( ! stack.empty() ) {
+		unsigned nd = stack.back();
+		stack.pop_back ();
+
+		unsigned first;
+		unsigned count = snapshot ( nd, first );
+		for (unsigned j=0; j<count; ++j) {
+			Value* val = load (values.at(nd)[j]);
+			if ( val != 0 ) {
+				gather ( nd, j, key );
+				visitor ( key, val );
+			}
 		}
+		siblings ( first, stack );
 	}
+}
+
+/*
+ * best-first search: subtrees are expanded in ascending distance of their
+ * region from the center and the radius shrinks to the K-th candidate;
+ * distances are kept squared until the answer is emitted
+ */
+template<class T, int D> template<class V> double Dtree<T,D>::nearest ( T *center, unsigned K, double radius, V& visitor ) const {
+	unsigned top = load (root);
+	if ( top == 0 || K == 0 )
+		return radius;
+
+	double bound = radius * radius;
+
+	/* candidates as (distance, (tree-node, slot)) with the farthest on top */
+	std::priority_queue<std::pair<double,std::pair<unsigned,unsigned> > > sorted;
+
+	/* pending subtrees with the nearest region on top, regions as lo/hi pairs */
+	std::priority_queue<std::pair<double,std::pair<unsigned,unsigned> >,
+			std::vector<std::pair<double,std::pair<unsigned,unsigned> > >,
+			std::greater<std::pair<double,std::pair<unsigned,unsigned> > > > frontier;
+	std::vector<T> regions (dimensions(), std::numeric_limits<T>::lowest());
+	regions.resize (2*dimensions(), std::numeric_limits<T>::max());
+
+	std::vector<unsigned> children;
+	std::vector<double> acc (bucket);
+
+	frontier.push ( std::make_pair (0.0, std::make_pair (top, 0u)) );
+	while ( ! frontier.empty() && frontier.top().first <= bound ) {
+		unsigned subtree = frontier.top().second.first;
+		unsigned region = frontier.top().second.second;
+		frontier.pop ();
+#ifdef __VISITS__
+		++nearest_visits;
+#endif
+
+		unsigned first;
+		unsigned count = snapshot ( subtree, first );
+		const T* pvt = pivot(subtree);
 
-	int opp_pos = sons - 1 - subtree % center;
+		if ( count == 1 ) {
+			acc[0] = ::sq_dist<T> ( pvt, center, dimensions() );
+		}else{
+			std::fill ( acc.begin(), acc.begin() + count, 0.0 );
+			for (int j=0; j<dimensions(); ++j)
+				sq_dist_column ( column(subtree,j), center[j], &acc[0], count );
+		}
 
-	for ( int j=0; j<sons; ++j ) {
-		if ( subtree.son[j] != 0 ) {
-			if ( ! is_node_qualified && opp_pos == j )
+		for (unsigned s=0; s<count; ++s) {
+			if ( acc[s] > bound || load (values.at(subtree)[s]) == 0 )
 				continue;
 
-			nearest ( center, K, radius, sorted, *subtree.son[j] );
+			if ( sorted.size() == K )
+				sorted.pop ();
+			sorted.push ( std::make_pair (acc[s], std::make_pair (subtree, s)) );
+
+			if ( sorted.size() == K && sorted.top().first < bound )
+				bound = sorted.top().first;
+		}
+
+		children.clear ();
+		siblings ( first, children );
+
+		for ( unsigned j=0; j<children.size(); ++j ) {
+			unsigned son_region = regions.size();
+			regions.resize (son_region + 2*dimensions());
+
+			double mindist = 0;
+			for ( int i=0; i<dimensions(); ++i ) {
+				T lo = regions [region+i];
+				T hi = regions [region+dimensions()+i];
+
+				if ( (node(children[j]).pos >> i) & 1 )
+					lo = std::max (lo, pvt[i]);
+				else
+					hi = std::min (hi, pvt[i]);
+
+				regions [son_region+i] = lo;
+				regions [son_region+dimensions()+i] = hi;
+
+				if ( center[i] < lo )
+					mindist += ((double) lo - center[i]) * ((double) lo - center[i]);
+				else if ( center[i] > hi )
+					mindist += ((double) center[i] - hi) * ((double) center[i] - hi);
+			}
+
+			if ( mindist <= bound )
+				frontier.push ( std::make_pair (mindist, std::make_pair (children[j], son_region)) );
+			else
+				regions.resize (son_region);
 		}
 	}
-}
 
-template<class T> std::vector<std::pair<T*,char*>*>& Dtree<T>::order ( int dim ) const {
-	std::priority_queue<std::pair<T*,char*>*, std::vector<std::pair<T*,char*>*>, bpair_comparison<T> > queue ( bpair_comparison<T>(false, dim) );
-	traverse ( *root, queue );
+	if ( sorted.empty() )
+		return radius;
 
-	std::vector<std::pair<T*,char*>*> *ans = new std::vector<std::pair<T*,char*>*>;
-	for (unsigned j=0; j<node_counter; ++j) {
-		ans->push_back ( queue.top() );
-		queue.pop ();
+	double Rmax = sqrt ( sorted.top().first );
+
+	T key [dimensions()];
+	while ( ! sorted.empty() ) {
+		unsigned nd = sorted.top().second.first;
+		unsigned slot = sorted.top().second.second;
+		double dist = sqrt ( sorted.top().first );
+		sorted.pop();
+
+		/* pairs erased meanwhile are left out */
+		Value* val = load (values.at(nd)[slot]);
+		if ( val != 0 ) {
+			gather ( nd, slot, key );
+			visitor ( dist, key, val );
+		}
 	}
-	return *ans;
+
+	return Rmax;
 }
 
-template<class T> inline void Dtree<T>::traverse ( TreeNode<T>& nd,
-		std::priority_queue<std::pair<T*,char*>*, std::vector<std::pair<T*,char*>*>, bpair_comparison<T> >& queue ) const {
+/*
+ * draws bucket slots of the tree-nodes reachable from the root, skipping
+ * empty ones, so that the draw stays uniform over keys
+ */
+template<class T, int D> void Dtree<T,D>::sample ( int dim, unsigned size, std::vector<T>& coords ) const {
+	std::vector<unsigned> order;
+	std::vector<unsigned> counts;
+	if ( load (root) != 0 )
+		order.push_back ( load (root) );
+	for (unsigned i=0; i<order.size(); ++i) {
+		unsigned first;
+		counts.push_back ( snapshot ( order[i], first ) );
+		siblings ( first, order );
+	}
 
-	for ( int j=sons-1; j>=0; --j )
-		if ( nd.son[j] != 0 )
-			traverse ( *nd.son[j] , queue );
-	std::pair<T*,char*> *tuple = new std::pair<T*,char*> ( nd.key , nd.val);
-	queue.push( tuple );
-	/*
-	for (int j=0; j<dims; ++j)
-		std::cerr << nd.key[j] << " ";
-	std::cerr << "\n";
-	*/
-}
+	unsigned total = load (node_counter);
+	if ( size == 0 || size >= total || order.empty() ) {
+		coords.reserve ( coords.size() + total );
+		for (unsigned i=0; i<order.size(); ++i)
+			for (unsigned j=0; j<counts[i]; ++j)
+				if ( load (values.at(order[i])[j]) != 0 )
+					coords.push_back ( column(order[i],dim)[j] );
+		return;
+	}
 
-template<class T> inline TreeNode<T>* Dtree<T>::min_leaf ( TreeNode<T>* subtree ) const {
-	if ( subtree == 0 )
-		return 0;
+	coords.reserve ( coords.size() + size );
+	unsigned long long seed = total;
+	for (unsigned long long drawn=0, draws=0; drawn < size && draws < 64ull*size; ++draws) {
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		unsigned long long r = (seed >> 24) % ((unsigned long long) order.size() * bucket);
+		unsigned i = (unsigned) (r / bucket);
+		unsigned j = (unsigned) (r % bucket);
+		if ( j < counts[i] && load (values.at(order[i])[j]) != 0 ) {
+			coords.push_back ( column(order[i],dim)[j] );
+			++drawn;
+		}
+	}
+}
 
-	for (int j=0; j<sons; ++j)
-		if ( subtree->son[j] != 0 )
-			return min_leaf ( subtree->son[j] );
-	return subtree;
+/*
+ * selects the q-quantile of the keys on dim in linear time, out of all keys
+ * or out of a uniform sample of records when sample is non-zero
+ */
+template<class T, int D> T Dtree<T,D>::quantile ( int dim, double q, unsigned sample ) const {
+	std::vector<T> coords;
+	this->sample ( dim, sample, coords );
+	return nth_quantile ( coords, q );
 }
 
-template<class T> inline TreeNode<T>* Dtree<T>::max_leaf ( TreeNode<T>* subtree ) const {
-	if ( subtree == 0 )
-		return 0;
+template<class T> T nth_quantile ( std::vector<T>& coords, double q ) {
+	if ( coords.empty() )
+		throw std::runtime_error ("** ERROR - Quantile of an empty tree.");
 
-	for (int j=sons-1; j>=0; --j)
-		if ( subtree->son[j] != 0 )
-			return max_leaf ( subtree->son[j] );
-	return subtree;
+	size_t nth = (size_t) (q * coords.size());
+	if ( nth >= coords.size() )
+		nth = coords.size() - 1;
+
+	std::nth_element ( coords.begin(), coords.begin() + nth, coords.end() );
+	return coords [nth];
 }
@@ -20,98 +20,346 @@
 #ifndef DTREE_H_
 #define DTREE_H_
 
-#include "bpriority_queue.h"
+#include "Arena.h"
+#include "ValueStore.h"
+#include "distance.h"
 #include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <pthread.h>
+#include <stdexcept>
 #include <vector>
 
+/* bit j is set when a key lies on the upper side of a pivot on dim#j */
+typedef unsigned long long orthant_t;
+
+const int MAXDIMS = 64;
+
+/* building with -DMIDAS_DIMS=<d> specializes the index for d dimensions */
+#ifndef MIDAS_DIMS
+#define MIDAS_DIMS 0
+#endif
+
+/* building with -D__VISITS__ counts the tree-nodes nearest expands, which make visits reports */
+#ifdef __VISITS__
+extern unsigned long long nearest_visits;
+#endif
+
 template<class T> struct TreeNode;
 
-class comparison;
+template<class T> class TupleArray;
 
-template<class T> class Dtree {
+template<class T> class Aggregate;
+
+/*
+ * Tree-nodes live in a slab arena and reference each other by 32-bit
+ * indices; index 0 stands for the null link. Only occupied orthants get
+ * a son, reached from the first son through a search tree of siblings,
+ * so a node costs the same for any dimensionality. A non-zero D fixes the
+ * dimensionality at compile time so that the per-key loops get unrolled.
+ *
+ * Every tree-node holds a bucket of up to B tuples whose first one is the
+ * pivot. Leaves fill their bucket before spilling it into sons, and inner
+ * nodes keep the pivot only.
+ *
+ * The tree owns copies of the keys. A bucket stores them dimension-major,
+ * one column of B coordinates per dimension, with the values in a parallel
+ * array, so filters and distances run down a column for all its tuples.
+ * Pivots are also kept as rows of their own for the descent.
+ *
+ * Erased tuples leave a NULL value behind as a tombstone, which keeps
+ * their pivot in place until compaction rebuilds the subtree.
+ *
+ * Every tree-node also summarizes its subtree with the count of its live
+ * tuples, the sums of their coordinates and their bounding box, so that
+ * aggregates take a subtree enclosed by their range at once.
+ *
+ * Readers may run along with one writer at a time. Writers fill records
+ * before publishing them to the links, counts and value slots that readers
+ * follow, and compaction swaps a rebuilt subtree in while handing back the
+ * tree-nodes it unlinks instead of releasing them. release and bulk_load
+ * rewrite the tree in place and need it to themselves.
+ */
+template<class T, int D=0> class Dtree {
 
-	TreeNode<T> *root;
+	Arena<TreeNode<T> > nodes;
+
+	/* pivot rows, bucket columns and bucket values, indexed like the tree-nodes */
+	Arena<T> pivots;
+	Arena<T> columns;
+	Arena<Value*> values;
+
+	/* bounding boxes as lo/hi rows and coordinate sums of the subtrees */
+	Arena<T> boxes;
+	Arena<double> sums;
+
+	/* tree-nodes passed on the way down by the writer */
+	std::vector<unsigned> path;
+
+	pthread_mutex_t alloc_lock;
+
+	unsigned root;
 	unsigned node_counter;
+	unsigned tombstones;
 
 	int dims;
-	int sons;
+	unsigned bucket;
 
 public:
-	Dtree (int d) : root(0), node_counter(0), dims(d), sons(1<<d) {}
+	Dtree (int d, unsigned b=1) : nodes(1), pivots(d), columns(d*b), values(b), boxes(2*d), sums(d), root(0), node_counter(0), tombstones(0), dims(d), bucket(b) {
+		if (d < 1 || d > MAXDIMS || (D > 0 && d != D))
+			throw std::runtime_error ("** CRITICAL ERROR - Unsupported dimensionality.");
+		if (b < 1)
+			throw std::runtime_error ("** CRITICAL ERROR - Bucket capacity should be positive.");
+		pthread_mutex_init (&alloc_lock, 0);
+	}
 	~Dtree ();
 
-	/* returns depth of new tree-node */
-	void push ( T *key , char* val );
+	/* indexes a copy of the key, the value passes to the tree */
+	void push ( T *key , Value* val );
 
-	/* returns value of the key or NULL */
-	char* pop ( T *key );
+	/*
+	 * indexes a copy of the key with val in one descent unless the key is
+	 * already indexed, returning its value slot then and NULL otherwise
+	 */
+	Value** insert ( T *key , Value* val );
+
+	/* leaves a tombstone in place of the key and returns its value or NULL */
+	Value* erase ( T *key );
 
-	TreeNode<T>* search ( T* query ) const;
+	/* returns the value slot of the key or NULL */
+	Value** search ( T* query ) const;
 
-	void range ( T *lo, T *hi, std::vector<std::pair<T*,char*>*>& ans ) const;
-	double nearest ( T *center, unsigned K, double Rmax, std::vector<std::pair<double,std::pair<T*,char*>*>*> &ans ) const;
+	/*
+	 * calls visitor (key, value) for every pair within [lo,hi]; an
+	 * Aggregate takes the summaries of enclosed subtrees instead
+	 */
+	template<class V> void range ( T *lo, T *hi, V& visitor ) const;
+
+	/* calls visitor (key, value) for every indexed pair in tree order */
+	template<class V> void scan ( V& visitor ) const;
+
+	/*
+	 * calls visitor (distance, key, value) for the K nearest pairs within
+	 * radius, farthest first, and returns the distance of the farthest
+	 */
+	template<class V> double nearest ( T *center, unsigned K, double radius, V& visitor ) const;
+
+	/* forgets all tree-nodes without releasing their values */
+	void release ();
+
+	/*
+	 * rebuilds a balanced tree with the passed pairs and the indexed ones,
+	 * taking each median on a round-robin dimension as the pivot
+	 */
+	void bulk_load ( TupleArray<T>& data );
+
+	/*
+	 * rebuilds every largest subtree where tombstones exceed ratio of
+	 * its tuples out of its live tuples only; the unlinked tree-nodes are
+	 * appended to retired and stay readable until passed to reclaim
+	 */
+	void compact ( double ratio, std::vector<unsigned>& retired );
+
+	/* releases a tree-node retired by compact */
+	void reclaim ( unsigned nd ) {release_node (nd);}
 
 private:
-	void range ( T *lo, T *hi, std::vector<std::pair<T*,char*>*>& ans, TreeNode<T>& subtree ) const;
-	void nearest ( T *center,
-			unsigned K,
-			double radius,
-			std::priority_queue <std::pair<double,std::pair<T*,char*>*>*, std::vector<std::pair<double,std::pair<T*,char*>*>*>, dist_comparison<T> >& sorted,
-			TreeNode<T> &subtree ) const;
+	template<class V> void range ( T *lo, T *hi, V& visitor, unsigned subtree ) const;
+	template<class V> void range ( T *lo, T *hi, V& visitor,
+			unsigned sibling, int bit, orthant_t lo_pos, orthant_t hi_pos ) const;
 
 public:
 
 	/* auxiliary */
-	unsigned get_size () const {return node_counter;}
-	std::vector<std::pair<T*,char*>*>& order ( int dim ) const;
+	unsigned get_size () const {return load (node_counter);}
+	unsigned get_tombstones () const {return load (tombstones);}
+	unsigned get_bucket () const {return bucket;}
+
+	/* returns the q-quantile on dim, estimated from sample keys unless 0 */
+	T quantile ( int dim, double q, unsigned sample=0 ) const;
 
-	TreeNode<T>* max_leaf () const {return max_leaf ( root );}
-	TreeNode<T>* min_leaf () const {return min_leaf ( root );}
+	/* appends the coordinates on dim of all keys, or of size sample keys unless 0 */
+	void sample ( int dim, unsigned size, std::vector<T>& coords ) const;
 
 private:
-	void dropTree ( TreeNode<T>& subtree ) const;
-	void traverse ( TreeNode<T>& subtree,
-			std::priority_queue<std::pair<T*,char*>*, std::vector<std::pair<T*,char*>*>, bpair_comparison<T> >& q ) const;
+	TreeNode<T>& node ( unsigned i ) const {return *nodes.at(i);}
 
-	TreeNode<T>* max_leaf(TreeNode<T>* subtree) const;
-	TreeNode<T>* min_leaf(TreeNode<T>* subtree) const;
-};
+	T* pivot ( unsigned i ) const {return pivots.at(i);}
 
-template<class T> struct TreeNode {
-	T* key;
+	/* coordinates on dim of the bucket of tree-node i */
+	T* column ( unsigned i, int dim ) const {return columns.at(i) + dim*bucket;}
 
-	TreeNode<T>** son;
-	TreeNode<T>* parent;
+	/* summary of the subtree of tree-node i */
+	T* box_lo ( unsigned i ) const {return boxes.at(i);}
+	T* box_hi ( unsigned i ) const {return boxes.at(i) + dimensions();}
+	double* sum ( unsigned i ) const {return sums.at(i);}
 
-	char* val;
+	/* counts key in the summary of nd */
+	void enclose ( unsigned nd, const T *key );
 
-	int dims;
-	int sons;
+	/* discounts key from the summaries along path, shrinking the boxes it bounded */
+	void retract ( const T *key );
 
-	TreeNode ( int d, T* new_key, char* new_val ) : key(new_key), son(0), parent(0), val(new_val), dims(d), sons(1<<d) {
-		son = (TreeNode<T>**) calloc (sons, sons*sizeof(TreeNode<T>*));
-		//memset (son, 0, sons * sizeof(TreeNode<T>*));
-	}
+	/* recomputes the box of nd out of its live tuples and sons, returns whether it changed */
+	bool shrink ( unsigned nd );
 
-	~TreeNode () {free(key); free(val); free (son);}
+	/* sets the summary of nd out of its bucket and the summaries of its sons */
+	void summarize ( unsigned nd );
 
-	bool operator == (T *nd_key) const;
-	bool operator != (T *nd_key) const;
-	bool operator >= (T *nd_key) const;
-	bool operator <= (T *nd_key) const;
+	/* visitors take no summaries unless they are aggregates */
+	template<class V> bool summarized ( V&, unsigned, const T*, const T* ) const {return false;}
 
-	/*
-	 * returns key distance
-	 */
-	double dist ( T *nd_key ) const;
+	/* merges the subtree into acc when enclosed by [lo,hi] or skips it when disjoint, returns whether either */
+	bool summarized ( Aggregate<T>& acc, unsigned subtree, const T *lo, const T *hi ) const;
+
+	/* copies the key in slot of the bucket of nd into key */
+	void gather ( unsigned nd, unsigned slot, T *key ) const;
+
+	int dimensions () const {return D > 0 ? D : dims;}
+
+	/* returns the son of nd in orthant pos or 0 */
+	unsigned son ( unsigned nd, orthant_t pos ) const;
+
+	/* returns the link among siblings where orthant pos is or belongs */
+	unsigned* locate ( unsigned* link, orthant_t pos ) const;
+
+	/* appends all sons of nd */
+	void sons ( unsigned nd, std::vector<unsigned>& ans ) const;
+
+	/* appends first and all its siblings */
+	void siblings ( unsigned first, std::vector<unsigned>& ans ) const;
 
 	/*
-	 *  returns balance
+	 * loads the first son of nd and returns the tuples of its bucket that
+	 * go along with it, all of them for a leaf and the pivot otherwise
 	 */
-	int operator % ( T *nd_key ) const;
+	unsigned snapshot ( unsigned nd, unsigned& first ) const;
+
+	/* returns the slot of the bucket of nd holding key alive or bucket */
+	unsigned find ( unsigned nd, const T *key ) const;
+
+	bool dominates ( const T *pt, const T *key ) const;
+	bool dominated ( const T *pt, const T *key ) const;
+
+	/* returns balance */
+	orthant_t orthant ( const T *pt, const T *key ) const;
+
+	/* allocates a tree-node along with its bucket */
+	unsigned alloc_node ();
+	void release_node ( unsigned nd );
+
+	/* appends a pair to the bucket of nd */
+	void append ( unsigned nd, const T *key, Value* val );
+
+	/* moves the bucket of a full leaf past its pivot into new sons */
+	void spill ( unsigned nd );
+
+	void dropTree ();
+
+	void compact ( unsigned* link, double ratio, const std::vector<unsigned>& total,
+			const std::vector<unsigned>& dead, std::vector<unsigned>& retired );
+
+	/* swaps the subtree at link for a balanced one of its live tuples */
+	void rebuild ( unsigned* link, std::vector<unsigned>& retired );
+
+	/* reads a link, count, value slot or summary that a writer may publish meanwhile */
+	template<class X> static X load ( const X& x ) {X v; __atomic_load (&x, &v, __ATOMIC_ACQUIRE); return v;}
+	template<class X> static void publish ( X& x, X v ) {__atomic_store (&x, &v, __ATOMIC_RELEASE);}
+
+	unsigned bulk_load ( std::pair<T*,Value*>* data, unsigned lo, unsigned hi, int depth, int threads );
+	void bulk_load ( std::pair<T*,Value*>* data, unsigned lo, unsigned hi, int depth, int threads,
+			unsigned parent, int bit, unsigned total, std::vector<std::pair<pthread_t,void*> >& workers );
+	void adopt ( unsigned parent, unsigned subtree );
+
+	template<class U, int E> friend void* bulk_load_worker ( void* );
+};
+
+/* returns the q-quantile of coords in linear time, reordering them */
+template<class T> T nth_quantile ( std::vector<T>& coords, double q );
+
+/*
+ * Tuples as a row-major key buffer with a parallel array of values; it
+ * also serves as a visitor that appends copies of the visited tuples.
+ */
+template<class T> class TupleArray {
+	int dims;
+
+	std::vector<T> keys;
+	std::vector<Value*> vals;
+
+public:
+	TupleArray ( int d ) : dims(d) {}
+
+	void operator () ( const T* key, Value* val ) {
+		keys.insert ( keys.end(), key, key + dims );
+		vals.push_back ( val );
+	}
+
+	void reserve ( unsigned n ) {
+		keys.reserve ( (size_t) n * dims );
+		vals.reserve ( n );
+	}
+
+	void clear () {
+		keys.clear ();
+		vals.clear ();
+	}
+
+	unsigned size () const {return vals.size();}
+
+	T* key ( unsigned i ) {return &keys [(size_t) i * dims];}
+	Value* val ( unsigned i ) const {return vals [i];}
+};
+
+/*
+ * COUNT, SUM, MIN and MAX of the keys of a set of tuples on every
+ * dimension. It visits tuples like TupleArray, and partial aggregates of
+ * disjoint sets merge into the aggregate of their union.
+ */
+template<class T> class Aggregate {
+public:
+	unsigned long long count;
+	std::vector<double> sum;
+	std::vector<T> min;
+	std::vector<T> max;
+
+	Aggregate ( int d ) : count(0), sum(d, 0.0), min(d, std::numeric_limits<T>::max()), max(d, std::numeric_limits<T>::lowest()) {}
+
+	void operator () ( const T* key, Value* ) {
+		merge ( 1, 0, key, key );
+	}
+
+	/* s may be NULL for a single key, which then is lo */
+	void merge ( unsigned long long n, const double* s, const T* lo, const T* hi ) {
+		count += n;
+		for (unsigned j=0; j<sum.size(); ++j) {
+			sum[j] += s != 0 ? s[j] : (double) lo[j];
+			if ( lo[j] < min[j] )
+				min[j] = lo[j];
+			if ( hi[j] > max[j] )
+				max[j] = hi[j];
+		}
+	}
+
+	void merge ( const Aggregate& other ) {
+		if ( other.count > 0 )
+			merge ( other.count, &other.sum[0], &other.min[0], &other.max[0] );
+	}
+};
+
+template<class T> struct TreeNode {
+	/* orthant of the parent where this node hangs */
+	orthant_t pos;
+
+	unsigned son;
+	unsigned sibling[2];
+
+	/* pairs in the bucket, 0 for a released or emptied tree-node */
+	unsigned count;
 
-	bool isCompatible ( TreeNode& nd ) const;
+	/* live tuples in the subtree, the bucket included */
+	unsigned total;
 };
 
 #endif
@@ -0,0 +1,103 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Epoch-based reclamation. A reader announces the global epoch in a slot
+ * of its own for as long as it follows shared links. A writer tags what it
+ * unlinks with the epoch it closes by advancing the global one, and frees
+ * it once every announced epoch is newer than the tag, as no reader left
+ * can have reached it then. Readers only ever write their own slot.
+ */
+class Epochs {
+
+	static const unsigned SLOTS = 128;
+
+	/* a slot per cache line, 0 for an idle one */
+	struct Slot {
+		unsigned long long epoch;
+		char pad [64 - sizeof(unsigned long long)];
+	};
+
+	Slot slots [SLOTS];
+
+	unsigned long long global;
+
+	Epochs (const Epochs&);
+	Epochs& operator = (const Epochs&);
+
+public:
+	Epochs () : global(1) {
+		memset (slots, 0, sizeof(slots));
+	}
+
+	/* announces the current epoch in a free slot and returns the slot */
+	unsigned enter () {
+		unsigned start = (unsigned) ((unsigned long) pthread_self() >> 8) % SLOTS;
+		for (unsigned i=start; ; i=(i+1)%SLOTS) {
+			unsigned long long idle = 0;
+			unsigned long long now = __atomic_load_n (&global, __ATOMIC_SEQ_CST);
+			if ( __atomic_compare_exchange_n (&slots[i].epoch, &idle, now, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+				return i;
+			if ( (i+1) % SLOTS == start )
+				sched_yield ();
+		}
+	}
+
+	void exit ( unsigned slot ) {
+		__atomic_store_n (&slots[slot].epoch, 0ull, __ATOMIC_RELEASE);
+	}
+
+	/* closes the current epoch and returns it as the tag of what was just unlinked */
+	unsigned long long advance () {
+		return __atomic_fetch_add (&global, 1ull, __ATOMIC_SEQ_CST);
+	}
+
+	/* returns the oldest epoch a reader may still be in */
+	unsigned long long oldest () const {
+		unsigned long long min = __atomic_load_n (&global, __ATOMIC_SEQ_CST);
+		for (unsigned i=0; i<SLOTS; ++i) {
+			unsigned long long epoch = __atomic_load_n (&slots[i].epoch, __ATOMIC_SEQ_CST);
+			if ( epoch != 0 && epoch < min )
+				min = epoch;
+		}
+		return min;
+	}
+};
+
+/* holds an epoch for the lifetime of a read */
+class EpochGuard {
+	Epochs& epochs;
+	unsigned slot;
+
+	EpochGuard (const EpochGuard&);
+	EpochGuard& operator = (const EpochGuard&);
+
+public:
+	EpochGuard ( Epochs& e ) : epochs(e), slot(e.enter()) {}
+	~EpochGuard () {epochs.exit (slot);}
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#include "Link.h"
+#include "common.h"
+#include <stdexcept>
+
+Link::Link ( ClientSocket* s ) : sock(s), posted(0), received(0), failed(false), refs(1) {
+	pthread_mutex_init (&write_lock, 0);
+	pthread_mutex_init (&lock, 0);
+	pthread_cond_init (&changed, 0);
+
+	pthread_attr_t attr;
+	pthread_attr_init (&attr);
+	pthread_attr_setstacksize (&attr, THREAD_STACK_SIZE);
+	int status = pthread_create (&reader, &attr, ::receive<Link>, this);
+	pthread_attr_destroy (&attr);
+	if (status != 0) {
+		pthread_cond_destroy (&changed);
+		pthread_mutex_destroy (&lock);
+		pthread_mutex_destroy (&write_lock);
+		throw std::runtime_error ("%% ERROR - Unable to create a new thread.");
+	}
+}
+
+Link::~Link () {
+	pthread_mutex_lock (&lock);
+	fail ();
+	pthread_mutex_unlock (&lock);
+	sock->shutdown ();
+	pthread_join (reader, 0);
+	delete sock;
+
+	pthread_cond_destroy (&changed);
+	pthread_mutex_destroy (&lock);
+	pthread_mutex_destroy (&write_lock);
+}
+
+unsigned long long Link::post ( const std::string& msg, const char* trailer ) {
+	pthread_mutex_lock (&write_lock);
+
+	pthread_mutex_lock (&lock);
+	if (failed) {
+		pthread_mutex_unlock (&lock);
+		pthread_mutex_unlock (&write_lock);
+		throw std::runtime_error ("Link has failed.");
+	}
+	unsigned long long ticket = posted++;
+	trailers.push_back (trailer);
+	pthread_cond_broadcast (&changed);
+	pthread_mutex_unlock (&lock);
+
+	/* the reader is not held up by a long write, so the peer never blocks on its replies */
+	try{
+		*sock << msg;
+	}catch (std::exception& e){
+		pthread_mutex_lock (&lock);
+		fail ();
+		pthread_mutex_unlock (&lock);
+		sock->shutdown ();
+		pthread_mutex_unlock (&write_lock);
+		throw;
+	}
+	pthread_mutex_unlock (&write_lock);
+	return ticket;
+}
+
+std::string Link::wait ( unsigned long long ticket ) {
+	pthread_mutex_lock (&lock);
+	std::map<unsigned long long,std::string>::iterator mi;
+	while ((mi = replies.find (ticket)) == replies.end() && !failed)
+		pthread_cond_wait (&changed, &lock);
+
+	if (mi == replies.end()) {
+		pthread_mutex_unlock (&lock);
+		throw std::runtime_error ("Link has failed.");
+	}
+	std::string reply;
+	reply.swap (mi->second);
+	replies.erase (mi);
+	pthread_mutex_unlock (&lock);
+	return reply;
+}
+
+void Link::drop ( unsigned long long ticket ) {
+	pthread_mutex_lock (&lock);
+	if (replies.erase (ticket) == 0 && ticket >= received)
+		dropped.insert (ticket);
+	pthread_mutex_unlock (&lock);
+}
+
+void Link::receive () {
+	std::string data;
+	try{
+		for (;;) {
+			/* a reply is read only once it is awaited, so that text ones are told apart by their ends */
+			pthread_mutex_lock (&lock);
+			while (trailers.empty() && !failed)
+				pthread_cond_wait (&changed, &lock);
+			if (failed) {
+				pthread_mutex_unlock (&lock);
+				return;
+			}
+			std::string trailer = trailers.front();
+			pthread_mutex_unlock (&lock);
+
+			std::string reply;
+			if (sock->is_framed()) {
+				*sock >> reply;
+			}else{
+				size_t end, scanned = 0;
+				while ((end = data.find (trailer, scanned)) == std::string::npos) {
+					scanned = data.size() < trailer.size() ? 0 : data.size()-trailer.size()+1;
+					std::string chunk;
+					*sock >> chunk;
+					data += chunk;
+				}
+				end += trailer.size();
+				reply = data.substr (0, end);
+				data.erase (0, end);
+			}
+
+			pthread_mutex_lock (&lock);
+			if (dropped.erase (received) == 0)
+				replies[received].swap (reply);
+			++received;
+			trailers.pop_front ();
+			pthread_cond_broadcast (&changed);
+			pthread_mutex_unlock (&lock);
+		}
+	}catch (std::exception& e){
+		pthread_mutex_lock (&lock);
+		fail ();
+		pthread_mutex_unlock (&lock);
+	}
+}
+
+void Link::fail () {
+	__atomic_store_n (&failed, true, __ATOMIC_RELEASE);
+	pthread_cond_broadcast (&changed);
+}
@@ -0,0 +1,113 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include "ClientSocket.h"
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+/*
+ * A skip-link shared by the workers of a node, with any number of requests
+ * in flight on it. A request is written whole and numbered by a ticket in
+ * the order it went out, and a reader of the link's own files the replies
+ * under the tickets of the outstanding requests, since a peer answers the
+ * messages of a connection in the order they came. Requests posted to
+ * several links before any reply is awaited take a single round-trip.
+ */
+class Link {
+	ClientSocket* sock;
+
+	/* held for the whole of a write, so that tickets follow the order on the wire */
+	pthread_mutex_t write_lock;
+
+	/* guards the outstanding requests and the replies, signalling any change of them */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+
+	/* tickets issued, and replies filed */
+	unsigned long long posted;
+	unsigned long long received;
+
+	/* how each outstanding text reply ends, oldest first */
+	std::deque<const char*> trailers;
+
+	/* replies filed but not collected yet */
+	std::map<unsigned long long,std::string> replies;
+
+	/* tickets whose replies nobody awaits, discarded as they come */
+	std::set<unsigned long long> dropped;
+
+	bool failed;
+	pthread_t reader;
+
+	/* holders of the link, counted by its owner; the last one to let go deletes it */
+	unsigned refs;
+
+	Link (const Link&);
+	Link& operator = (const Link&);
+
+public:
+	/* takes over a connected link, already negotiated */
+	Link ( ClientSocket* sock );
+	~Link ();
+
+	/* sends msg and returns the ticket of its reply, ending with trailer unless framed */
+	unsigned long long post ( const std::string& msg, const char* trailer="\n" );
+
+	/* returns the reply of ticket, or throws once the link has failed without it */
+	std::string wait ( unsigned long long ticket );
+
+	/* gives up on the reply of ticket, so that it is discarded instead of filed */
+	void drop ( unsigned long long ticket );
+
+	/* sends msg and waits for its reply */
+	std::string request ( const std::string& msg, const char* trailer="\n" ) { return wait (post (msg, trailer)); }
+
+	/* adds a holder, on behalf of one who holds the link already */
+	void hold () { __atomic_add_fetch (&refs, 1, __ATOMIC_RELAXED); }
+
+	/* drops a holder, returns whether it was the last one */
+	bool release () { return __atomic_sub_fetch (&refs, 1, __ATOMIC_ACQ_REL) == 0; }
+
+	bool is_binary () const { return sock->is_binary(); }
+	bool is_valid () const { return !__atomic_load_n (&failed, __ATOMIC_ACQUIRE); }
+
+	/* files the replies taken off the link until it fails or closes */
+	void receive ();
+
+private:
+	/* marks the link failed, waking up its waiters, the lock held */
+	void fail ();
+};
+
+/* a request in flight on the skip-link of index */
+struct Forward {
+	unsigned index;
+	Link* link;
+	unsigned long long ticket;
+
+	Forward ( unsigned i, Link* l, unsigned long long t ) : index(i), link(l), ticket(t) {}
+};
+
+#endif
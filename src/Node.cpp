@@ -18,6 +18,7 @@
  *********************************************************************/
 
 #include <sys/time.h>
+#include <sys/epoll.h>
 #include <stdexcept>
 #include <typeinfo>
 #include <algorithm>
@@ -25,102 +26,122 @@
 #include <cassert>
 #include <climits>
 #include <cfloat>
+#include <ctime>
 
 #include "common.h"
+#include "Codec.h"
 #include "Node.h"
 #include "Pool.cpp"
+#include "RouteCache.cpp"
 
 //#define __TIMING__
+
+/* seconds between passes of the compactor over fresh tombstones */
+#define COMPACTION_PERIOD 1
+
+/* seconds between checks of the rebalancer on the load of its node */
+#define REBALANCE_PERIOD 2
+
+/* least share of the tuples of a node worth moving across a boundary */
+#define MIN_SHIFT .125
+
+/* query regions a node keeps for its split policy */
+#define WORKLOAD_SAMPLE 1024
+
+/* nanoseconds a shift or a join waits for the handlers before giving way to them */
+#define ROUTING_PATIENCE 50000000
+
+/* milliseconds a route to an owner met in a reply waits to connect */
+#define ROUTE_TIMEOUT 1000
+
+/* milliseconds a spare peer is given to accept, so that a dead one is passed over */
+#define RECRUIT_TIMEOUT 1000
+
+/* milliseconds a skip-link is given to connect, so that a dead peer holds up no handler */
+#define LINK_TIMEOUT 1000
+
+/* microseconds between the attempts of a skip-link to connect */
+#define LINK_RETRY 10000
+
+/* milliseconds a joining peer is given to take its region, while no handler routes */
+#define JOIN_TIMEOUT 5000
 #define MIN(a,b) (a)<(b)?(a):(b)
 
-template<class T> static void stream2vec (std::istream& in,
-					void* vec,
-					int dims,
-					char delimiter) {
-	for (int j = 0; j < dims; ++j) {
-		if (typeid (T) == typeid (char)){
-			char temp;
-			in >> temp;
-			reinterpret_cast<char*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (short int)){
-			short int temp;
-			in >> temp;
-			reinterpret_cast<short int*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (unsigned short int)){
-			unsigned short int temp;
-			in >> temp;
-			reinterpret_cast<unsigned short int*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (int)){
-			int temp;
-			in >> temp;
-			reinterpret_cast<int*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (unsigned int)){
-			unsigned int temp;
-			in >> temp;
-			reinterpret_cast<unsigned int*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (long int)){
-			long int temp;
-			in >> temp;
-			reinterpret_cast<long int*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (unsigned long int)){
-			unsigned long int temp;
-			in >> temp;
-			reinterpret_cast<unsigned long int*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (float)){
-			float temp;
-			in >> temp;
-			reinterpret_cast<float*> (vec)[j] = temp;
-		}else if (typeid (T) == typeid (double)){
-			double temp;
-			in >> temp;
-			reinterpret_cast<double*> (vec)[j] = temp;
-		}else
-			throw std::runtime_error("** CRITICAL ERROR - Unexpected index type used.");
-
-		if (delimiter != '\n' && delimiter != '\r' && delimiter != '\t' && delimiter != ' ') {
-			if (j < dims - 1) {
-				char symbol;
-				in >> symbol;
+/* range visitor formatting answer tuples straight into the outgoing message, binary between peers that agreed on it */
+template<class T> class answer_printer {
+	std::ostream& out;
+	int dims;
+	bool binary;
+public:
+	unsigned size;
+
+	answer_printer (std::ostream& o, int d, bool b=false) : out(o), dims(d), binary(b), size(0) {}
+
+	void operator () (T* key, Value* val) {
+		if (binary) {
+			std::stringstream value;
+			value << *val;
+			put (key, value.str());
+			return;
+		}
+		out << "(key(";
+		::vec2stream<T> (out, key, dims, ',');
+		out << "),[" << *val << "])\n";
+		++size;
+	}
 
-				if (symbol != delimiter)
-					throw std::runtime_error(" Bad request message. Expected "+delimiter);
-			}
+	void put (T* key, const std::string& value) {
+		if (binary) {
+			std::string tuple;
+			::put_key<T> (tuple, key, dims);
+			::put_value (tuple, value.data(), value.size());
+			out << tuple;
+		}else{
+			out << "(key(";
+			::vec2stream<T> (out, key, dims, ',');
+			out << "),[" << value << "])\n";
 		}
+		++size;
 	}
-}
+};
+
+/* nearest visitor copying the neighbors out, to be merged with those of other peers */
+template<class T> class neighbor_collector {
+	std::vector<Neighbor<T> >& found;
+	int dims;
+public:
+	neighbor_collector (std::vector<Neighbor<T> >& f, int d) : found(f), dims(d) {}
+
+	void operator () (double distance, T* key, Value* val) {
+		Neighbor<T> n;
+		n.distance = distance;
+		n.key.assign (key, key+dims);
+
+		std::stringstream value;
+		value << *val;
+		n.value = value.str();
+		found.push_back (n);
+	}
+};
 
-template<class T> static void vec2stream (std::ostream& out,
-					void* vec,
-					int dims,
-					char delimiter) {
-	for (int j = 0; j < dims; ++j) {
-		if (typeid(T) == typeid(char))
-			out << reinterpret_cast<char*> (vec)[j];
-		else if (typeid(T) == typeid(short int))
-			out << reinterpret_cast<short int*> (vec)[j];
-		else if (typeid(T) == typeid(unsigned short int))
-			out << reinterpret_cast<unsigned short int*> (vec)[j];
-		else if (typeid(T) == typeid(int))
-			out << reinterpret_cast<int*> (vec)[j];
-		else if (typeid(T) == typeid(unsigned int))
-			out << reinterpret_cast<unsigned int*> (vec)[j];
-		else if (typeid(T) == typeid(long int))
-			out << reinterpret_cast<long int*> (vec)[j];
-		else if (typeid(T) == typeid(unsigned long int))
-			out << reinterpret_cast<unsigned long int*> (vec)[j];
-		else if (typeid(T) == typeid(float))
-			out << reinterpret_cast<float*> (vec)[j];
-		else if (typeid(T) == typeid(double))
-			out << reinterpret_cast<double*> (vec)[j];
-		else
-			throw std::runtime_error("** CRITICAL ERROR - Unexpected index type.");
+/* scan visitor formatting the tuples of a marshalized node */
+template<class T> class tuple_printer {
+	std::ostream& out;
+	int dims;
+public:
+	unsigned size;
+
+	tuple_printer (std::ostream& o, int d) : out(o), dims(d), size(0) {}
 
-		if (j < dims - 1)
-			out << delimiter;
+	void operator () (T* key, Value* val) {
+		::vec2stream<T> (out, key, dims, ',');
+		out << " " << *val << "\n";
+		++size;
 	}
-}
+};
 
-template<class T> Node<T>::Node (int dms,std::string& msg) : dims(dms), pool(dms) {
+template<class T> Node<T>::Node (int dms,std::string& msg) : dims(dms), pool(dms,bucket_size,pool_shards), routes(dms,route_capacity) {
+	init_locks();
 	initialize(msg);
 }
 
@@ -128,12 +149,35 @@ template<class T> Node<T>::Node (std::string& hst,
 				int prt,
 				int dms,
 				std::string& msg)
-				: dims(dms), pool(dms) {
+				: dims(dms), pool(dms,bucket_size,pool_shards), routes(dms,route_capacity) {
+	init_locks();
 	initialize(msg);
 	host = hst;
 	port = prt;
 }
 
+template<class T> void Node<T>::init_locks () {
+	pthread_mutex_init (&compaction_lock, 0);
+	pthread_cond_init (&compaction_cond, 0);
+	compacting = false;
+	quitting = false;
+	pthread_mutex_init (&workload_lock, 0);
+	observed = 0;
+	pthread_cond_init (&rebalance_cond, 0);
+	rebalancing = false;
+	requests = 0;
+	request_rate = 0;
+	/* a pending shift or join holds off new handlers, or it would wait for a lull in vain */
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init (&attr);
+	pthread_rwlockattr_setkind_np (&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init (&routing_lock, &attr);
+	pthread_rwlockattr_destroy (&attr);
+	pthread_mutex_init (&skip_lock, 0);
+	reactor = -1;
+	listener = 0;
+}
+
 template<class T> void Node<T>::initialize (std::string &msg) {
 	if (pool.get_size() > 0)
 		return;
@@ -191,6 +235,14 @@ template<class T> void Node<T>::initialize (std::string &msg) {
 	for (unsigned j = 0; j < hist.size(); ++j)
 		pts.push_back ( temp [j] );
 
+	for (unsigned j = 0; j < hist.size(); ++j) {
+		int axis = -1;
+		in >> axis;
+		if (axis < 0 || axis >= dims)
+			throw std::runtime_error("** ERROR - Invalid split dimension at reconstruction protocol.\n");
+		axes.push_back (axis);
+	}
+
 	for (unsigned j = 0; j < hist.size(); ++j) {
 		std::string link_host;
 		in >> link_host;
@@ -202,6 +254,9 @@ template<class T> void Node<T>::initialize (std::string &msg) {
 		frontlink_ports.push_back(link_port);
 	}
 
+	/* the grid of the pool is laid over its region along with the tuples */
+	TupleArray<T> data (dims);
+
 	in >> junk;
 	if ( junk.compare ("#TUPLES") == 0 ) {
 		int quantity = 0;
@@ -210,9 +265,10 @@ template<class T> void Node<T>::initialize (std::string &msg) {
 
 		std::cerr << "** "<< id <<"@" << port << " is loading " << quantity << " tuples.\n";
 
-		for (int j = 0; j < quantity; ++j) {
-			T* key = new T [dims];
+		data.reserve (quantity);
 
+		T key [dims];
+		for (int j = 0; j < quantity; ++j) {
 			::stream2vec<T> (in, key, dims, ',');
 			::vec2stream<T> (std::cerr, key, dims, ',');
 			std::cerr << std::endl;
@@ -220,12 +276,10 @@ template<class T> void Node<T>::initialize (std::string &msg) {
 			std::string value;
 			in >> value;
 
-			char* buffer = new char [value.size() + 1];
-			strcpy(buffer, value.c_str());
-
-			pool.push(key, buffer);
+			data (key, ValueStore::create (value.data(), value.size()));
 		}
 	}
+	pool.bulk_load (data);
 }
 
 template<class T> void Node<T>::serve () {
@@ -238,290 +292,517 @@ template<class T> void Node<T>::serve () {
 	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED );
 	pthread_attr_setstacksize (&attr, THREAD_STACK_SIZE );
 
+	if (!compacting) {
+		if (pthread_create(&compactor, 0, ::compact<Node<T> >, static_cast<void*> (this)) != 0)
+			throw std::runtime_error("** ERROR - Unable to create the compaction thread.");
+		compacting = true;
+	}
+
+	if (!rebalancing && (overload_tuples > 0 || overload_rate > 0)) {
+		if (pthread_create(&rebalancer, 0, ::rebalance<Node<T> >, static_cast<void*> (this)) != 0)
+			throw std::runtime_error("** ERROR - Unable to create the rebalancing thread.");
+		rebalancing = true;
+	}
+
+	reactor = epoll_create1 (0);
+	if (reactor < 0)
+		throw std::runtime_error("** ERROR - Unable to create the reactor.");
+
+	/* the server socket is armed for one worker at a time as well */
+	listener = &ss;
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = 0;
+	if (epoll_ctl (reactor, EPOLL_CTL_ADD, ss.descriptor(), &ev) != 0)
+		throw std::runtime_error("** ERROR - Unable to watch the server socket.");
+
+	/* the serving thread is a worker too */
+	for (unsigned i = server_threads.size()+1; i < server_workers; ++i) {
+		pthread_t* thread = new pthread_t;
+		if (pthread_create(thread, &attr, ::work<Node<T> >, static_cast<void*> (this)) != 0)
+			throw std::runtime_error("** ERROR - Unable to create a new thread.");
+		server_threads.push_back(thread);
+	}
+	work ();
+}
+
+template<class T> void Node<T>::work () {
 	while (true) {
-		try {
-			ServerSocket* new_sock = new ServerSocket;
-			ss.accept(*new_sock);
+		epoll_event ev;
+		if (epoll_wait (reactor, &ev, 1, -1) != 1)
+			continue;
+
+		Connection* conn = static_cast<Connection*> (ev.data.ptr);
+		if (conn == 0) {
+			try {
+				conn = new Connection;
+				listener->accept(conn->sock);
+				conn->sock.set_non_blocking (true);
+
+				ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+				ev.data.ptr = conn;
+				if (epoll_ctl (reactor, EPOLL_CTL_ADD, conn->sock.descriptor(), &ev) != 0)
+					throw std::runtime_error("** ERROR - Unable to watch a new connection.");
+			} catch (std::exception &e) {
+				std::cerr << "** " << get_id() << "@" << port << " Server has caught an exception.\n";
+				delete conn;
+			}
+
+			ev.events = EPOLLIN | EPOLLONESHOT;
+			ev.data.ptr = 0;
+			epoll_ctl (reactor, EPOLL_CTL_MOD, listener->descriptor(), &ev);
+			continue;
+		}
+
+		/* the connection stays disarmed until its worker is done with it */
+		if (handle (*conn)) {
+			ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+			ev.data.ptr = conn;
+			if (epoll_ctl (reactor, EPOLL_CTL_MOD, conn->sock.descriptor(), &ev) == 0)
+				continue;
+		}
 
-			pthread_t* thread = new pthread_t;
-			std::pair<Node<T>*, ServerSocket*> *args = new std::pair<Node<T>*,
-					ServerSocket*>(this, new_sock);
+		epoll_ctl (reactor, EPOLL_CTL_DEL, conn->sock.descriptor(), 0);
+		delete conn;
+	}
+}
 
-			if (pthread_create(thread, &attr, ::handle<Node<T> >, static_cast<void*> (args)) != 0)
-				throw std::runtime_error("** ERROR - Unable to create a new thread.");
+template<class T> size_t Node<T>::frame (Connection& conn) const {
+	std::string& data = conn.data;
+	if (conn.offset == data.size())
+		return 0;
 
-			server_threads.push_back(thread);
-		} catch (std::exception &e) {
-			std::cerr << "** " << get_id() << "@" << port << " Server has caught an exception.\n";
+	/* a frame tells its length, so it is complete once that much is received */
+	if ((unsigned char) data.at(conn.offset) == FRAME_MAGIC) {
+		if (data.size()-conn.offset < FRAME_HEADER)
+			return 0;
+		size_t length = frame_length (data.data()+conn.offset);
+		if (length > MAXFRAME)
+			throw std::runtime_error ("Frame too large.");
+		if (data.size()-conn.offset < FRAME_HEADER+length) {
+			data.reserve (conn.offset+FRAME_HEADER+length);
+			return 0;
 		}
+		return FRAME_HEADER+length;
 	}
+
+	/* answers and multi-line messages end with a trailer, the rest with their line */
+	char symbol = data.at(conn.offset);
+	bool answer = data.compare (conn.offset, 4, "#ACK") == 0;
+	const char* trailer = "\n";
+	if (answer)
+		trailer = "#END";
+	else if (symbol == 'O' || symbol == 'G' || symbol == 'H')
+		trailer = "#END\n";
+	else if (symbol == 'B')
+		trailer = "\n#END\n";
+
+	size_t length = strlen (trailer);
+	size_t pos = data.find (trailer, std::max (conn.scanned, conn.offset));
+	if (pos == std::string::npos) {
+		/* only the tail received next is searched again */
+		conn.scanned = data.size() < length ? 0 : data.size()-length+1;
+		return 0;
+	}
+	conn.scanned = 0;
+
+	pos += length;
+	if (answer && pos < data.size() && data.at(pos) == '\n')
+		++pos;
+	return pos-conn.offset;
 }
 
-template<class T> void Node<T>::handle ( ServerSocket& sock ) {
-	while (true){
-		try{
-			/**
-			 * process client messages
-			 */
-			std::string data;
-			sock >> data;
-
-data_processing:
-			if (data.find("#ACK") != std::string::npos) {
-				/* get response message */
-				std::string answer;
-				answer = data;
-				while (answer.find("#END") == std::string::npos) {
-					std::string new_data;
-					sock >> new_data;
-					answer += new_data;
+template<class T> bool Node<T>::handle ( Connection& conn ) {
+	ServerSocket& sock = conn.sock;
+	std::string& data = conn.data;
+
+	int received = sock.drain (data);
+
+	bool routing = false;
+	try{
+		/**
+		 * process client messages
+		 */
+		size_t length;
+		while ((length = frame (conn)) > 0) {
+			/* the reply takes the form of the message */
+			bool framed = (unsigned char) data.at(conn.offset) == FRAME_MAGIC;
+			sock.set_framed (framed);
+
+			std::string msg;
+			if (framed)
+				msg = data.substr (conn.offset+FRAME_HEADER, length-FRAME_HEADER);
+			else
+				msg = data.substr (conn.offset, length);
+			conn.offset += length;
+
+			if (msg.empty())
+				continue;
+
+			if (msg.compare (0, 4, "#ACK") == 0) {
+				std::cerr<<"** "<<get_id()<<"@"<<port<<" received answer:\n"<<msg<<"\n";
+				continue;
+			}
+
+			char symbol = msg.at (0);
+			__atomic_add_fetch (&requests, 1, __ATOMIC_RELAXED);
+
+			/* a join splits the node, so it excludes the rest until the joining peer is linked */
+			routing = symbol != 'W' && symbol != 'I' && symbol != 'E';
+			if (symbol == 'S')
+				exclude_routing ();
+			else if (routing)
+				pthread_rwlock_rdlock (&routing_lock);
+
+			if (symbol == 'W'){
+				sock << marshalize(false);
+			}else if (symbol == 'I'){
+				std::stringstream out (std::stringstream::out);
+				out << "I " << get_data_load() << " ";
+				::put_text<double> (out, request_rate);
+				out << " " << get_id() << "\n";
+				sock << out.str();
+			}else if (symbol == 'R' && (::is_binary (msg) || msg.find_first_not_of (" \r\n", msg.rfind (')')+1) == std::string::npos)){
+				sock << process_collected_range_msg (msg);
+			}else if (symbol == 'K'){
+				sock << process_neighbors_msg (msg);
+			}else if (symbol == 'M'){
+				sock << marshalize(true);
+			}else if (symbol == 'O'){
+				unsigned sender_id_end_pos = msg.find ("\n");
+				std::string sender_id = msg.substr(2,sender_id_end_pos);
+
+				std::cerr << "** " << get_id() << "@" << port << " Received overlay maintenance message from node " << sender_id << ".\n";
+
+				unsigned msg_end_pos = msg.find ("#END\n") + 4;
+				std::string current;
+				current = msg.substr(sender_id_end_pos+1,msg_end_pos+1);
+
+				Node<T> marshalized (dims,current);
+
+				unsigned lcp_length = 0;
+				for (std::vector<bool>::const_iterator vi=hist.begin(); vi!=hist.end(); ++vi) {
+					if ((*vi && marshalized.get_id().at(lcp_length) == '1')
+					|| (!*vi && marshalized.get_id().at(lcp_length) == '0')) {
+						++lcp_length;
+					}else{
+						break;
+					}
 				}
-				answer += data.substr(0, data.find("#END")+5);
 
-				std::cerr<<"** "<<get_id()<<"@"<<port<<" received answer:\n"<<answer<<"\n";
-				//data.clear();
-				answer.clear();
-			}else{
-				unsigned pos = data.find ('\n');
-				if (pos != std::string::npos) {
-					std::string msg;
-					msg = data.substr (0, pos+1);
-					data = data.substr (pos+1, data.size()-pos+1);
-
-					if (msg.size() == 0)
-						continue;
-
-					char symbol = msg.at (0);
-
-					if (symbol == 'W'){
-						sock << marshalize(false);
-					}else if (symbol == 'M'){
-						sock << marshalize(true);
-					}else if (symbol == 'O'){
-						msg += data;
-						while (msg.find ("#END\n") == std::string::npos) {
-							std::string temp;
-							sock >> temp;
-							msg += temp;
-						}
+				std::cerr << "** " << get_id() << "@" << port << " Substituting skip-link #" << lcp_length
+						<< " from " << frontlink_hosts[lcp_length] << ":" << frontlink_ports[lcp_length]
+						<< " to " << marshalized.host << ":" << marshalized.port << ".\n";
 
-						unsigned sender_id_end_pos = msg.find ("\n");
-						std::string sender_id = msg.substr(2,sender_id_end_pos);
+				/* the old link stays until the new one is up, and fails on its own if its peer is gone */
+				try{
+					put_link (lcp_length, connect_link (marshalized.host, marshalized.port));
+					frontlink_hosts[lcp_length] = marshalized.host;
+					frontlink_ports[lcp_length] = marshalized.port;
+				}catch (std::exception &e){
+					std::cerr << "** " << get_id() << "@" << port << " unable to establish connection with link#" << lcp_length << " @" << marshalized.host << ":" << marshalized.port << ".\n";
+				}
 
-						std::cerr << "** " << get_id() << "@" << port << " Received overlay maintenance message from node " << sender_id << ".\n";
+				lcp_length = 0;
+				for (std::vector<bool>::const_iterator vi=hist.begin(); vi!=hist.end(); ++vi) {
+					if (*vi == sender_id.at(lcp_length)) {
+						++lcp_length;
+					}else{
+						break;
+					}
+				}
 
-						unsigned msg_end_pos = msg.find ("#END\n") + 4;
-						std::string current;
-						current = msg.substr(sender_id_end_pos+1,msg_end_pos+1);
+				/* the maintenance messages are all sent before any reply is awaited */
+				std::vector<Forward> forwards;
+				for (unsigned i=lcp_length+2; i<skip.size(); ++i) {
+					std::string link_id;
+					for (unsigned j=0; j<i; ++j) {
+						link_id.push_back (hist.at(j) ? '1' : '0');
+					}
+					link_id.push_back (hist.at(i) ? '0' : '1');
 
-						data.clear();
-						if (msg_end_pos + 1 <= msg.size ()) {
-							data = msg.substr(msg_end_pos+1,msg.size()-msg_end_pos);
-						}
+					std::cerr << "** " << get_id() << "@" << port << " Forwarding maintenance message to link#" << i << " with id " << link_id << "X.";
 
-						Node<T> marshalized (dims,current);
+					if (!post_link (i, "O " + get_id() + "\n" + current, "\n", forwards))
+						std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
+				}
+				for (unsigned f=0; f<forwards.size(); ++f) {
+					unsigned i = forwards[f].index;
+					try{
+						std::string response = collect (forwards[f]);
 
-						unsigned lcp_length = 0;
-						for (std::vector<bool>::const_iterator vi=hist.begin(); vi!=hist.end(); ++vi) {
-							if ((*vi && marshalized.get_id().at(lcp_length) == '1')
-							|| (!*vi && marshalized.get_id().at(lcp_length) == '0')) {
-								++lcp_length;
-							}else{
-								break;
-							}
+						if (response.compare("O OK\n") != 0){
+							std::cerr << "** " << get_id() << "@" << port << " Failed response from overlay maintenance message: " << msg;
 						}
+					}catch(std::exception &e){
+						std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
+					}
+				}
+				sock << "O OK\n";
+			}else if (symbol == 'Q'){
+				std::cerr << "** " << get_id() << "@" << port
+					<< " now quitting...\n";
+				depart();
+				unlink();
+				sock << "Q OK\n";
+				//pthread_exit(0);
+				exit(0);
+			}else if (symbol == 'G'){
+				if (process_merge_msg (msg) == 0) {
+					sock << "G OK\n";
+				}else{
+					sock << "G BAD\n";
+				}
+			}else if (symbol == 'B'){
+				if (process_batch_msg (msg) < 0) {
+					sock << "B BAD\n";
+				}else{
+					sock << "B OK\n";
+				}
+			}else if (symbol == 'S') {
+				std::stringstream in (msg,std::stringstream::in);
 
-						std::cerr << "** " << get_id() << "@" << port << " Substituting skip-link #" << lcp_length
-								<< " from " << frontlink_hosts[lcp_length] << ":" << frontlink_ports[lcp_length]
-								<< " to " << marshalized.host << ":" << marshalized.port << ".\n";
-
-						frontlink_hosts[lcp_length] = marshalized.host;
-						frontlink_ports[lcp_length] = marshalized.port;
-						skip [lcp_length] = new ClientSocket (marshalized.host,marshalized.port);
-
-						lcp_length = 0;
-						for (std::vector<bool>::const_iterator vi=hist.begin(); vi!=hist.end(); ++vi) {
-							if (*vi == sender_id.at(lcp_length)) {
-								++lcp_length;
-							}else{
-								break;
-							}
-						}
+				std::string remote_host;
+				std::string remote_port;
 
-						for (unsigned i=lcp_length+2; i<skip.size(); ++i) {
-							try{
-								std::string response;
-								std::string link_id;
-								for (unsigned j=0; j<i; ++j) {
-									link_id.push_back (hist.at(j) ? '1' : '0');
-								}
-								link_id.push_back (hist.at(i) ? '0' : '1');
-
-								std::cerr << "** " << get_id() << "@" << port << " Forwarding maintenance message to link#" << i << " with id " << link_id << "X.";
-
-								*skip.at(i) << "O " << get_id() << "\n" << current;
-								*skip.at(i) >> response;
-
-								if (response.compare("O OK\n") != 0){
-									std::cerr << "** " << get_id() << "@" << port << " Failed response from overlay maintenance message: " << msg;
-								}
-							}catch(std::exception &e){
-								std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
-								skip [i] = 0;
-							}
-						}
-						sock << "O OK\n";
-					}else if (symbol == 'Q'){
-						std::cerr << "** " << get_id() << "@" << port
-							<< " now quitting...\n";
-						depart();
-						unlink();
-						sock << "Q OK\n";
-						//pthread_exit(0);
-						exit(0);
-					}else if (symbol == 'G'){
-						msg += data;
-						while (msg.find ("#END\n") == std::string::npos) {
-							std::string temp;
-							sock >> temp;
-							msg += temp;
-						}
+				in >> symbol;
+				in >> remote_host;
+				in >> remote_port;
 
-						unsigned msg_end_pos = msg.find ("#END\n") + 4;
-						std::string current;
-						current = msg.substr(0,msg_end_pos+1);
+				/* the joining node answers on this connection, which its worker awaits */
+				if (cached.empty()) {
+					Node& sibling = split();
+					sibling.host = remote_host;
+					sibling.port = std::atoi(remote_port.c_str());
 
-						data.clear();
-						if (msg_end_pos + 1 <= msg.size ()) {
-							data = msg.substr(msg_end_pos+1,msg.size()-msg_end_pos);
-						}
+					sock << sibling.marshalize(true);
 
-						if (process_merge_msg (current) == 0) {
-							sock << "G OK\n";
-						}else{
-							sock << "G BAD\n";
-						}
-					}else if (symbol == 'S') {
-						std::stringstream in (msg,std::stringstream::in);
-
-						std::string remote_host;
-						std::string remote_port;
-
-						in >> symbol;
-						in >> remote_host;
-						in >> remote_port;
-
-						if (cached.empty()) {
-							Node& sibling = split();
-							sibling.host = remote_host;
-							sibling.port = std::atoi(remote_port.c_str());
-
-							sock << sibling.marshalize(true);
-
-							std::string response;
-							sock >> response;
-
-							if (response.compare("S OK\n") != 0) {
-								if (hist.back()) merge_lo (sibling);
-								else merge_hi (sibling);
-							}else{
-								frontlink_hosts.back() = remote_host;
-								frontlink_ports.back() = std::atoi(remote_port.c_str());
-								link();
-							}
-							delete &sibling;
-						}else{
-							Node<T>* stray = cached.back();
-							stray->host = remote_host;
-							stray->port = std::atoi(remote_port.c_str());
-
-							sock << stray->marshalize(true);
-							std::string response;
-							sock >> response;
-							if (response.compare("S OK\n") == 0) {
-								cached.pop_back();
-								delete stray;
-							}
-						}
+					/* the routing lock is held meanwhile, so a joiner silent for too long is merged back */
+					std::string response;
+					sock.set_timeout (JOIN_TIMEOUT);
+					try{
+						sock >> response;
+					}catch (std::exception &e){
+						std::cerr << "** " << get_id() << "@" << port << " got no answer from joining peer " << remote_host << ":" << remote_port << ".\n";
+					}
+					sock.set_timeout (-1);
+
+					if (response.compare("S OK\n") != 0) {
+						if (hist.back()) merge_lo (sibling);
+						else merge_hi (sibling);
 					}else{
-						std::string response;
-						response += symbol;
-						if (process_async_msg(msg)<0) response += " BAD\n";
-						else response += " OK\n";
-						sock << response;
+						frontlink_hosts.back() = remote_host;
+						frontlink_ports.back() = std::atoi(remote_port.c_str());
+						link();
 					}
-					goto data_processing;
+					delete &sibling;
 				}else{
-					std::string new_data;
-					sock >> new_data;
-					data += new_data;
-					goto data_processing;
+					Node<T>* stray = cached.back();
+					stray->host = remote_host;
+					stray->port = std::atoi(remote_port.c_str());
+
+					sock << stray->marshalize(true);
+					std::string response;
+					sock.set_timeout (JOIN_TIMEOUT);
+					try{
+						sock >> response;
+					}catch (std::exception &e){
+						std::cerr << "** " << get_id() << "@" << port << " got no answer from joining peer " << remote_host << ":" << remote_port << ".\n";
+					}
+					sock.set_timeout (-1);
+					if (response.compare("S OK\n") == 0) {
+						cached.pop_back();
+						delete stray;
+					}
 				}
+			}else{
+				/* a peer links with an encoding offer, and its replies name the owner of what it forwards */
+				if (symbol == 'E')
+					conn.peer = true;
+
+				std::string response, owner;
+				response += symbol;
+				if (process_async_msg(msg, conn.peer ? &owner : 0)<0) response += " BAD\n";
+				else if (!owner.empty()) response += " OK " + owner;
+				else response += " OK\n";
+				sock << response;
 			}
-		}catch (std::exception &e){
-			if (hist.empty())
-				pthread_exit (0);
+
+			if (routing)
+				pthread_rwlock_unlock (&routing_lock);
+			routing = false;
+		}
+
+		/* handled messages are dropped at once rather than one by one */
+		data.erase (0, conn.offset);
+		conn.scanned = conn.scanned > conn.offset ? conn.scanned-conn.offset : 0;
+		conn.offset = 0;
+	}catch (std::exception &e){
+		if (routing)
+			pthread_rwlock_unlock (&routing_lock);
+		std::cerr << "** " << get_id() << "@" << port << " Handler has caught an exception. (" << e.what() << ")\n";
+		probe_links ();
+		return false;
+	}
+
+	/* a peer that went away may have been a node of the overlay */
+	if (received < 0) {
+		probe_links ();
+		return false;
+	}
+	return true;
+}
+
+template<class T> void Node<T>::probe_links () {
+	if (hist.empty())
+		return;
 
 #ifdef __TIMING__
-			timeval tim;
-			gettimeofday (&tim, NULL);
-			double t1 = tim.tv_sec + (tim.tv_usec/1000000.0);
+	timeval tim;
+	gettimeofday (&tim, NULL);
+	double t1 = tim.tv_sec + (tim.tv_usec/1000000.0);
 #endif
 
-			std::cerr << "** " << get_id() << "@" << port << " Handler has caught an exception. (" << e.what() << ")\n";
-			unsigned i = 0;
-			for (std::vector<ClientSocket*>::iterator vi=skip.begin(); vi!=skip.end(); ++vi) {
-				try{
-					if ((*vi)->is_valid()) {
-						std::string whois_response;
-						*skip.at(i) << "W\n";
-						*skip.at(i) >> whois_response;
-						std::cerr << "** " << get_id() << "@" << port << " Confirmed status of skip-link #" << i << "\n";
-					}
-				}catch(std::exception &e){
-					std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
-					*vi = 0;
-				}
-				++i;
-			}
+	/* every link is probed at once, and the replies awaited afterwards */
+	std::vector<Forward> forwards;
+	for (unsigned i=0; i<skip.size(); ++i) {
+		Link* link = hold_link (i);
+		if (link == 0)
+			continue;
+		if (!link->is_valid()) {
+			std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
+			drop_link (i, link);
+			release_link (link);
+			continue;
+		}
+		release_link (link);
+		if (!post_link (i, "W\n", "#END\n", forwards))
+			std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
+	}
+	for (unsigned f=0; f<forwards.size(); ++f) {
+		unsigned i = forwards[f].index;
+		try{
+			collect (forwards[f]);
+			std::cerr << "** " << get_id() << "@" << port << " Confirmed status of skip-link #" << i << "\n";
+		}catch(std::exception &e){
+			std::cerr << "** " << get_id() << "@" << port << " Removing skip-link #" << i << "\n";
+		}
+	}
 
 #ifdef __TIMING__
-				gettimeofday (&tim, NULL);
-				double t2 = tim.tv_sec + (tim.tv_usec/1000000.0);
+	gettimeofday (&tim, NULL);
+	double t2 = tim.tv_sec + (tim.tv_usec/1000000.0);
 
-				std::cerr << "SELF-ACTIVATION RESPONSE TIME: " << t2-t1 << " seconds elapsed.\n";
+	std::cerr << "SELF-ACTIVATION RESPONSE TIME: " << t2-t1 << " seconds elapsed.\n";
 #endif
+}
 
-			pthread_exit (0);
-		}
+template<class T> Link* Node<T>::hold_link ( unsigned j ) const {
+	pthread_mutex_lock (&skip_lock);
+	Link* link = j < skip.size() ? skip[j] : 0;
+	if (link != 0)
+		link->hold();
+	pthread_mutex_unlock (&skip_lock);
+	return link;
+}
+
+template<class T> void Node<T>::release_link ( Link* link ) const {
+	if (link != 0 && link->release())
+		delete link;
+}
+
+template<class T> void Node<T>::drop_link ( unsigned j, Link* link ) {
+	pthread_mutex_lock (&skip_lock);
+	bool held = j < skip.size() && skip[j] == link;
+	if (held)
+		skip[j] = 0;
+	pthread_mutex_unlock (&skip_lock);
+
+	/* the reference of the slot goes only once, whoever else saw the link fail */
+	if (held)
+		release_link (link);
+}
+
+template<class T> void Node<T>::put_link ( unsigned j, Link* link ) {
+	pthread_mutex_lock (&skip_lock);
+	Link* old = skip.at(j);
+	skip[j] = link;
+	pthread_mutex_unlock (&skip_lock);
+	release_link (old);
+}
+
+template<class T> bool Node<T>::post_link ( unsigned j, const std::string& msg, const char* trailer, std::vector<Forward>& forwards ) {
+	return post_link (j, msg, std::string(), trailer, forwards);
+}
+
+template<class T> bool Node<T>::post_link ( unsigned j, const std::string& msg, const std::string& binary_msg, const char* trailer, std::vector<Forward>& forwards ) {
+	Link* link = hold_link (j);
+	if (link == 0)
+		return false;
+	try{
+		bool binary = link->is_binary() && !binary_msg.empty();
+		forwards.push_back (Forward (j, link, link->post (binary ? binary_msg : msg, trailer)));
+		return true;
+	}catch(std::exception &e){
+		drop_link (j, link);
+		release_link (link);
+		return false;
+	}
+}
+
+template<class T> std::string Node<T>::collect ( Forward& forward ) {
+	try{
+		std::string response = forward.link->wait (forward.ticket);
+		release_link (forward.link);
+		return response;
+	}catch(std::exception &e){
+		drop_link (forward.index, forward.link);
+		release_link (forward.link);
+		throw;
 	}
 }
 
-template<class T> int Node<T>::process_async_msg ( std::string& msg ) {
+template<class T> int Node<T>::process_async_msg ( std::string& msg, std::string* owner ) {
 	char req_type = msg.at (0);
 
 	switch (req_type){
 
 	/* update (key,value) pair */
 	case 'U':
-		return process_insert_msg (msg);
+		return process_insert_msg (msg, owner);
 
 	/* update (key,old_value+new_value) pair */
 	case 'A':
-		return process_append_msg (msg);
+		return process_append_msg (msg, owner);
 
 	/* lookup key */
 	case 'L':
-		return process_lookup_msg (msg);
+		return process_lookup_msg (msg, owner);
 
 	/* lookup key range */
 	case 'R':
 		return process_range_msg (msg);
 
+	/* aggregate key range */
+	case 'C':
+		return process_aggregate_msg (msg);
+
 	/* nearest neighbor request */
 	case 'N':
 		return process_nearest_msg (msg);
 
+	/* delete key */
+	case 'D':
+		return process_delete_msg (msg, owner);
+
+	/* binary encoding offered by a peer */
+	case 'E':
+		return process_encoding_msg (msg);
+
+	/* boundary shifted by the sibling */
+	case 'H':
+		return process_shift_msg (msg);
+
 	default:
 		std::cerr << "** " << get_id() << "@" << port
 			<< " met unknown message format.\n-- UNKNOWN FORMAT START --\n"
@@ -532,68 +813,179 @@ template<class T> int Node<T>::process_async_msg ( std::string& msg ) {
 }
 
 /**
- * U(.5,.5)dummy_value_string\n
+ * E 2 8\n
+ *
+ * A peer offers binary tuples of dims coordinates of the given width,
+ * which it may send only if they match ours.
  */
-template<class T> int Node<T>::process_insert_msg ( std::string& msg ) {
+template<class T> int Node<T>::process_encoding_msg ( std::string& msg ) {
+	std::stringstream in (msg, std::stringstream::in);
+
+	char symbol;
+	int peer_dims = 0;
+	size_t width = 0;
+	in >> symbol >> peer_dims >> width;
+
+	return peer_dims == dims && width == sizeof(T) ? 0 : -1;
+}
+
+template<class T> void Node<T>::negotiate ( ClientSocket* link ) const {
+	link->set_framed (framed_protocol);
+
+	/* the offer also tells the peer that a node is linking, so binary tuples are only taken up over frames */
+	std::stringstream out;
+	out << "E " << dims << " " << sizeof(T) << "\n";
+	*link << out.str();
+
+	std::string response;
+	link->set_timeout (LINK_TIMEOUT);
+	*link >> response;
+	link->set_timeout (-1);
+	link->set_binary (framed_protocol && response.compare ("E OK\n") == 0);
+}
+
+/*
+ * A joiner answers before it listens, so a refused connection is tried
+ * again until the link runs out of time.
+ */
+template<class T> Link* Node<T>::connect_link ( const std::string& link_host, int link_port ) const {
+	timespec start;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+
+	ClientSocket* cs = 0;
+	for (;;) {
+		timespec now;
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		int left = LINK_TIMEOUT - (now.tv_sec-start.tv_sec)*1000 - (now.tv_nsec-start.tv_nsec)/1000000;
+		if (left <= 0)
+			throw std::runtime_error ("Could not connect skip-link.");
+		try{
+			cs = new ClientSocket (link_host, link_port, left);
+			break;
+		}catch (std::exception &e){
+			usleep (LINK_RETRY);
+		}
+	}
+
+	try{
+		negotiate (cs);
+		return new Link (cs);
+	}catch (std::exception &e){
+		delete cs;
+		throw;
+	}
+}
+
+template<class T> void Node<T>::parse_tuple_msg ( std::string& msg, char type, T* key, std::string& value ) const {
+	if (msg.at(0) != type)
+		throw std::runtime_error (" Bad request header.\n");
+
+	if (::is_binary (msg)) {
+		size_t pos = 2;
+		::get_key<T> (msg, pos, key, dims);
+		if (type != 'D')
+			::get_value (msg, pos, value);
+		return;
+	}
+
 	std::stringstream in (msg, std::stringstream::in);
 
 	char symbol;
 	in >> symbol;
-	if (symbol != 'U')
-		throw std::runtime_error (" Bad update query header.\n");
 
 	in >> symbol;
 	if (symbol != '(')
-		throw std::runtime_error (" Bad update request message. Opening parenthesis expected.\n");
+		throw std::runtime_error (" Bad request message. Opening parenthesis expected.\n");
 
-	T *key = new T [dims];
 	::stream2vec<T> (in, key, dims, ',');
 
 	in >> symbol;
 	if (symbol != ')')
-		throw std::runtime_error (" Bad update request message. Closing parenthesis expected.\n");
+		throw std::runtime_error (" Bad request message. Closing parenthesis expected.\n");
+
+	if (type != 'D')
+		value = msg.substr (in.tellg(), msg.size()-in.tellg()-1);
+}
+
+template<class T> void Node<T>::encode_entry ( std::string& out, bool binary, char type, T* key, const std::string& value ) const {
+	out += type;
+	if (binary) {
+		::put_key<T> (out, key, dims);
+		if (type != 'D')
+			::put_value (out, value.data(), value.size());
+		return;
+	}
+
+	std::stringstream text;
+	text << "(";
+	::vec2stream<T> (text, key, dims, ',');
+	text << ")";
+	if (type != 'D')
+		text << value;
+	text << "\n";
+	out += text.str();
+}
+
+template<class T> std::string Node<T>::relay ( const Link* link, char type, T* key, const std::string& value, std::string& msg ) const {
+	bool binary = link->is_binary();
+	if (binary == ::is_binary (msg))
+		return msg;
+
+	std::string out;
+	encode_entry (out, binary, type, key, value);
+	if (binary)
+		out.insert (1, 1, BINARY_TAG);
+	return out;
+}
 
-	std::string value = msg.substr (in.tellg(), msg.size()-in.tellg()-1);
+/**
+ * U(.5,.5)dummy_value_string\n
+ */
+template<class T> int Node<T>::process_insert_msg ( std::string& msg, std::string* owner ) {
+	T key [dims];
+	std::string value;
+	parse_tuple_msg (msg, 'U', key, value);
 
-	if (!pool.isRelevant(key)){
-		int dest_link = forward_to(key);
+	int dest_link;
+	if (beyond (key, dest_link)) {
 
 		if (dest_link == -1)
 			throw std::runtime_error(" Unable to forward update request.\n");
 
-		try{
-			if (skip.at(dest_link) == 0) {
-				for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi) {
-					if ((*vi)->pool.isRelevant(key)) {
-						std::cerr << "** " << (*vi)->get_id() << "@" << (*vi)->port << " is indexing in cached node value '" << value << "' by key ";
-						::vec2stream<T>(std::cerr,key,dims,',');
-						std::cerr << "\n";
-
-						char* buffer = (char*) malloc (value.size() + 1);
-						strcpy (buffer, value.c_str());
-
-						//pthread_mutex_lock (&(*vi)->pool_lock);
-						(*vi)->pool.update(key, buffer);
-						//pthread_mutex_unlock (&(*vi)->pool_lock);
-						return 0;
-					}
-				}
-			}else{
-				//skip.at(dest_link)->open();
-				*skip.at(dest_link) << msg;
+		int routed = forward_route (dest_link, 'U', key, value, msg, owner);
+		if (routed != 0)
+			return routed;
 
-				std::string response;
-				*skip.at(dest_link) >> response;
+		Link* link = hold_link (dest_link);
+		if (link != 0) {
+			std::string response;
+			try{
+				response = link->request (relay (link, 'U', key, value, msg));
+			}catch (std::exception &e){
+				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
+				drop_link (dest_link, link);
+				release_link (link);
+				return -1;
+			}
+			release_link (link);
+
+			if (!accept_reply ('U', response, frontlink_hosts.at(dest_link), frontlink_ports.at(dest_link), owner)){
+				std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
+				return -1;
+			}
+		}else{
+			for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi) {
+				if ((*vi)->pool.isRelevant(key)) {
+					std::cerr << "** " << (*vi)->get_id() << "@" << (*vi)->port << " is indexing in cached node value '" << value << "' by key ";
+					::vec2stream<T>(std::cerr,key,dims,',');
+					std::cerr << "\n";
 
-				if (response.compare("U OK\n") != 0){
-					std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
-					return -1;
+					(*vi)->pool.update(key, ValueStore::create (value.data(), value.size()));
+					if (owner != 0)
+						*owner = describe_owner (**vi);
+					return 0;
 				}
 			}
-		}catch (std::exception &e){
-			std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
-			skip.at(dest_link) = 0;
-			return -1;
 		}
 		std::cerr << "** Server@" << port << " forwarding to link#" << dest_link << " message " << msg;
 		return 1;
@@ -602,12 +994,10 @@ template<class T> int Node<T>::process_insert_msg ( std::string& msg ) {
 		::vec2stream<T>(std::cerr,key,dims,',');
 		std::cerr << "\n";
 
-		char* buffer = (char*) malloc (value.size() + 1);
-		strcpy (buffer, value.c_str());
-
-//		pthread_mutex_lock (&pool_lock);
-		pool.update(key, buffer);
-//		pthread_mutex_unlock (&pool_lock);
+		pool.update(key, ValueStore::create (value.data(), value.size()));
+		observe (key, key);
+		if (owner != 0)
+			*owner = describe_owner (*this);
 		return 0;
 	}
 }
@@ -615,84 +1005,656 @@ template<class T> int Node<T>::process_insert_msg ( std::string& msg ) {
 /**
  * A(.5,.5)dummy_value_string\n
  */
-template<class T> int Node<T>::process_append_msg ( std::string& msg ) {
-	std::stringstream in(msg, std::stringstream::in);
+template<class T> int Node<T>::process_append_msg ( std::string& msg, std::string* owner ) {
+	T key [dims];
+	std::string value;
+	parse_tuple_msg (msg, 'A', key, value);
 
-	char symbol;
-	in >> symbol;
-	if (symbol != 'A')
-		throw std::runtime_error(" Bad append request header.\n");
+	int dest_link;
+	if (beyond (key, dest_link)) {
 
-	in >> symbol;
-	if (symbol != '(')
-		throw std::runtime_error(" Bad append request message. Opening parenthesis expected.\n");
+		if (dest_link == -1)
+			throw std::runtime_error(" Unable to forward update request.\n");
 
-	T* key = new T[dims];
-	::stream2vec<T> ( in, key, dims, ',' );
+		int routed = forward_route (dest_link, 'A', key, value, msg, owner);
+		if (routed != 0)
+			return routed;
 
-	in >> symbol;
-	if ( symbol != ')' )
-		throw std::runtime_error (" Bad append request message. Closing parenthesis expected.\n");
+		Link* link = hold_link (dest_link);
+		if (link != 0) {
+			std::string response;
+			try{
+				response = link->request (relay (link, 'A', key, value, msg));
+			}catch (std::exception &e){
+				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
+				drop_link (dest_link, link);
+				release_link (link);
+				return -1;
+			}
+			release_link (link);
+
+			if (!accept_reply ('A', response, frontlink_hosts.at(dest_link), frontlink_ports.at(dest_link), owner)){
+				std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
+				return -1;
+			}
+		}else{
+			for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi) {
+				if ((*vi)->pool.isRelevant(key)) {
+					std::cerr << "** " << (*vi)->get_id() << "@" << (*vi)->port << " is appending in cache locally value: " << value << "\n";
+
+					(*vi)->pool.append(key, value.data(), value.size());
+					if (owner != 0)
+						*owner = describe_owner (**vi);
+					return 0;
+				}
+			}
+		}
+		std::cerr << "** Server@" << port << " forwarding to link#" << dest_link << " message " << msg;
+		return 1;
+	}else{
+		std::cerr << "** " << get_id() << "@" << port << " is appending indexed locally value: " << value << "\n";
+
+		pool.append(key, value.data(), value.size());
+		observe (key, key);
+		if (owner != 0)
+			*owner = describe_owner (*this);
+		return 0;
+	}
+}
 
-	std::string value = msg.substr(in.tellg(), msg.size() - in.tellg() - 1);
+/**
+ * B\n
+ * U(.5,.5)dummy_value_string\n
+ * A(.2,.7)another_value_string\n
+ * #END\n
+ *
+ * Pairs bound elsewhere leave in one sub-batch per link, and the local
+ * updates are indexed at once. Appends of a batch apply after its updates.
+ * Between peers the batch may be binary, a run of pairs after its tag.
+ */
+template<class T> int Node<T>::process_batch_msg ( std::string& msg ) {
+	bool binary = ::is_binary (msg);
+	if (!binary && msg.compare (0, 2, "B\n") != 0)
+		throw std::runtime_error (" Bad batch request header.\n");
 
-	if (!pool.isRelevant(key)) {
-		int dest_link = forward_to(key);
+	TupleArray<T> updates (dims);
+	std::vector<std::pair<std::vector<T>,std::string> > appends;
+	std::map<int,std::string> forwards;
+	int status = 0;
 
-		if (dest_link == -1)
-			throw std::runtime_error(" Unable to forward update request.\n");
+	/* the links met are held until their sub-batches are collected */
+	std::map<int,Link*> links;
 
-		try{
-			if (skip.at(dest_link) == 0) {
-				for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi) {
-					if ((*vi)->pool.isRelevant(key)) {
-						std::cerr << "** " << (*vi)->get_id() << "@" << (*vi)->port << " is appending in cache locally value: " << value << "\n";
-
-						char *buffer = new char[value.size() + 1];
-						strcpy(buffer, value.c_str());
-
-						//pthread_mutex_lock (&pool_lock);
-						(*vi)->pool.concatenate(key, buffer);
-						//pthread_mutex_unlock (&pool_lock);
-						return 0;
-					}
-				}
+	T key [dims];
+	std::string value;
+	std::stringstream in;
+	size_t begin = 2;
+	try{
+		for (size_t end; begin < msg.size(); begin = end) {
+			char type;
+			if (binary) {
+				end = begin;
+				type = msg.at (end++);
+				if (type != 'U' && type != 'A')
+					throw std::runtime_error (" Bad batch request message. Update or append expected.\n");
+				::get_key<T> (msg, end, key, dims);
+				::get_value (msg, end, value);
 			}else{
-				//skip.at(dest_link)->open();
-				*skip.at(dest_link) << msg;
+				end = msg.find ('\n', begin);
+				if (end == std::string::npos)
+					break;
+				std::string line = msg.substr (begin, ++end-begin);
+				if (line.compare ("#END\n") == 0)
+					break;
 
-				std::string response;
-				*skip.at(dest_link) >> response;
+				in.clear ();
+				in.str (line);
 
-				if (response.compare("A OK\n") != 0){
-					std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
-					return -1;
+				char symbol;
+				in >> symbol;
+				if (symbol != 'U' && symbol != 'A')
+					throw std::runtime_error (" Bad batch request message. Update or append expected.\n");
+				type = symbol;
+
+				in >> symbol;
+				if (symbol != '(')
+					throw std::runtime_error (" Bad batch request message. Opening parenthesis expected.\n");
+
+				::stream2vec<T> (in, key, dims, ',');
+
+				in >> symbol;
+				if (symbol != ')')
+					throw std::runtime_error (" Bad batch request message. Closing parenthesis expected.\n");
+
+				value = line.substr (in.tellg(), line.size()-in.tellg()-1);
+			}
+
+			int dest_link;
+			if (!beyond (key, dest_link)) {
+				if (type == 'U')
+					updates (key, ValueStore::create (value.data(), value.size()));
+				else
+					appends.push_back (std::make_pair (std::vector<T> (key, key+dims), value));
+				continue;
+			}
+
+			if (dest_link == -1)
+				throw std::runtime_error(" Unable to forward batch request.\n");
+
+			std::map<int,Link*>::iterator li = links.find (dest_link);
+			if (li == links.end())
+				li = links.insert (std::make_pair (dest_link, hold_link (dest_link))).first;
+			if (li->second != 0) {
+				/* a pair is copied as it came unless the link takes the other encoding */
+				if (li->second->is_binary() == binary)
+					forwards[dest_link].append (msg, begin, end-begin);
+				else
+					encode_entry (forwards[dest_link], !binary, type, key, value);
+				continue;
+			}
+
+			status = -1;
+			for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi) {
+				if ((*vi)->pool.isRelevant(key)) {
+					if (type == 'U')
+						(*vi)->pool.update(key, ValueStore::create (value.data(), value.size()));
+					else
+						(*vi)->pool.append(key, value.data(), value.size());
+					status = 0;
+					break;
 				}
 			}
+		}
+	}catch (std::exception &e){
+		for (std::map<int,Link*>::iterator li=links.begin(); li!=links.end(); ++li)
+			release_link (li->second);
+		throw;
+	}
+
+	/* the sub-batches are all sent before any reply is awaited */
+	std::vector<Forward> pending;
+	for (std::map<int,std::string>::iterator mi=forwards.begin(); mi!=forwards.end(); ++mi) {
+		int dest_link = mi->first;
+		Link* link = links[dest_link];
+		try{
+			if (link->is_binary())
+				pending.push_back (Forward (dest_link, link, link->post (std::string ("B") + BINARY_TAG + mi->second)));
+			else
+				pending.push_back (Forward (dest_link, link, link->post ("B\n" + mi->second + "#END\n")));
+		}catch (std::exception &e){
+			std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
+			drop_link (dest_link, link);
+			release_link (link);
+			status = -1;
+		}
+	}
+	for (unsigned f=0; f<pending.size(); ++f) {
+		int dest_link = pending[f].index;
+		try{
+			std::string response = collect (pending[f]);
+
+			if (response.compare("B OK\n") != 0){
+				std::cerr << "** " << get_id() << "@" << port << " failed to forward batch to link#" << dest_link << ".\n";
+				status = -1;
+			}
 		}catch (std::exception &e){
 			std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
-			skip.at(dest_link) = 0;
+			status = -1;
+		}
+	}
+
+	std::cerr << "** " << get_id() << "@" << port << " is indexing locally a batch of "
+			<< updates.size() << " updates and " << appends.size() << " appends.\n";
+
+	pool.push_batch (updates);
+	for (unsigned i=0; i<appends.size(); ++i)
+		pool.append (&appends[i].first[0], appends[i].second.data(), appends[i].second.size());
+	return status;
+}
+
+/**
+ * D(.5,.5)\n
+ */
+template<class T> int Node<T>::process_delete_msg ( std::string& msg, std::string* owner ) {
+	T key [dims];
+	std::string value;
+	parse_tuple_msg (msg, 'D', key, value);
+
+	Node<T>* holder = this;
+	int dest_link;
+	if (beyond (key, dest_link)) {
+
+		if (dest_link == -1)
+			throw std::runtime_error(" Unable to forward delete request.\n");
+
+		int routed = forward_route (dest_link, 'D', key, value, msg, owner);
+		if (routed != 0)
+			return routed;
+
+		holder = 0;
+		Link* link = hold_link (dest_link);
+		if (link != 0) {
+			std::string response;
+			try{
+				response = link->request (relay (link, 'D', key, value, msg));
+			}catch (std::exception &e){
+				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
+				drop_link (dest_link, link);
+				release_link (link);
+				return -1;
+			}
+			release_link (link);
+
+			if (!accept_reply ('D', response, frontlink_hosts.at(dest_link), frontlink_ports.at(dest_link), owner)){
+				std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
+				return -1;
+			}
+			std::cerr << "** Server@" << port << " forwarding to link#" << dest_link << " message " << msg;
+			return 1;
+		}
+		for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi)
+			if ((*vi)->pool.isRelevant(key))
+				holder = *vi;
+		if (holder == 0)
 			return -1;
+	}
+
+	std::cerr << "** " << holder->get_id() << "@" << holder->port << " is deleting key ";
+	::vec2stream<T>(std::cerr,key,dims,',');
+	std::cerr << "\n";
+
+	if (owner != 0)
+		*owner = describe_owner (*holder);
+
+	/* the key turns into a tombstone, compaction is left to the background */
+	if (!holder->pool.erase(key))
+		return 0;
+
+	pthread_mutex_lock (&holder->compaction_lock);
+	unsigned tombstones = holder->pool.get_tombstones();
+	if (tombstones > 0 && tombstones >= compaction_ratio * (holder->pool.get_size() + tombstones))
+		pthread_cond_signal (&holder->compaction_cond);
+	pthread_mutex_unlock (&holder->compaction_lock);
+	return 0;
+}
+
+/*
+ * Deletions wake the compactor once tombstones reach the compaction ratio
+ * of the pool, which then rebuilds it as a whole. A periodic pass after
+ * fresh deletions rebuilds the subtrees that are degraded beyond that
+ * ratio on their own, so localized churn is shed early.
+ */
+template<class T> void Node<T>::compact () {
+	unsigned last = 0;
+
+	pthread_mutex_lock (&compaction_lock);
+	while (!quitting) {
+		unsigned tombstones = pool.get_tombstones();
+		if (tombstones > 0 && tombstones != last) {
+			/* readers and writers go on while the pool compacts */
+			pthread_mutex_unlock (&compaction_lock);
+			pool.compact (compaction_ratio);
+			pthread_mutex_lock (&compaction_lock);
+			if (pool.get_tombstones() != tombstones)
+				std::cerr << "** " << get_id() << "@" << port << " compacted "
+						<< tombstones - pool.get_tombstones() << " tombstones.\n";
 		}
-		std::cerr << "** Server@" << port << " forwarding to link#" << dest_link << " message " << msg;
-		return 1;
+		last = pool.get_tombstones();
+
+		timespec deadline;
+		clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += COMPACTION_PERIOD;
+		pthread_cond_timedwait (&compaction_cond, &compaction_lock, &deadline);
+	}
+	pthread_mutex_unlock (&compaction_lock);
+}
+
+template<class T> void Node<T>::stop_compaction () {
+	if (!compacting)
+		return;
+
+	pthread_mutex_lock (&compaction_lock);
+	quitting = true;
+	pthread_cond_signal (&compaction_cond);
+	pthread_mutex_unlock (&compaction_lock);
+
+	pthread_join (compactor, 0);
+	compacting = false;
+}
+
+/*
+ * An overloaded node, whether by its tuples or by the messages it handles
+ * per second, sheds load once per period. A spare peer in standby is asked
+ * to join at the node, which then splits its region in half with it as
+ * with any joining peer. Without spares the node shifts the boundary it
+ * shares with its sibling, if the sibling is a leaf as well, so that each
+ * holds about half of what they hold together; only the tuples in between
+ * migrate.
+ */
+template<class T> void Node<T>::rebalance () {
+	unsigned long long handled = __atomic_load_n (&requests, __ATOMIC_RELAXED);
+	unsigned awaited = 0, patience = 0;
+	timespec then;
+	clock_gettime (CLOCK_MONOTONIC, &then);
+
+	pthread_mutex_lock (&compaction_lock);
+	while (!quitting) {
+		timespec deadline;
+		clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += REBALANCE_PERIOD;
+		pthread_cond_timedwait (&rebalance_cond, &compaction_lock, &deadline);
+		if (quitting)
+			break;
+		pthread_mutex_unlock (&compaction_lock);
+
+		timespec now;
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		double elapsed = (now.tv_sec-then.tv_sec) + (now.tv_nsec-then.tv_nsec)/1e9;
+		unsigned long long count = __atomic_load_n (&requests, __ATOMIC_RELAXED);
+		if (elapsed > 0)
+			request_rate = (count-handled) / elapsed;
+		handled = count;
+		then = now;
+
+		/* a recruited spare is given a few periods to join before anything else is shed */
+		bool crowded = overload_tuples > 0 && get_data_load() > overload_tuples;
+		bool busy = overload_rate > 0 && request_rate > overload_rate;
+		bool waiting = hist.size() < awaited && patience > 0;
+		if (waiting)
+			--patience;
+		else if ((crowded || busy) && recruit_spare ()) {
+			awaited = hist.size()+1;
+			patience = 5;
+		}else if (crowded || busy)
+			shift_boundary (!crowded);
+
+		pthread_mutex_lock (&compaction_lock);
+	}
+	pthread_mutex_unlock (&compaction_lock);
+}
+
+/*
+ * A handler may await a peer that sends a message back here, say a
+ * sub-query of a nearest neighbor query it forwarded, which a pending
+ * writer would hold off for good. The writer gives way every so often
+ * instead, and lets such messages in.
+ */
+template<class T> void Node<T>::exclude_routing () {
+	for (;;) {
+		timespec deadline;
+		clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += ROUTING_PATIENCE;
+		if (deadline.tv_nsec >= 1000000000) {
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+		if (pthread_rwlock_timedwrlock (&routing_lock, &deadline) == 0)
+			return;
+		sched_yield ();
+	}
+}
+
+template<class T> void Node<T>::stop_rebalancing () {
+	if (!rebalancing)
+		return;
+
+	pthread_mutex_lock (&compaction_lock);
+	quitting = true;
+	pthread_cond_signal (&rebalance_cond);
+	pthread_mutex_unlock (&compaction_lock);
+
+	pthread_join (rebalancer, 0);
+	rebalancing = false;
+}
+
+/**
+ * J 127.0.0.1 6000\n
+ *
+ * A spare peer in standby joins at the given node once told so.
+ */
+template<class T> bool Node<T>::recruit_spare () {
+	while (!spare_peers.empty()) {
+		std::pair<std::string,int> spare = spare_peers.back();
+		spare_peers.pop_back();
+		try{
+			ClientSocket cs (spare.first, spare.second, RECRUIT_TIMEOUT);
+			cs << "J " + host + " " + std::to_string(port) + "\n";
+
+			std::string response;
+			cs >> response;
+			if (response.compare ("J OK\n") == 0) {
+				std::cerr << "** " << get_id() << "@" << port << " is overloaded and recruited spare peer "
+						<< spare.first << ":" << spare.second << ".\n";
+				return true;
+			}
+		}catch (std::exception &e){
+		}
+		std::cerr << "** " << get_id() << "@" << port << " unable to recruit spare peer "
+				<< spare.first << ":" << spare.second << ".\n";
+	}
+	return false;
+}
+
+/**
+ * H 0110 .375\n
+ * #TUPLES 2\n
+ * .3,.4 value\n
+ * .3,.35 value\n
+ * #END\n
+ *
+ * The boundary moves to where the loads of the siblings even out, by
+ * tuples or by requests, as long as enough is at stake. The tuples beyond
+ * it are taken out of the pool and the split point is moved at once, while
+ * no handler routes; the sibling is told before any handler may route to
+ * it by the new point, so whatever it is sent for the tuples in between
+ * comes after them. If the sibling does not take them, they are put back.
+ */
+template<class T> bool Node<T>::shift_boundary ( bool by_rate ) {
+	if (hist.empty() || !cached.empty())
+		return false;
+
+	unsigned L = hist.size()-1;
+	Link* link = hold_link (L);
+	if (link == 0)
+		return false;
+	if (!link->is_valid()) {
+		drop_link (L, link);
+		release_link (link);
+		return false;
+	}
+
+	unsigned sibling_load = 0;
+	double sibling_rate = 0;
+	std::string sibling_id;
+	try{
+		std::stringstream in (link->request ("I\n"), std::stringstream::in);
+		char symbol;
+		in >> symbol;
+		in >> sibling_load;
+		::get_text<double> (in, sibling_rate);
+		in >> sibling_id;
+	}catch (std::exception &e){
+		drop_link (L, link);
+		release_link (link);
+		return false;
+	}
+
+	/* the sibling holds the other half of the last split only if it was never split itself */
+	std::string id = get_id();
+	if (sibling_id.size() != id.size() || sibling_id.compare (0, L, id, 0, L) != 0 || sibling_id.at(L) == id.at(L)) {
+		release_link (link);
+		return false;
+	}
+
+	double load = get_data_load();
+	double share = (load-sibling_load) / (2*load);
+	if (by_rate)
+		share = (request_rate-sibling_rate) / (2*request_rate);
+	if (load == 0 || !(share >= MIN_SHIFT)) {
+		release_link (link);
+		return false;
+	}
+
+	/* the upper half sheds its lowest tuples and the lower half its highest */
+	bool upper = hist.back();
+	int dim = axes.at(L);
+	T boundary = pool.get_quantile (dim, upper ? share : 1-share, exact_median);
+
+	T lo [dims];
+	T hi [dims];
+	memcpy (lo, pool.get_lo(), dims*sizeof(T));
+	memcpy (hi, pool.get_hi(), dims*sizeof(T));
+	if (upper ? boundary <= lo[dim] : boundary >= hi[dim]) {
+		release_link (link);
+		return false;
+	}
+	if (upper)
+		hi[dim] = boundary;
+	else
+		lo[dim] = boundary;
+	Pool<T> moved (dims, lo, hi, bucket_size);
+
+	exclude_routing ();
+	if (hist.size() != L+1) {
+		pthread_rwlock_unlock (&routing_lock);
+		release_link (link);
+		return false;
+	}
+
+	T old = pts.at(L);
+	if (upper)
+		pool.split_lo (dim, boundary, moved);
+	else
+		pool.split (dim, boundary, moved);
+	pts.at(L) = boundary;
+
+	std::stringstream tuples (std::stringstream::out);
+	tuple_printer<T> printer (tuples, dims);
+	moved.scan (printer);
+
+	std::stringstream out (std::stringstream::out);
+	out << "H " << id << " ";
+	::put_text<T> (out, boundary);
+	out << "\n#TUPLES " << printer.size << "\n" << tuples.str() << "#END\n";
+
+	unsigned long long ticket = 0;
+	bool posted = true;
+	try{
+		ticket = link->post (out.str());
+	}catch (std::exception &e){
+		posted = false;
+	}
+	pthread_rwlock_unlock (&routing_lock);
+
+	std::string response;
+	try{
+		if (posted)
+			response = link->wait (ticket);
+	}catch (std::exception &e){
+		posted = false;
+	}
+	if (!posted)
+		drop_link (L, link);
+	release_link (link);
+
+	if (response.compare ("H OK\n") == 0) {
+		std::cerr << "** " << get_id() << "@" << port << " shifted its boundary on dim#" << dim << " to ";
+		::vec2stream<T> (std::cerr, &boundary, 1, '\n');
+		std::cerr << " handing " << printer.size << " tuples to its sibling.\n";
+		return true;
+	}
+
+	/* the region is restored before the grid is laid anew over it */
+	exclude_routing ();
+	pts.at(L) = old;
+	if (upper) {
+		memcpy (lo, pool.get_lo(), dims*sizeof(T));
+		lo[dim] = old;
+		pool.set_lo (lo);
 	}else{
-		std::cerr << "** " << get_id() << "@" << port << " is appending indexed locally value: " << value << "\n";
+		memcpy (hi, pool.get_hi(), dims*sizeof(T));
+		hi[dim] = old;
+		pool.set_hi (hi);
+	}
+	pool.absorb (moved);
+	pthread_rwlock_unlock (&routing_lock);
+
+	std::cerr << "** " << get_id() << "@" << port << " took back " << printer.size << " tuples its sibling refused.\n";
+	return false;
+}
 
-		char *buffer = new char[value.size() + 1];
-		strcpy(buffer, value.c_str());
+/*
+ * The tuples are indexed before the region grows to hold them, and the
+ * region grows before the split point moves, so a message for them is
+ * either handled here once they are or sent back to the sibling, which
+ * sends it anew past this message. Readers hold the routing lock shared
+ * all along, so the single bound and the point are stored with release
+ * in that order, and beyond loads the point with acquire before it
+ * checks the region anew.
+ */
+template<class T> int Node<T>::process_shift_msg ( std::string& msg ) {
+	std::stringstream in (msg, std::stringstream::in);
 
-		//pthread_mutex_lock (&pool_lock);
-		pool.concatenate(key, buffer);
-		//pthread_mutex_unlock (&pool_lock);
-		return 0;
+	char symbol;
+	in >> symbol;
+
+	std::string sibling_id;
+	in >> sibling_id;
+
+	T boundary;
+	::get_text<T> (in, boundary);
+
+	std::string id = get_id();
+	if (hist.empty() || !cached.empty() || sibling_id.size() != id.size()
+			|| sibling_id.compare (0, id.size()-1, id, 0, id.size()-1) != 0 || sibling_id.at(id.size()-1) == id.at(id.size()-1)) {
+		std::cerr << "** " << id << "@" << port << " refused a boundary shift of " << sibling_id << ".\n";
+		return -1;
+	}
+
+	unsigned L = hist.size()-1;
+	int dim = axes.at(L);
+	bool upper = hist.back();
+	T bound = (upper ? pool.get_lo() : pool.get_hi())[dim];
+	if (upper ? boundary > bound : boundary < bound) {
+		std::cerr << "** " << id << "@" << port << " refused a boundary shift that shrinks its region.\n";
+		return -1;
 	}
+
+	std::string junk;
+	in >> junk;
+	if (junk.compare ("#TUPLES") != 0)
+		throw std::runtime_error(" Bad boundary shift. Tuples expected.\n");
+
+	int quantity = 0;
+	in >> quantity;
+
+	TupleArray<T> data (dims);
+	data.reserve (quantity);
+	T key [dims];
+	for (int i = 0; i < quantity; ++i) {
+		::stream2vec<T> (in, key, dims, ',');
+
+		std::string value;
+		in >> value;
+
+		data (key, ValueStore::create (value.data(), value.size()));
+	}
+	pool.push_batch (data);
+
+	/* readers only share the routing lock, so the bound and then the point are published one by one, see beyond */
+	pool.set_bound (dim, boundary, !upper);
+	__atomic_store (&pts.at(L), &boundary, __ATOMIC_RELEASE);
+
+	std::cerr << "** " << id << "@" << port << " took " << quantity << " tuples from its sibling up to ";
+	::vec2stream<T> (std::cerr, &boundary, 1, '\n');
+	std::cerr << ".\n";
+	return 0;
 }
 
 /**
  * L(.5,.5) 127.0.0.1 50000 0\n
  */
-template<class T> int Node<T>::process_lookup_msg ( std::string& msg ) {
+template<class T> int Node<T>::process_lookup_msg ( std::string& msg, std::string* owner ) {
 	std::stringstream in (msg, std::stringstream::in);
 
 	char symbol;
@@ -721,82 +1683,89 @@ template<class T> int Node<T>::process_lookup_msg ( std::string& msg ) {
 	in >> hops;
 	++hops;
 
-	if (!pool.isRelevant(key)) {
-		int dest_link = forward_to(key);
+	int dest_link;
+	if (beyond (key, dest_link)) {
 
 		if (dest_link == -1)
 			throw std::runtime_error(" Unable to forward lookup request.\n");
 
-		if (skip.at(dest_link) == 0) {
+		std::stringstream fwd (std::stringstream::out);
+		fwd << "L(";
+		::vec2stream<T> ( fwd, key, dims, ',');
+		fwd << ") " << dest_host << " " << dest_port << " " << hops << "\n";
+		std::string forwarded = fwd.str();
+
+		int routed = forward_route (dest_link, 'L', key, "", forwarded, owner);
+		if (routed != 0)
+			return routed;
+
+		Link* link = hold_link (dest_link);
+		if (link == 0) {
 			for (typename std::vector<Node<T>*>::const_iterator vi=cached.begin(); vi!=cached.end(); ++vi) {
 				if ((*vi)->pool.isRelevant(key)) {
-					std::pair<T*, char*>& tuple = (*vi)->pool.lookup(key);
-
 					std::cerr << "** " << (*vi)->get_id() << "@" << (*vi)->port << " looked up message " << msg;
 
 					std::stringstream out (std::stringstream::out);
 					out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
 						<< host << ":" << (*vi)->port << "\n#ID: " << (*vi)->get_id() << "\n";
 
-					out << "(key(";
-					::vec2stream<T> ( out, key, dims, ',');
-
-					if (&tuple != 0)
-						out << "),[" << tuple.second << "])\n#END\n";
-					else
-						out << "),[])\n#END\n";
+					answer_printer<T> ans (out, dims);
+					if (!(*vi)->pool.lookup(key, ans)) {
+						out << "(key(";
+						::vec2stream<T> ( out, key, dims, ',');
+						out << "),[])\n";
+					}
+					out << "#END\n";
 
-					ClientSocket cs(dest_host, dest_port);
-					cs << out.str();
-					return 0;
+					if (owner != 0)
+						*owner = describe_owner (**vi);
+					return deliver (dest_host, dest_port, out.str()) ? 0 : -1;
 				}
 			}
 		}else{
-			std::stringstream out (std::stringstream::out);
-			out << "L(";
-			::vec2stream<T> ( out, key, dims, ',');
-			out << ") " << dest_host << " " << dest_port << " " << hops << "\n";
-
+			std::string response;
 			try{
-				//skip.at(dest_link)->open();
-				*skip.at(dest_link) << out.str();
+				response = link->request (forwarded);
 			}catch (std::exception &e){
 				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << dest_link << " has failed.\n";
-				skip [dest_link] = 0;
+				drop_link (dest_link, link);
+				release_link (link);
 				return -1;
 			}
-			std::cerr << "** " << get_id() << "@" << port << " is forwarding to link " << dest_link << " message: " << out.str();
+			release_link (link);
+
+			if (!accept_reply ('L', response, frontlink_hosts.at(dest_link), frontlink_ports.at(dest_link), owner)){
+				std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << forwarded;
+				return -1;
+			}
+			std::cerr << "** " << get_id() << "@" << port << " is forwarding to link " << dest_link << " message: " << forwarded;
 			return 1;
 		}
+		return -1;
 	}else{
-		std::pair<T*, char*>& tuple = pool.lookup(key);
-
 		std::cerr << "** " << get_id() << "@" << port << " looked up message " << msg;
 
 		std::stringstream out (std::stringstream::out);
 		out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
 			<< host << ":" << port << "\n#ID: " << get_id() << "\n";
 
-		out << "(key(";
-		::vec2stream<T> ( out, key, dims, ',');
-
-		if (&tuple != 0)
-			out << "),[" << tuple.second << "])\n#END\n";
-		else
-			out << "),[])\n#END\n";
+		observe (key, key);
+		answer_printer<T> ans (out, dims);
+		if (!pool.lookup(key, ans)) {
+			out << "(key(";
+			::vec2stream<T> ( out, key, dims, ',');
+			out << "),[])\n";
+		}
+		out << "#END\n";
 
-		ClientSocket cs(dest_host, dest_port);
-		cs << out.str();
-		return 0;
+		if (owner != 0)
+			*owner = describe_owner (*this);
+		return deliver (dest_host, dest_port, out.str()) ? 0 : -1;
 	}
 }
 
-/**
- * R((.4,.4),(.6,.6)) 127.0.0.1 50000 0\n
- */
-template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
-	std::stringstream in(msg, std::stringstream::in);
-
+/* parses the range of a range query, leaving in past it */
+template<class T> void Node<T>::parse_range_msg ( std::istream& in, T* lo, T* hi ) const {
 	char symbol;
 	in >> symbol;
 	if (symbol != 'R')
@@ -806,14 +1775,12 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 	if (symbol != '(')
 		throw std::runtime_error(" Bad range request message. Tuple open parenthesis expected.\n");
 
-	T key [2][dims];
-
 	/* lo-point */
 	in >> symbol;
 	if (symbol != '(')
 		throw std::runtime_error(" Bad range request message. Lo-point open parenthesis expected.\n");
 
-	::stream2vec<T> ( in, key[0], dims, ',' );
+	::stream2vec<T> ( in, lo, dims, ',' );
 
 	in >> symbol;
 	if ( symbol != ')' )
@@ -828,7 +1795,7 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 	if (symbol != '(')
 		throw std::runtime_error(" Bad range request message. Hi-point open parenthesis expected.\n");
 
-	::stream2vec<T> ( in, key[1], dims, ',' );
+	::stream2vec<T> ( in, hi, dims, ',' );
 
 	in >> symbol;
 	if ( symbol != ')' )
@@ -837,6 +1804,16 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 	in >> symbol;
 	if (symbol != ')')
 		throw std::runtime_error(" Bad range request message. Tuple closing parenthesis expected\n");
+}
+
+/**
+ * R((.4,.4),(.6,.6)) 127.0.0.1 50000 0\n
+ */
+template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
+	std::stringstream in(msg, std::stringstream::in);
+
+	T key [2][dims];
+	parse_range_msg (in, key[0], key[1]);
 
 	std::string dest_host;
 	in >> dest_host;
@@ -851,45 +1828,170 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 	/**
 	 * local processing
 	 */
-	std::vector<std::pair<T*, char*>*> ans;
-	pool.range(key[0], key[1], ans);
+	std::stringstream out (std::stringstream::out);
+	out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
+		<< host << ":" << port << "\n#ID: " << get_id() << "\n";
 
-	if (!ans.empty()) {
-		std::stringstream out (std::stringstream::out);
-		out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
-			<< host << ":" << port << "\n#ID: " << get_id() << "\n";
+	observe (key[0], key[1]);
+	answer_printer<T> ans (out, dims);
+	pool.range(key[0], key[1], ans);
 
-		for (unsigned i = 0; i < ans.size(); ++i) {
-			out << "(key(";
-			::vec2stream<T>(out, ans.at(i)->first, dims, ',');
-			out << "),[" << ans.at(i)->second << "])\n";
-		}
+	if (ans.size > 0) {
 		out << "#END\n";
 
 		std::cerr << "** " << get_id() << "@" << port
-			<< " returning answer of size " << ans.size() << " to "
+			<< " returning answer of size " << ans.size << " to "
 			<< dest_host << ":" << dest_port << "\n";
 
-		ClientSocket cs(dest_host, dest_port);
-		cs << out.str();
+		deliver (dest_host, dest_port, out.str());
+	}
+
+	return forward_range ('R', key[0], key[1], dest_host, dest_port, hops, msg);
+}
+
+/**
+ * R((.1,.1),(.5,.5))\n
+ *
+ * A range query without a requester is answered on its own connection,
+ * once the parts of it forwarded along the overlay have come back merged
+ * into the replies of the links, as a single message:
+ * R OK 2\n
+ * (key(.2,.4),[dummy_value_string])\n
+ * (key(.3,.1),[another_value_string])\n
+ * #END\n
+ * with the count of the tuples up front. The answer is complete when it
+ * reads OK, while BAD means some part of the overlay did not answer.
+ * Between binary peers the range goes as its two keys after its tag, and
+ * the counted tuples come back as keys and length-prefixed values, with
+ * no trailer since the frame ends the reply.
+ */
+template<class T> std::string Node<T>::process_collected_range_msg ( std::string& msg ) {
+	bool binary = ::is_binary (msg);
+
+	T key [2][dims];
+	if (binary) {
+		size_t pos = 2;
+		::get_key<T> (msg, pos, key[0], dims);
+		::get_key<T> (msg, pos, key[1], dims);
+	}else{
+		std::stringstream in(msg, std::stringstream::in);
+		parse_range_msg (in, key[0], key[1]);
+	}
+
+	std::stringstream out (std::stringstream::out);
+	observe (key[0], key[1]);
+	answer_printer<T> ans (out, dims, binary);
+	pool.range(key[0], key[1], ans);
+
+	std::vector<Forward> forwards;
+	bool complete = post_range ('R', key[0], key[1], "\n", "\n#END\n", forwards, true) == 0;
+
+	/* each reply holds as many tuples as its header counts, in the encoding of its link */
+	for (unsigned f=0; f<forwards.size(); ++f) {
+		try{
+			bool framed = forwards[f].link->is_binary();
+			std::string response = collect (forwards[f]);
+
+			size_t pos = response.find ('\n');
+			if (pos == std::string::npos)
+				throw std::runtime_error (" Bad range reply.\n");
+
+			std::stringstream header (response.substr (0, ++pos));
+			std::string status;
+			unsigned size = 0;
+			header >> status >> status >> size;
+			if (!header || status.compare ("OK") != 0)
+				complete = false;
+
+			T tuple [dims];
+			std::string value;
+			for (unsigned t=0; t<size; ++t) {
+				if (framed) {
+					::get_key<T> (response, pos, tuple, dims);
+					::get_value (response, pos, value);
+				}else{
+					size_t begin = response.find ("),[", pos);
+					size_t end = response.find ("])\n", begin);
+					if (response.compare (pos, 5, "(key(") != 0 || end == std::string::npos)
+						throw std::runtime_error (" Bad range reply. Tuple expected.\n");
+
+					std::stringstream in (response.substr (pos+5, begin-pos-5));
+					::stream2vec<T> (in, tuple, dims, ',');
+					if (::skip_blanks (in) != EOF)
+						throw std::runtime_error (" Bad range reply. Key expected.\n");
+
+					value.assign (response, begin+3, end-begin-3);
+					pos = end + 3;
+				}
+				ans.put (tuple, value);
+			}
+			if (framed ? pos != response.size() : response.compare (pos, std::string::npos, "#END\n") != 0)
+				throw std::runtime_error (" Bad range reply. Trailing data.\n");
+		}catch (std::exception &e){
+			std::cerr << "** " << get_id() << "@" << port << " traced that link#" << forwards[f].index << " has failed.\n";
+			complete = false;
+		}
+	}
+
+	std::cerr << "** " << get_id() << "@" << port << " returning collected answer of size " << ans.size << "\n";
 
-		out.clear();
-		ans.clear();
+	std::stringstream reply (std::stringstream::out);
+	reply << (complete ? "R OK " : "R BAD ") << ans.size << "\n";
+	return reply.str() + out.str() + (binary ? "" : "#END\n");
+}
+
+template<class T> bool Node<T>::deliver ( std::string& dest_host, int dest_port, const std::string& answer ) {
+	if (answers.deliver (dest_host, dest_port, answer))
+		return true;
+
+	std::cerr << "** " << get_id() << "@" << port << " unable to deliver answer to "
+		<< dest_host << ":" << dest_port << ".\n";
+	return false;
+}
+
+template<class T> int Node<T>::forward_range ( char symbol, T* lo, T* hi,
+		std::string& dest_host, int dest_port, int hops, std::string& msg ) {
+	std::stringstream tail (std::stringstream::out);
+	tail << " " << dest_host << " " << dest_port << " " << hops << "\n";
+
+	std::vector<Forward> forwards;
+	int status = post_range (symbol, lo, hi, tail.str(), "\n", forwards);
+
+	/* the sub-queries are in flight together, their replies awaited only now */
+	for (unsigned f=0; f<forwards.size(); ++f) {
+		try{
+			std::string response = collect (forwards[f]);
+
+			if (response.compare(std::string(1, symbol) + " OK\n") != 0){
+				std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
+				status = -1;
+			}
+		}catch (std::exception &e){
+			std::cerr << "** " << get_id() << "@" << port << " traced that link#" << forwards[f].index << " has failed.\n";
+			status = -1;
+		}
 	}
+	return status;
+}
 
-	/**
-	 * forwarding request for remote processing
-	 */
-	if (!pool.encloses(key[0], key[1])) {
+/*
+ * sends the parts of a range query beyond the region of the node to the
+ * links of the splits it crosses, narrowing [lo,hi] to the rest
+ */
+template<class T> int Node<T>::post_range ( char symbol, T* lo, T* hi,
+		const std::string& tail, const char* trailer, std::vector<Forward>& forwards, bool binary ) {
+	int status = 0;
+	if (!pool.encloses(lo, hi)) {
 		for (unsigned j = 0; j < hist.size(); ++j) {
-			int d = j % dims;
+			int d = axes[j];
 
 			/* if there is no relevance between the split area the range query */
-			if (!hist[j] && key[0][d] < pts[j] && key[1][d] < pts[j])
+			T point = split_point (j);
+			if (!hist[j] && lo[d] < point && hi[d] < point)
 				continue;
-			if (hist[j] && key[0][d] > pts[j] && key[1][d] > pts[j])
+			if (hist[j] && lo[d] > point && hi[d] > point)
 				continue;
-			if (key[0][d] == key[1][d])
+			if (lo[d] == hi[d])
 				continue;
 
 			/**
@@ -904,17 +2006,17 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 			for (int i = 0; i < dims; ++i) {
 				if (i == d) {
 					if (!hist[j]) {
-						subquery[0][i] = (key[0][i] < pts[j] ? pts[j] : key[0][i]);
-						subquery[1][i] = key[1][i];
-						key[1][i] = subquery[0][i];
+						subquery[0][i] = (lo[i] < point ? point : lo[i]);
+						subquery[1][i] = hi[i];
+						hi[i] = subquery[0][i];
 					}else{
-						subquery[0][i] = key[0][i];
-						subquery[1][i] = (key[1][i] > pts[j] ? pts[j] : key[1][i]);
-						key[0][i] = subquery[1][i];
+						subquery[0][i] = lo[i];
+						subquery[1][i] = (hi[i] > point ? point : hi[i]);
+						lo[i] = subquery[1][i];
 					}
 				}else{
-					subquery[0][i] = key[0][i];
-					subquery[1][i] = key[1][i];
+					subquery[0][i] = lo[i];
+					subquery[1][i] = hi[i];
 				}
 			}
 
@@ -932,11 +2034,7 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 			::vec2stream<T>(hi_req, subquery[1], dims, ',');
 			hi_req << "))";
 
-			std::stringstream tail_req (std::stringstream::out);
-			tail_req << dest_host << " " << dest_port << " " << hops << "\n";
-
-			std::string request = "R" + lo_req.str() + hi_req.str() + " "
-					+ tail_req.str();
+			std::string request = symbol + lo_req.str() + hi_req.str() + tail;
 
 			for (int i = 0; i < dims; ++i)
 				if (subquery[0][i] >= subquery[1][i]) {
@@ -945,31 +2043,123 @@ template<class T> int Node<T>::process_range_msg ( std::string& msg ) {
 				}
 
 			if (!request.empty()) {
-				std::cerr << "** Server@"<< port << " forwarding to link " << j << " request: " << request ;
-				try{
-					//skip.at(j)->open();
-					*skip.at(j) << request;
-
-					std::string response;
-					*skip.at(j) >> response;
+				std::string binary_request;
+				if (binary) {
+					binary_request = symbol;
+					binary_request += BINARY_TAG;
+					::put_key<T> (binary_request, subquery[0], dims);
+					::put_key<T> (binary_request, subquery[1], dims);
+				}
 
-					if (response.compare("R OK\n") != 0){
-						std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
-						return -1;
-					}
-				}catch (std::exception &e){
+				std::cerr << "** Server@"<< port << " forwarding to link " << j << " request: " << request ;
+				if (!post_link (j, request, binary_request, trailer, forwards)) {
 					std::cerr << "** " << get_id() << "@" << port << " traced that link#" << j << " has failed.\n";
-					skip [j] = 0;
-					return -1;
+					status = -1;
 				}
 			}
 		}
 	}
-	return 0;
+	return status;
+}
+
+/**
+ * C((.1,.1),(.5,.5)) 127.0.0.1 50000 0\n
+ *
+ * Answers with the COUNT, SUM, MIN and MAX of the keys within the range
+ * on every dimension, out of the part of the range in each node, as
+ * (count(n),sum(s1,...,sd),min(m1,...,md),max(M1,...,Md))
+ * for the requester to merge.
+ */
+template<class T> int Node<T>::process_aggregate_msg ( std::string& msg ) {
+	std::stringstream in(msg, std::stringstream::in);
+
+	char symbol;
+	in >> symbol;
+	if (symbol != 'C')
+		throw std::runtime_error(" Bad aggregate query processing.\n");
+
+	in >> symbol;
+	if (symbol != '(')
+		throw std::runtime_error(" Bad aggregate request message. Tuple open parenthesis expected.\n");
+
+	T key [2][dims];
+
+	/* lo-point */
+	in >> symbol;
+	if (symbol != '(')
+		throw std::runtime_error(" Bad aggregate request message. Lo-point open parenthesis expected.\n");
+
+	::stream2vec<T> ( in, key[0], dims, ',' );
+
+	in >> symbol;
+	if ( symbol != ')' )
+		throw std::runtime_error (" Bad aggregate request message. Lo closing parenthesis expected.\n");
+
+	in >> symbol;
+	if (symbol != ',')
+		throw std::runtime_error(" Bad aggregate request message. Lo-Hi comma expected.\n");
+
+	/* hi-point */
+	in >> symbol;
+	if (symbol != '(')
+		throw std::runtime_error(" Bad aggregate request message. Hi-point open parenthesis expected.\n");
+
+	::stream2vec<T> ( in, key[1], dims, ',' );
+
+	in >> symbol;
+	if ( symbol != ')' )
+		throw std::runtime_error (" Bad aggregate request message. Hi closing parenthesis expected.\n");
+
+	in >> symbol;
+	if (symbol != ')')
+		throw std::runtime_error(" Bad aggregate request message. Tuple closing parenthesis expected\n");
+
+	std::string dest_host;
+	in >> dest_host;
+
+	int dest_port(-1);
+	in >> dest_port;
+
+	int hops(-1);
+	in >> hops;
+	++hops;
+
+	/* enclosed subtrees of the pool are summed up without visiting their tuples */
+	observe (key[0], key[1]);
+	Aggregate<T> acc (dims);
+	pool.range(key[0], key[1], acc);
+
+	if (acc.count > 0) {
+		std::stringstream out (std::stringstream::out);
+		out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
+			<< host << ":" << port << "\n#ID: " << get_id() << "\n";
+
+		out.precision (std::numeric_limits<double>::digits10 + 2);
+		out << "(count(" << acc.count << "),sum(";
+		::vec2stream<double> (out, &acc.sum[0], dims, ',');
+		out << "),min(";
+		::vec2stream<T> (out, &acc.min[0], dims, ',');
+		out << "),max(";
+		::vec2stream<T> (out, &acc.max[0], dims, ',');
+		out << "))\n#END\n";
+
+		std::cerr << "** " << get_id() << "@" << port
+			<< " returning aggregate of " << acc.count << " tuples to "
+			<< dest_host << ":" << dest_port << "\n";
+
+		deliver (dest_host, dest_port, out.str());
+	}
+
+	return forward_range ('C', key[0], key[1], dest_host, dest_port, hops, msg);
 }
 
 /**
  * N((q1,..,qD),K,Rmax) host_IP port_no hops depth\n
+ *
+ * A negative Rmax asks for the K nearest at any distance: the query is
+ * relayed towards the owner of its center first, a hop per link, and the
+ * owner gathers the neighbors out of its subtree and the links beyond. A
+ * query of a given Rmax is answered within that radius where it lands.
  */
 template<class T> int Node<T>::process_nearest_msg ( std::string& msg ) {
 	std::stringstream in (msg, std::stringstream::in);
@@ -1009,30 +2199,6 @@ template<class T> int Node<T>::process_nearest_msg ( std::string& msg ) {
 	double Rmax;
 	in >> Rmax;
 
-	if (Rmax < 0) {
-		if (pool.isRelevant (key)){
-			Rmax = DBL_MAX;
-		}else{
-			unsigned relevant = forward_to(key);
-			try{
-				*skip.at(relevant) << msg;
-
-				std::string response;
-				*skip.at(relevant) >> response;
-
-				if (response.compare("N OK\n") != 0){
-					std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
-					return -1;
-				}
-				return 0;
-			}catch (std::exception &e){
-				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << relevant << " has failed.\n";
-				skip [relevant] = 0;
-				return -1;
-			}
-		}
-	}
-
 	in >> symbol;
 	if (symbol != ')')
 		throw std::runtime_error(" Bad nearest neighbor request message. Tuple closing parenthesis expected\n");
@@ -1050,118 +2216,346 @@ template<class T> int Node<T>::process_nearest_msg ( std::string& msg ) {
 	int depth = 0;
 	in >> depth;
 
-	/**
-	 * local processing
+	/*
+	 * the owner of the query center coordinates, unless the way to it is
+	 * lost; its answer goes to the requester, so its reply is not awaited,
+	 * as the sub-queries it gathers may come back here while every worker
+	 * waits on such a reply
 	 */
-	std::vector<std::pair<double, std::pair<T*, char*>*>*> ans;
-	double Rlocal = pool.nearest(key, K, Rmax, ans);
-
-	if (Rlocal < Rmax)
-		Rmax = Rlocal;
+	int relevant;
+	if (Rmax < 0 && beyond (key, relevant)) {
+		Link* link = relevant != -1 ? hold_link (relevant) : 0;
+		if (link != 0) {
+			std::stringstream fwd (std::stringstream::out);
+			fwd << "N((";
+			::vec2stream<T> (fwd, key, dims, ',');
+			fwd << ")," << K << ",";
+			::put_text<double> (fwd, Rmax);
+			fwd << ") " << dest_host << " " << dest_port << " " << hops << " " << depth << "\n";
 
-	if (!ans.empty()) {
-		std::stringstream out (std::stringstream::out);
-		out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
-				<< host << ":" << port << "\n#ID: " << get_id() << "\n";
-
-		for (unsigned i = 0; i < ans.size(); ++i) {
-			out << "(distance(" << ans.at(i)->first << "),key(";
-			::vec2stream<T> (out, ans.at(i)->second->first, dims, ',');
-			out << "),[";
-			out << ans.at(i)->second->second;
-			out << "])\n";
+			try{
+				link->drop (link->post (fwd.str()));
+			}catch (std::exception &e){
+				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << relevant << " has failed.\n";
+				drop_link (relevant, link);
+				release_link (link);
+				return -1;
+			}
+			release_link (link);
+			return 0;
 		}
-		out << "#END\n";
+	}
+	if (Rmax < 0)
+		Rmax = DBL_MAX;
 
-		std::cerr << "** " << get_id() << "@" << port
-				<< " returning answer of size " << ans.size() << " to "
-				<< dest_host << ":" << dest_port << "\n";
+	std::vector<Neighbor<T> > found;
+	unsigned forwards = 0;
+	bool complete = gather_nearest (key, K, Rmax, depth, found, forwards);
+
+	/* the merged neighbors leave in a single answer, nearest first */
+	std::stringstream out (std::stringstream::out);
+	out << "#ACK\n#QUERY: " << msg << "#HOPS: " << hops << "\n#HOST: "
+			<< host << ":" << port << "\n#ID: " << get_id() << "\n#FORWARDS: " << forwards << "\n";
 
-		ClientSocket cs (dest_host, dest_port);
-		cs << out.str();
+	for (unsigned i=0; i<found.size(); ++i) {
+		out << "(distance(" << found[i].distance << "),key(";
+		::vec2stream<T> (out, &found[i].key[0], dims, ',');
+		out << "),[" << found[i].value << "])\n";
 	}
+	out << "#END\n";
 
-	/**
-	 * forwarding request for remote processing
-	 */
-	std::stringstream general_req_stream (std::stringstream::out);
-	general_req_stream << "N((";
+	std::cerr << "** " << get_id() << "@" << port
+			<< " returning answer of size " << found.size() << " to "
+			<< dest_host << ":" << dest_port << "\n";
+
+	if (!deliver (dest_host, dest_port, out.str()))
+		return -1;
+	return complete ? 0 : -1;
+}
+
+/**
+ * K((.5,.5),3,0.11) 2\n
+ *
+ * Answered with the K nearest neighbors within the radius out of the node
+ * and its links from the depth on, which make up a subtree of the overlay,
+ * along with the sub-queries it took to find them:
+ * K OK 1\n
+ * (0.09,(0.41,0.5),5)val24\n
+ * #END\n
+ * The length of each value keeps it apart from the rest, whatever its bytes.
+ */
+template<class T> std::string Node<T>::process_neighbors_msg ( std::string& msg ) {
+	std::stringstream in (msg, std::stringstream::in);
 
-	::vec2stream<T>(general_req_stream, key, dims, ',');
+	char symbol;
+	in >> symbol;
+	if (symbol != 'K')
+		throw std::runtime_error(" Bad nearest neighbor sub-query processing.\n");
+
+	in >> symbol;
+	if (symbol != '(')
+		throw std::runtime_error(" Bad nearest neighbor sub-query. Tuple open parenthesis expected.\n");
 
-	general_req_stream << ")," << K << "," << Rmax << ") ";
-	general_req_stream << dest_host << " " << dest_port << " " << hops << " ";
+	in >> symbol;
+	if (symbol != '(')
+		throw std::runtime_error(" Bad nearest neighbor sub-query. Query center open parenthesis expected.\n");
 
-	T lo[dims];
-	T hi[dims];
+	T key [dims];
+	::stream2vec<T> ( in, key, dims, ',' );
 
-	for (int j = 0; j < dims; ++j) {
-		lo[j] = key[j] - Rmax;
-		hi[j] = key[j] + Rmax;
+	in >> symbol;
+	if (symbol != ')')
+		throw std::runtime_error(" Bad nearest neighbor sub-query. Query center closing parenthesis expected.\n");
+
+	in >> symbol;
+	if (symbol != ',')
+		throw std::runtime_error(" Bad nearest neighbor sub-query. Query center - K comma expected.\n");
+
+	int K = 0;
+	in >> K;
+
+	in >> symbol;
+	if (symbol != ',')
+		throw std::runtime_error(" Bad nearest neighbor sub-query. K - radius comma expected.\n");
+
+	double radius;
+	::get_text<double> (in, radius);
+
+	in >> symbol;
+	if (symbol != ')')
+		throw std::runtime_error(" Bad nearest neighbor sub-query. Tuple closing parenthesis expected.\n");
+
+	unsigned depth = 0;
+	in >> depth;
+
+	std::vector<Neighbor<T> > found;
+	unsigned forwards = 0;
+	bool complete = gather_nearest (key, K, radius, depth, found, forwards);
+
+	std::stringstream out (std::stringstream::out);
+	out << (complete ? "K OK " : "K BAD ") << forwards << "\n";
+	for (unsigned i=0; i<found.size(); ++i) {
+		out << "(";
+		::put_text<double> (out, found[i].distance);
+		out << ",(";
+		::vec2stream<T> (out, &found[i].key[0], dims, ',');
+		out << ")," << found[i].value.size() << ")" << found[i].value << "\n";
 	}
+	out << "#END\n";
+	return out.str();
+}
 
-	if (!pool.encloses(lo, hi)) {
-		for (unsigned j = depth; j<hist.size(); ++j) {
-			int d = j % dims;
+template<class T> bool Node<T>::gather_nearest ( T* key, int K, double radius, unsigned depth,
+		std::vector<Neighbor<T> >& found, unsigned& forwards ) {
+	if (K <= 0)
+		return true;
+
+	neighbor_collector<T> collector (found, dims);
+	pool.nearest (key, K, radius, collector);
+	std::sort (found.begin(), found.end());
+
+	/* a link leads beyond its split point, so that far at least lies anything it holds */
+	std::vector<std::pair<double,unsigned> > order;
+	for (unsigned j = depth; j < hist.size(); ++j) {
+		int d = axes[j];
+		double gap = hist[j] ? key[d] - split_point (j) : split_point (j) - key[d];
+		order.push_back (std::make_pair (gap > 0 ? gap : 0, j));
+	}
+	std::sort (order.begin(), order.end());
+
+	bool complete = true;
+	for (unsigned i = 0; i < order.size(); ++i) {
+		bool full = (int) found.size() == K;
+		if (full && order[i].first >= found.back().distance)
+			break;
+		if (!full && order[i].first > radius)
+			break;
+
+		unsigned j = order[i].second;
+		Link* link = hold_link (j);
+		if (link == 0) {
+			complete = false;
+			continue;
+		}
 
-			if (!hist[j] && lo[d]<pts[j] && hi[d]<pts[j])
-				continue;
-			if (hist[j] && lo[d]>pts[j] && hi[d]>pts[j])
-				continue;
+		std::stringstream req (std::stringstream::out);
+		req << "K((";
+		::vec2stream<T> (req, key, dims, ',');
+		req << ")," << K << ",";
+		::put_text<double> (req, full ? found.back().distance : radius);
+		req << ") " << j + 1 << "\n";
 
-			std::stringstream current_req_stream (std::stringstream::out);
-			current_req_stream << general_req_stream.str() << j + 1 << "\n";
+		std::cerr << "** " << get_id() << "@"<< port << " forwarding to link " << j << " request: " << req.str();
 
-			std::cerr << "** " << get_id() << "@"<< port << " forwarding to link " << j << " request: " << current_req_stream.str() ;
+		std::string response;
+		try{
+			response = link->request (req.str(), "\n#END\n");
+		}catch (std::exception &e){
+			std::cerr << "** " << get_id() << "@" << port << " traced that link#" << j << " has failed.\n";
+			drop_link (j, link);
+			release_link (link);
+			complete = false;
+			continue;
+		}
+		release_link (link);
+		++forwards;
+
+		std::stringstream in (response, std::stringstream::in);
+		std::string status;
+		unsigned sub_forwards = 0;
+		char symbol;
+		in >> symbol >> status >> sub_forwards;
+		if (symbol != 'K')
+			throw std::runtime_error(" Bad nearest neighbor sub-query response.\n");
+		if (status.compare ("OK") != 0)
+			complete = false;
+		forwards += sub_forwards;
+
+		/* the neighbors of the subtree are merged in, tightening the K-th distance */
+		while (::skip_blanks (in) == '(') {
+			Neighbor<T> n;
+			n.key.resize (dims);
+			size_t length = 0;
+
+			in >> symbol;
+			::get_text<double> (in, n.distance);
+			in >> symbol;
+			if (symbol != ',')
+				throw std::runtime_error(" Bad nearest neighbor sub-query response. Comma expected.\n");
+			in >> symbol;
+			::stream2vec<T> (in, &n.key[0], dims, ',');
+			in >> symbol >> symbol >> length >> symbol;
+			if (symbol != ')')
+				throw std::runtime_error(" Bad nearest neighbor sub-query response. Closing parenthesis expected.\n");
+
+			n.value.resize (length);
+			in.read (&n.value[0], length);
+			found.push_back (n);
+		}
+		std::sort (found.begin(), found.end());
+		if ((int) found.size() > K)
+			found.resize (K);
+	}
+	return complete;
+}
 
-			try{
-				//skip.at(j)->open();
-				*skip.at(j) << current_req_stream.str();
+template<class T> void Node<T>::observe ( const T* lo, const T* hi ) {
+	if (split_policy != BALANCED_SPLIT && split_policy != WORKLOAD_SPLIT)
+		return;
 
-				std::string response;
-				*skip.at(j) >> response;
+	pthread_mutex_lock (&workload_lock);
+	size_t slot = (size_t) (observed % WORKLOAD_SAMPLE) * 2*dims;
+	if (workload.size() < slot + 2*dims)
+		workload.resize (slot + 2*dims);
+	std::copy (lo, lo+dims, workload.begin()+slot);
+	std::copy (hi, hi+dims, workload.begin()+slot+dims);
+	++observed;
+	pthread_mutex_unlock (&workload_lock);
+}
 
-				if (response.compare("N OK\n") != 0){
-					std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
-					return -1;
-				}
-				return 0; //////////////////////////////////////////////////////////////////// should this be here?????
-			}catch (std::exception &e){
-				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << j << " has failed.\n";
-				skip [j] = 0;
-				return -1;
-			}
+/*
+ * The spread of a dimension is taken between the outer deciles of the
+ * tuples, so that a few outliers do not stretch it, and the widest one
+ * wins, the round robin one on ties. A balanced split moves the median
+ * towards the queried keys, so that either half gets as many tuples as
+ * requests, each as a share of the total. A split by the workload costs
+ * for each dimension the share of the observed queries straddling its
+ * median, since those are forwarded across the split; the cheapest wins
+ * and the widest on ties, so it is the same as by spread until queries
+ * spanning ranges are met. An empty node splits in turn at the middle.
+ */
+template<class T> int Node<T>::choose_split ( T& point ) const {
+	int turn = hist.size() % dims;
+	if (split_policy == ROUND_ROBIN_SPLIT || pool.get_size() == 0) {
+		point = pool.get_median (turn, exact_median);
+		return turn;
+	}
+
+	std::vector<std::vector<T> > coords (dims);
+	std::vector<double> spread (dims, 0);
+	std::vector<T> medians (dims);
+	for (int j = 0; j < dims; ++j) {
+		pool.sample (j, exact_median, coords[j]);
+		if (coords[j].empty()) {
+			medians[j] = pool.get_lo()[j] + (pool.get_hi()[j]-pool.get_lo()[j])/2;
+			continue;
 		}
+		spread[j] = (double) ::nth_quantile (coords[j], .9) - ::nth_quantile (coords[j], .1);
+		medians[j] = ::nth_quantile (coords[j], .5);
 	}
-	return 0;
+
+	int widest = turn;
+	for (int i = 1; i < dims; ++i) {
+		int j = (turn+i) % dims;
+		if (spread[j] > spread[widest])
+			widest = j;
+	}
+
+	std::vector<T> queries;
+	pthread_mutex_lock (&workload_lock);
+	queries = workload;
+	pthread_mutex_unlock (&workload_lock);
+	unsigned count = queries.size() / (2*dims);
+
+	if (split_policy == BALANCED_SPLIT && count > 0 && !coords[widest].empty()) {
+		/* tuples and queried keys each weigh one half in all, the keys at the middle of their regions */
+		std::vector<std::pair<T,double> > weighted;
+		for (unsigned i = 0; i < coords[widest].size(); ++i)
+			weighted.push_back (std::make_pair (coords[widest][i], .5 / coords[widest].size()));
+		for (unsigned i = 0; i < count; ++i) {
+			T* query = &queries[i*2*dims];
+			T center = query[widest] + (query[dims+widest]-query[widest])/2;
+			center = std::max (pool.get_lo()[widest], std::min (center, pool.get_hi()[widest]));
+			weighted.push_back (std::make_pair (center, .5 / count));
+		}
+		std::sort (weighted.begin(), weighted.end());
+
+		double sum = 0;
+		unsigned i = 0;
+		while (i+1 < weighted.size() && (sum += weighted[i].second) < .5)
+			++i;
+		point = weighted[i].first;
+		return widest;
+	}
+
+	if (split_policy == WORKLOAD_SPLIT && count > 0) {
+		int cheapest = widest;
+		std::vector<unsigned> straddling (dims, 0);
+		for (unsigned i = 0; i < count; ++i) {
+			T* query = &queries[i*2*dims];
+			for (int j = 0; j < dims; ++j)
+				if (query[j] < medians[j] && query[dims+j] >= medians[j])
+					++straddling[j];
+		}
+		for (int i = 0; i < dims; ++i) {
+			int j = (widest+i) % dims;
+			if (coords[j].empty())
+				continue;
+			if (straddling[j] < straddling[cheapest] || (straddling[j] == straddling[cheapest] && spread[j] > spread[cheapest]))
+				cheapest = j;
+		}
+		point = medians[cheapest];
+		return cheapest;
+	}
+
+	point = medians[widest];
+	return widest;
 }
 
 template<class T> Node<T>& Node<T>::split () {
-	int splt_dim = hist.size() % dims;
+	T median;
+	int splt_dim = choose_split (median);
 
 	T lo1 [dims];
-	T hi0 [dims];
 
 	for (int j = 0; j < dims; ++j) {
 		if (j == splt_dim) {
-			lo1[j] = pool.get_median (splt_dim);
-			hi0[j] = lo1[j];
+			lo1[j] = median;
 		} else {
 			lo1[j] = pool.get_lo()[j];
-			hi0[j] = pool.get_hi()[j];
 		}
 	}
 
-	/* old pool */
-	Pool<T>* lo_pool = new Pool<T> (dims, pool.get_lo(), hi0);
-
-	std::vector<std::pair<T*, char*>*> data;
-	pool.range (pool.get_lo(), hi0, data);
-	random_shuffle (data.begin(), data.end());
-	for (unsigned j = 0; j < data.size(); ++j)
-		lo_pool->push (data.at(j)->first, data.at(j)->second);
-	data.clear();
-
 	/* new node */
 	int new_node_port = port + (1<<hist.size());
 
@@ -1171,11 +2565,8 @@ template<class T> Node<T>& Node<T>::split () {
 			lo1,
 			pool.get_hi());
 
-	pool.range (lo1, pool.get_hi(), data);
-	random_shuffle (data.begin(), data.end());
-	for (unsigned j = 0; j < data.size(); ++j)
-		new_node->pool.push (data.at(j)->first, data.at(j)->second);
-	data.clear();
+	/* old pool swaps in a grid of the tuples it keeps over its lower half */
+	pool.split (splt_dim, median, new_node->pool);
 
 	new_node->hist.insert (new_node->hist.end(), hist.begin(), hist.end());
 	new_node->hist.push_back (true);
@@ -1184,6 +2575,9 @@ template<class T> Node<T>& Node<T>::split () {
 	pts.push_back ( lo1[splt_dim] );
 	new_node->pts.insert (new_node->pts.end(), pts.begin(), pts.end());
 
+	axes.push_back (splt_dim);
+	new_node->axes.insert (new_node->axes.end(), axes.begin(), axes.end());
+
 	new_node->frontlink_hosts.insert (new_node->frontlink_hosts.end(),
 			frontlink_hosts.begin(),
 			frontlink_hosts.end());
@@ -1202,38 +2596,162 @@ template<class T> Node<T>& Node<T>::split () {
 	::vec2stream<T> ( std::cerr, lo1 + splt_dim, 1, '\n');
 	std::cerr << "\n";
 
-	pool = *lo_pool;
-
 	return *new_node;
 }
 
 template<class T> inline int Node<T>::forward_to (T key[]) const {
 	for (unsigned j = 0; j < hist.size(); ++j) {
-		int dim = j % dims;
-		if ((hist.at(j) && key[dim] < pts.at(j)) || (!hist.at(j) && key[dim] >= pts.at(j)))
+		int dim = axes.at(j);
+		T point = split_point (j);
+		if ((hist.at(j) && key[dim] < point) || (!hist.at(j) && key[dim] >= point))
 			return j;
 	}
 	return -1;
 }
 
-template<class T> void Node<T>::unlink () {
-	for (std::vector<ClientSocket*>::const_iterator vi=skip.begin(); vi!=skip.end(); ++vi) {
-		(*vi)->close();
-		delete *vi;
+/*
+ * A sibling shifting its boundary stores the moved bound of the region
+ * before the split point, both with release, so a split point loaded with
+ * acquire that no longer leads away from key comes with the region that
+ * holds it, and the region is checked anew before the way is deemed lost.
+ */
+template<class T> bool Node<T>::beyond (T key[], int& dest_link) const {
+	dest_link = -1;
+	if (pool.isRelevant (key))
+		return false;
+	dest_link = forward_to (key);
+	return dest_link != -1 || !pool.isRelevant (key);
+}
+
+/*
+ * A route is taken only to an owner whose path begins with that of the
+ * subtree behind dest_link, the one the split history leads the key to.
+ * Then the owner shares a longer prefix with the path to the key than
+ * this node does, as it would after the hop over the link, so a stale
+ * route still gets the request closer and no two routes bounce it back
+ * and forth.
+ */
+template<class T> int Node<T>::forward_route ( int dest_link, char type, T* key, const std::string& value, std::string& msg, std::string* owner ) {
+	if (routes.get_capacity() == 0)
+		return 0;
+
+	std::string prefix = get_id().substr (0, dest_link);
+	prefix.push_back (hist.at(dest_link) ? '0' : '1');
+
+	typename RouteCache<T>::Route* route = routes.acquire (key, prefix);
+	if (route == 0)
+		return 0;
+
+	/* the route is connected by the first request to take it, not by the reply that named the owner */
+	if (route->link == 0) {
+		ClientSocket* cs = 0;
+		Link* link = 0;
+		try{
+			cs = new ClientSocket (route->host, route->port, ROUTE_TIMEOUT);
+			negotiate (cs);
+			link = new Link (cs);
+		}catch (std::exception &e){
+			std::cerr << "** " << get_id() << "@" << port << " unable to establish a route to " << route->host << ":" << route->port << ".\n";
+			delete cs;
+		}
+		routes.connect (route, link);
+		if (link == 0) {
+			routes.release (route);
+			return 0;
+		}
 	}
-	skip.clear();
 
-	void **ret = 0;
+	int status = 1;
+	try{
+		/* lookups are text alone, tuples go in the encoding of the link */
+		std::string response = route->link->request (type == 'L' ? msg : relay (route->link, type, key, value, msg));
 
-	unsigned thread_counter = 0;
-	for (std::vector<pthread_t*>::iterator vi = server_threads.begin(); vi!=server_threads.end(); ++vi) {
-		std::cerr << "** " << get_id() << "@" << port
-			<< " joining node handling thread#" << ++thread_counter << "/"
-			<< server_threads.size() << "\n";
-		pthread_join(**vi, ret);
-		delete *vi;
+		if (!accept_reply (type, response, route->host, route->port, owner)) {
+			std::cerr << "** " << get_id() << "@" << port << " failed to forward message: " << msg;
+			status = -1;
+		}else{
+			std::cerr << "** " << get_id() << "@" << port << " is forwarding to " << route->host << ":" << route->port << " message: " << msg;
+		}
+	}catch (std::exception &e){
+		std::cerr << "** " << get_id() << "@" << port << " traced that the route to " << route->host << ":" << route->port << " has failed.\n";
+		routes.forget (route->host, route->port);
+		status = -1;
+	}
+	routes.release (route);
+	return status;
+}
+
+/**
+ * U OK 127.0.0.1 5001 (.5,0) (1,.5) 10\n
+ *
+ * The reply to a peer names the owner by address, region and path, after
+ * the #HOST and #ID of an answer. A reply naming another owner than the
+ * one at via_host:via_port redirects, and drops what was cached for that.
+ */
+template<class T> bool Node<T>::accept_reply ( char type, const std::string& response, const std::string& via_host, int via_port, std::string* owner ) {
+	if (response.size() < 5 || response.at(0) != type || response.compare (1, 3, " OK") != 0)
+		return false;
+	if (response.at(4) != ' ')
+		return response.at(4) == '\n';
+
+	std::string owner_host, id;
+	int owner_port = 0;
+	T lo [dims];
+	T hi [dims];
+	try{
+		std::stringstream in (response.substr (5), std::stringstream::in);
+		char symbol;
+		in >> owner_host >> owner_port >> symbol;
+		::stream2vec<T> (in, lo, dims, ',');
+		in >> symbol >> symbol;
+		::stream2vec<T> (in, hi, dims, ',');
+		in >> symbol;
+		if (!in)
+			return true;
+		in >> id;
+	}catch (std::exception &e){
+		return true;
+	}
+
+	if (owner != 0)
+		*owner = response.substr (5);
+
+	if (routes.get_capacity() == 0 || (owner_host == via_host && owner_port == via_port))
+		return true;
+
+	routes.forget (via_host, via_port);
+	routes.learn (owner_host, owner_port, id, lo, hi);
+	return true;
+}
+
+template<class T> std::string Node<T>::describe_owner ( const Node& holder ) const {
+	std::stringstream out (std::stringstream::out);
+	out << host << " " << port << " (";
+	::vec2stream<T> (out, holder.get_lo(), dims, ',');
+	out << ") (";
+	::vec2stream<T> (out, holder.get_hi(), dims, ',');
+	out << ") " << holder.get_id() << "\n";
+	return out.str();
+}
+
+template<class T> void Node<T>::cut_links ( unsigned size ) {
+	std::vector<Link*> cut;
+	pthread_mutex_lock (&skip_lock);
+	if (skip.size() > size) {
+		cut.assign (skip.begin()+size, skip.end());
+		skip.resize (size);
 	}
-	server_threads.clear();
+	pthread_mutex_unlock (&skip_lock);
+
+	for (std::vector<Link*>::const_iterator vi=cut.begin(); vi!=cut.end(); ++vi)
+		release_link (*vi);
+}
+
+template<class T> void Node<T>::unlink () {
+	cut_links (0);
+	routes.clear();
+
+	/* the workers are detached and may be the caller, so they end with the process */
 }
 
 template<class T> void Node<T>::link () {
@@ -1242,14 +2760,15 @@ template<class T> void Node<T>::link () {
 	for (unsigned j = skip.size(); j < frontlink_ports.size(); ++j) {
 		std::cerr << "** " << get_id() << "@" << port << " establishes connection with link#" << j << " @" << frontlink_hosts.at(j) << ":"<<frontlink_ports.at(j)<<".\n";
 
-		ClientSocket *cs = 0;
+		Link* link = 0;
 		try{
-			cs = new ClientSocket (frontlink_hosts.at(j), frontlink_ports.at(j));
-			skip.push_back (cs);
+			link = connect_link (frontlink_hosts.at(j), frontlink_ports.at(j));
 		}catch (std::exception &e){
 			std::cerr << "** " << get_id() << "@" << port << " unable to establish connection with link#" << j << " @" << frontlink_hosts.at(j) << ":"<<frontlink_ports.at(j)<<".\n";
-			skip.push_back (0);
 		}
+		pthread_mutex_lock (&skip_lock);
+		skip.push_back (link);
+		pthread_mutex_unlock (&skip_lock);
 	}
 }
 
@@ -1263,7 +2782,7 @@ template<class T> int Node<T>::merge_hi (Node &hi) {
 		return -1;
 	}
 
-	int last_splt = (hist.size()-1) % dims;
+	int last_splt = axes.back();
 	for (int j = 0; j < dims; ++j) {
 		if (j == last_splt) {
 			if (hi.pool.get_lo()[j] != pool.get_hi()[j]) {
@@ -1285,27 +2804,19 @@ template<class T> int Node<T>::merge_hi (Node &hi) {
 
 	pool.set_hi (hi.pool.get_hi());
 
-	std::vector<std::pair<T*, char*>*> data;
-
-	hi.pool.range(hi.pool.get_lo(), hi.pool.get_hi(), data);
-	random_shuffle(data.begin(), data.end());
-	for (unsigned j = 0; j < data.size(); ++j) {
-		T* key = (T*) calloc (dims, dims*sizeof(T));
-		memcpy (key, data.at(j)->first, dims*sizeof(T));
-
-		char* buffer = (char*) malloc (strlen(data.at(j)->second) + 1);
-		strcpy (buffer, data.at(j)->second);
-
-		pool.push (key, buffer);
-	}
+	/* the tuples of the merged node change ownership */
+	pool.absorb (hi.pool);
 
 	hist.pop_back ();
-	skip.pop_back ();
 	pts.pop_back ();
+	axes.pop_back ();
 
 	frontlink_hosts.pop_back ();
 	frontlink_ports.pop_back ();
 
+	/* a join undone never got the link of the split, so only those beyond the history go */
+	cut_links (hist.size());
+
 	std::cerr << "** " << get_id() << "0@" << port << " was merged with "
 		<< hi.get_id() << " on dim#" << last_splt << "\n";
 	return 0;
@@ -1321,7 +2832,7 @@ template<class T> int Node<T>::merge_lo (Node &lo) {
 		return -1;
 	}
 
-	int last_splt = (hist.size()-1) % dims;
+	int last_splt = axes.back();
 	for (int j = 0; j < dims; ++j) {
 		if (j == last_splt) {
 			if (pool.get_lo()[j] != lo.pool.get_hi()[j]) {
@@ -1343,27 +2854,18 @@ template<class T> int Node<T>::merge_lo (Node &lo) {
 
 	pool.set_lo (lo.pool.get_lo());
 
-	std::vector<std::pair<T*, char*>*> data;
-
-	lo.pool.range(lo.pool.get_lo(), lo.pool.get_hi(), data);
-	random_shuffle(data.begin(), data.end());
-	for (unsigned j = 0; j < data.size(); ++j) {
-		T* key = (T*) calloc (dims, dims*sizeof(T));
-		memcpy (key, data.at(j)->first, dims*sizeof(T));
-
-		char* buffer = (char*) malloc (strlen(data.at(j)->second) + 1);
-		strcpy (buffer, data.at(j)->second);
-
-		pool.push (key, buffer);
-	}
+	/* the tuples of the merged node change ownership */
+	pool.absorb (lo.pool);
 
 	hist.pop_back ();
-	skip.pop_back ();
 	pts.pop_back ();
+	axes.pop_back ();
 
 	frontlink_hosts.pop_back ();
 	frontlink_ports.pop_back ();
 
+	cut_links (hist.size());
+
 	std::cerr << "** " << get_id() << "1@" << port << " was merged with "
 		<< lo.get_id() << " on dim#" << last_splt << "\n";
 	return 0;
@@ -1378,6 +2880,7 @@ template<class T> int Node<T>::depart () {
 
 	assert (frontlink_hosts.size() == frontlink_ports.size());
 	ClientSocket cs (frontlink_hosts.back(), frontlink_ports.back());
+	cs.set_framed (framed_protocol);
 
 	cs << "G " + get_id().substr(0, hist.size()-1) + (hist.back() ? "0" : "1") + "\n" + marshalize(true);
 
@@ -1447,10 +2950,10 @@ template<class T> int Node<T>::process_merge_msg (std::string& msg) {
 		to_mrg->port = port;
 		to_mrg->host = host;
 
-		unsigned i = 0;
 		unsigned bad = 0;
 		unsigned failed = 0;
-		for (std::vector<ClientSocket*>::const_iterator vi=skip.begin(); vi!=skip.end(); ++vi) {
+		std::vector<Forward> forwards;
+		for (unsigned i=0; i<skip.size(); ++i) {
 			std::string link_id;
 			for (unsigned j=0; j<i; ++j) {
 				link_id.push_back (hist.at(j) ? '1' : '0');
@@ -1458,26 +2961,28 @@ template<class T> int Node<T>::process_merge_msg (std::string& msg) {
 			link_id.push_back (hist.at(i) ? '0' : '1');
 
 			if (to_mrg->get_id().compare(link_id) != 0) {
-				try{
-					std::cerr << "** " << get_id() << "@" << port << " To forward maintenance message to link#" << i << " corresponding to node " << link_id << "X.\n";
-
-					std::string response;
-					*skip.at(i) << "O " << get_id() << "\n" << to_mrg->marshalize(false);
-					*skip.at(i) >> response;
+				std::cerr << "** " << get_id() << "@" << port << " To forward maintenance message to link#" << i << " corresponding to node " << link_id << "X.\n";
 
-					if (response.compare("O OK\n") != 0){
-						std::cerr << "** " << get_id() << "@" << port << " failed response from overlay maintenance message: " << msg;
-						++bad;
-					}
-				}catch (std::exception &e){
+				if (!post_link (i, "O " + get_id() + "\n" + to_mrg->marshalize(false), "\n", forwards)) {
 					std::cerr << "** " << get_id() << "@" << port << " traced that link#" << i << " has failed.\n";
-					skip [i] = 0;
 					++failed;
 				}
 			}else{
 				std::cerr << "** " << get_id() << "@" << port << " Omitting maintenance message to link#" << i << " corresponding to node " << link_id << "X.\n";
 			}
-			++i;
+		}
+		for (unsigned f=0; f<forwards.size(); ++f) {
+			try{
+				std::string response = collect (forwards[f]);
+
+				if (response.compare("O OK\n") != 0){
+					std::cerr << "** " << get_id() << "@" << port << " failed response from overlay maintenance message: " << msg;
+					++bad;
+				}
+			}catch (std::exception &e){
+				std::cerr << "** " << get_id() << "@" << port << " traced that link#" << forwards[f].index << " has failed.\n";
+				++failed;
+			}
 		}
 		return -bad-failed;
 	}
@@ -1509,20 +3014,22 @@ template<class T> std::string Node<T>::marshalize (bool print_data) const {
 	::vec2stream<T> ( out, temp, pts.size(), '\n' );
 	out << "\n";
 
+	/* split dimensions */
+	for (unsigned j = 0; j < axes.size(); ++j)
+		out << axes.at(j) << " ";
+	out << "\n";
+
 	/* links */
 	for (unsigned j = 0; j < hist.size(); ++j)
 		out << frontlink_hosts.at(j) << " " << frontlink_ports.at(j) << "\n";
 
 	if (print_data) {
 		/* ( key, value ) tuple array */
-		std::vector<std::pair<T*, char*>*> ans;
-		pool.range(pool.get_lo(), pool.get_hi(), ans);
-		out << "#TUPLES " << ans.size() << "\n";
-
-		for (unsigned i = 0; i < ans.size(); ++i) {
-			::vec2stream<T> ( out, ans.at(i)->first, dims, ',' );
-			out << " " << ans.at(i)->second << "\n";
-		}
+		/* counted as printed, since writers may go on meanwhile */
+		std::stringstream tuples (std::stringstream::out);
+		tuple_printer<T> printer (tuples, dims);
+		pool.scan (printer);
+		out << "#TUPLES " << printer.size << "\n" << tuples.str();
 	}
 
 	out << "#END\n";
@@ -22,11 +22,75 @@
 
 #include "ServerSocket.h"
 #include "ClientSocket.h"
+#include "ConnectionCache.h"
+#include "Link.h"
+#include "RouteCache.h"
 #include "Pool.h"
 #include <pthread.h>
 #include <sched.h>
 #include <map>
 
+/* splits on the exact median instead of a sampled estimate */
+extern bool exact_median;
+
+/* tuples held by each tree-node of a pool */
+extern unsigned bucket_size;
+
+/* share of tombstones in a pool that triggers compaction */
+extern double compaction_ratio;
+
+/* sub-pools on a grid over the region of a node, each with a lock of its own */
+extern unsigned pool_shards;
+
+/* threads serving the connections of a node, however many they are */
+extern unsigned server_workers;
+
+/* peers exchange framed messages instead of text */
+extern bool framed_protocol;
+
+/* tuples and requests per second beyond which a node sheds load, unless 0 */
+extern unsigned overload_tuples;
+extern double overload_rate;
+
+/* idle peers in standby that overloaded nodes recruit to split with */
+extern std::vector<std::pair<std::string,int> > spare_peers;
+
+/*
+ * how a node picks the dimension and the point of a split: each dimension
+ * in turn at the median, the dimension of widest spread at the median, that
+ * dimension at the point halving tuples and requests alike, or the
+ * dimension whose median the fewest observed queries straddle
+ */
+enum SplitPolicy {ROUND_ROBIN_SPLIT, MAX_SPREAD_SPLIT, BALANCED_SPLIT, WORKLOAD_SPLIT};
+extern SplitPolicy split_policy;
+
+/* routes to the owners of remote regions each node caches, none if 0 */
+extern unsigned route_capacity;
+
+/* an accepted connection along with what is received of it but not handled yet */
+struct Connection {
+	ServerSocket sock;
+	std::string data;
+
+	/* where the pending message starts, and where the search for its end resumes */
+	size_t offset;
+	size_t scanned;
+
+	/* a link of a peer, which is told the owner of what it forwards */
+	bool peer;
+
+	Connection () : offset(0), scanned(0), peer(false) {}
+};
+
+/* a neighbor copied out of a pool, to be merged with those found elsewhere */
+template<class T> struct Neighbor {
+	double distance;
+	std::vector<T> key;
+	std::string value;
+
+	bool operator < (const Neighbor& other) const {return distance < other.distance;}
+};
+
 template<class T> class Node {
 
 	std::string host;
@@ -40,11 +104,40 @@ template<class T> class Node {
 	/* split points */
 	std::vector<T> pts;
 
+	/* split dimensions */
+	std::vector<int> axes;
+
 	/* data pool */
 	Pool<T> pool;
 
-	//pthread_mutex_t pool_lock;
-
+	/* background compaction of tombstones, woken up by deletions */
+	mutable pthread_mutex_t compaction_lock;
+	pthread_t compactor;
+	pthread_cond_t compaction_cond;
+	bool compacting;
+	bool quitting;
+
+	/* background rebalancing of an overloaded node, woken up by the same lock */
+	pthread_t rebalancer;
+	pthread_cond_t rebalance_cond;
+	bool rebalancing;
+
+	/* the latest query regions the node answered for, kept for the split policy */
+	mutable pthread_mutex_t workload_lock;
+	std::vector<T> workload;
+	unsigned observed;
+
+	/* messages handled so far, and their rate over the last period */
+	unsigned long long requests;
+	double request_rate;
+
+	/*
+	 * held for reading by the handlers, which route by the split points,
+	 * and for writing while a boundary shifts or a peer joins, so that no
+	 * message is routed by the points of one side and the region of the
+	 * other, nor to a link not yet established
+	 */
+	pthread_rwlock_t routing_lock;
 
 	/* link to a peer of the opposite side for each split. */
 	std::vector<std::string> frontlink_hosts;
@@ -52,23 +145,50 @@ template<class T> class Node {
 
 	//pthread_mutex_t backlink_lock;
 
-	/* serving connected node clients with threads */
+	/*
+	 * a fixed pool of workers waits on an epoll reactor for the server
+	 * socket and the accepted connections, each armed for one event at a
+	 * time so that a single worker handles it until it is armed again
+	 */
+	int reactor;
+	ServerSocket* listener;
 	std::vector<pthread_t*> server_threads;
-	std::vector<ClientSocket*> skip;
+
+	/*
+	 * skip-links, one slot per split; each slot holds a reference to its
+	 * link, and a handler holds one more while it uses it, so that a link
+	 * dropped from its slot on failure lives until the last user lets go
+	 */
+	mutable pthread_mutex_t skip_lock;
+	std::vector<Link*> skip;
 	std::vector<Node<T>*> cached;
 
+	/* warm connections to requesters for the answers */
+	ConnectionCache answers;
+
+	/* shortcuts to the owners met in the replies of forwarded requests */
+	RouteCache<T> routes;
+
 public:
 
 	Node (std::string &hst, int prt,
 			int dms, T const* lo, T const* hi)
-		: host (hst), port (prt), dims(dms), pool (dms,lo,hi) {
-		//pthread_mutex_init (&pool_lock, 0);
+		: host (hst), port (prt), dims(dms), pool (dms,lo,hi,bucket_size,pool_shards), routes (dms,route_capacity) {
+		init_locks ();
 		//pthread_mutex_init (&backlink_lock, 0);
 	}
 
 	~Node () {
 		unlink();
-		//pthread_mutex_destroy (&pool_lock);
+		stop_compaction ();
+		stop_rebalancing ();
+		pthread_cond_destroy (&rebalance_cond);
+		pthread_rwlock_destroy (&routing_lock);
+		pthread_mutex_destroy (&skip_lock);
+		pthread_mutex_destroy (&workload_lock);
+		pthread_cond_destroy (&compaction_cond);
+		pthread_mutex_destroy (&compaction_lock);
+		if (reactor >= 0) close (reactor);
 		//pthread_mutex_destroy (&backlink_lock);
 	}
 
@@ -80,24 +200,151 @@ public:
 
 	/* node server functionality */
 	void serve ();
-	void handle (ServerSocket& sock);
 
-	int process_async_msg (std::string&);
+	/* handles the connections the reactor finds ready until the process ends */
+	void work ();
+
+	/* handles the complete messages received so far, returns whether the connection stays open */
+	bool handle (Connection& conn);
+
+	/* handles an asynchronous message, naming the owner of its key in owner if given */
+	int process_async_msg (std::string&, std::string* owner=0);
+
+	/* rebuilds degraded subtrees of the pool until the node quits */
+	void compact ();
+
+	/* sheds load whenever the node is overloaded until it quits */
+	void rebalance ();
 
 private:
 
+	void init_locks ();
+	void stop_compaction ();
+	void stop_rebalancing ();
+
+	/* locks out the handlers that route, giving way to them now and then */
+	void exclude_routing ();
+
+	/* has a spare peer join at this node, returns whether one did */
+	bool recruit_spare ();
+
+	/* hands the tuples beyond a boundary shifted by tuples or by rate to the sibling, returns whether it took them */
+	bool shift_boundary (bool by_rate);
+
+	/* returns the length of the pending message of conn once complete, or 0 */
+	size_t frame (Connection& conn) const;
+
+	/* drops the skip-links that no longer answer */
+	void probe_links ();
+
+	/* returns skip-link j held for the caller, or 0 if there is none */
+	Link* hold_link (unsigned j) const;
+
+	/* lets go of a held link, deleting it if it was the last holder */
+	void release_link (Link* link) const;
+
+	/* empties slot j if it still holds link, which failed */
+	void drop_link (unsigned j, Link* link);
+
+	/* puts link in slot j, letting go of the one it replaces */
+	void put_link (unsigned j, Link* link);
+
+	/* posts msg over skip-link j into forwards, held until collected; returns false if there is no link or it failed */
+	bool post_link (unsigned j, const std::string& msg, const char* trailer, std::vector<Forward>& forwards);
+
+	/* the same, posting binary_msg instead if the link is binary */
+	bool post_link (unsigned j, const std::string& msg, const std::string& binary_msg, const char* trailer, std::vector<Forward>& forwards);
+
+	/* returns the reply of a posted forward and lets go of its link, dropping it if it failed */
+	std::string collect (Forward& forward);
+
+	/* sends an answer to its requester, returns whether it left */
+	bool deliver (std::string& dest_host, int dest_port, const std::string& answer);
+
+	/*
+	 * collects into found the K nearest neighbors of key within radius out
+	 * of the pool and the links from depth on, visited nearest first and
+	 * each within the K-th distance met so far; counts the sub-queries sent
+	 * into forwards, and returns whether every link answered
+	 */
+	bool gather_nearest (T* key, int K, double radius, unsigned depth, std::vector<Neighbor<T> >& found, unsigned& forwards);
+
+	/* forwards the parts of a range query beyond the region of the node */
+	int forward_range (char symbol, T* lo, T* hi, std::string& dest_host, int dest_port, int hops, std::string& msg);
+
+	/* sends those parts with tail, for replies ending with trailer, returns -1 if a link failed; binary ones go as keys over binary links */
+	int post_range (char symbol, T* lo, T* hi, const std::string& tail, const char* trailer, std::vector<Forward>& forwards, bool binary=false);
+
+	/* returns the dimension of the next split by the policy, and its point */
+	int choose_split (T& point) const;
+
+	/* samples a query region or key answered for, if the policy weighs the workload */
+	void observe (const T* lo, const T* hi);
+
+	/* reads split point j, which a shifting sibling may move under the routing readers */
+	T split_point (unsigned j) const {T v; __atomic_load (&pts[j], &v, __ATOMIC_ACQUIRE); return v;}
+
 	/* return index of the most relevant link */
 	int forward_to (T key[]) const;
+
+	/* returns whether key lies beyond the region, along with the link towards it or -1 if lost */
+	bool beyond (T key[], int& dest_link) const;
 	int forward_cache (T key[]) const;
 
+	/*
+	 * sends msg of type for key straight to its owner if a cached route
+	 * leads below dest_link; returns 1 once it is done, -1 if it failed, or
+	 * 0 if no route was taken
+	 */
+	int forward_route (int dest_link, char type, T* key, const std::string& value, std::string& msg, std::string* owner);
+
+	/* returns whether response is the OK of type, caching a route to the owner it names unless that is host:port */
+	bool accept_reply (char type, const std::string& response, const std::string& via_host, int via_port, std::string* owner);
+
+	/* names the address of the node along with the path and the region of holder, for a reply to a peer */
+	std::string describe_owner (const Node& holder) const;
+
 	/* client interface implementation */
 
 	/*** asynchronous ***/
-	int process_insert_msg (std::string&);
-	int process_append_msg (std::string&);
-	int process_lookup_msg (std::string&);
+	int process_insert_msg (std::string&, std::string* owner);
+	int process_append_msg (std::string&, std::string* owner);
+	int process_lookup_msg (std::string&, std::string* owner);
 	int process_range_msg (std::string&);
+
+	/* answers a range query with every tuple of the overlay within it at once */
+	std::string process_collected_range_msg (std::string&);
+	void parse_range_msg (std::istream& in, T* lo, T* hi) const;
+	int process_aggregate_msg (std::string&);
 	int process_nearest_msg (std::string&);
+	int process_delete_msg (std::string&, std::string* owner);
+
+	/* answers a nearest neighbor sub-query of a peer with what its subtree holds */
+	std::string process_neighbors_msg (std::string&);
+
+	/* updates and appends of many keys at once, forwarded per link */
+	int process_batch_msg (std::string&);
+
+	/* binary tuples offered by a peer */
+	int process_encoding_msg (std::string&);
+
+	/* tuples beyond a boundary shifted by the sibling */
+	int process_shift_msg (std::string&);
+
+	/* frames the messages of a new link, and agrees on binary tuples with its peer */
+	void negotiate (ClientSocket* link) const;
+
+	/* returns a negotiated skip-link to a peer that may not listen yet, or throws after LINK_TIMEOUT */
+	Link* connect_link (const std::string& host, int port) const;
+
+	/* parses an update, append or delete of either encoding into key and value */
+	void parse_tuple_msg (std::string& msg, char type, T* key, std::string& value) const;
+
+	/* appends a pair of a batch, or an update, append or delete without its tag */
+	void encode_entry (std::string& out, bool binary, char type, T* key, const std::string& value) const;
+
+	/* returns msg, or its key and value encoded for link */
+	std::string relay (const Link* link, char type, T* key, const std::string& value, std::string& msg) const;
 
 	/*** synchronous ***/
 	int process_merge_msg (std::string&);
@@ -130,6 +377,9 @@ public:
 	void unlink ();
 	void link ();
 
+	/* lets go of the skip-links from size on */
+	void cut_links (unsigned size);
+
 	std::string get_host () const {return host;}
 	int get_port () const {return port;}
 };
@@ -20,76 +20,631 @@
 #include "Pool.h"
 #include "Dtree.cpp"
 
-template<class T> inline void Pool<T>::push ( T *key , char* val ) {
-	return dtree.push( key, val );
+/* keys drawn for an estimated median */
+#define MEDIAN_SAMPLE 4096
+
+/* retirements between attempts to reclaim */
+#define RECLAIM_PERIOD 64
+
+/* prime factors of the shard count are dealt to the dimensions in turn, largest first */
+template<class T> ShardGrid<T>::ShardGrid ( int dims, unsigned bucket, unsigned shards, const T* lo_key, const T* hi_key )
+	: cells (dims, 1) {
+
+	if ( lo_key != 0 && hi_key != 0 ) {
+		lo.assign ( lo_key, lo_key + dims );
+		hi.assign ( hi_key, hi_key + dims );
+
+		std::vector<unsigned> factors;
+		for (unsigned f=2; shards > 1; ) {
+			if ( shards % f == 0 ) {
+				factors.push_back (f);
+				shards /= f;
+			}else{
+				++f;
+			}
+		}
+		for (unsigned i=factors.size(); i-- > 0; )
+			cells [(factors.size()-1-i) % dims] *= factors[i];
+	}
+
+	unsigned count = 1;
+	for (int j=0; j<dims; ++j)
+		count *= cells[j];
+	for (unsigned i=0; i<count; ++i)
+		trees.push_back ( new Dtree<T,MIDAS_DIMS> (dims, bucket) );
 }
 
-template<class T> inline char* Pool<T>::pop ( T *key ) {
-	return dtree.pop( key );
+template<class T> ShardGrid<T>::~ShardGrid () {
+	for (unsigned i=0; i<trees.size(); ++i)
+		delete trees[i];
 }
 
-template<class T> inline std::pair<T*,char*>& Pool<T>::lookup ( T *key ) const {
-	TreeNode<T> const* ret = dtree.search( key );
-	if ( ret != 0 )
-		return *( new std::pair<T*,char*> (key, ret->val) );
-	return *(std::pair<T*,char*>*)0;
+template<class T> inline unsigned ShardGrid<T>::coordinate ( const T* key, int dim ) const {
+	if ( cells[dim] == 1 )
+		return 0;
+
+	double pos = ((double) key[dim] - lo[dim]) * cells[dim] / ((double) hi[dim] - lo[dim]);
+	if ( ! (pos > 0) )
+		return 0;
+	return pos < cells[dim] ? (unsigned) pos : cells[dim] - 1;
 }
 
-template<class T> void Pool<T>::range ( T *lo, T *hi, std::vector<std::pair<T*,char*>*>& ans ) const {
-	dtree.range ( lo, hi, ans );
+template<class T> unsigned ShardGrid<T>::locate ( const T* key ) const {
+	unsigned cell = 0;
+	for (unsigned j=0; j<cells.size(); ++j)
+		cell = cell * cells[j] + coordinate (key, j);
+	return cell;
 }
 
-template<class T> double Pool<T>::nearest ( T *key, int K, double radius, std::vector<std::pair<double,std::pair<T*,char*>*>*> &ans ) const {
-	return (radius < 0 ? radius : dtree.nearest(key, K, radius, ans));
+template<class T> void ShardGrid<T>::overlap ( const T* lo_key, const T* hi_key, std::vector<unsigned>& ans ) const {
+	int dims = cells.size();
+	unsigned from [dims];
+	unsigned to [dims];
+	unsigned at [dims];
+	for (int j=0; j<dims; ++j)
+		at[j] = from[j] = coordinate (lo_key, j);
+	for (int j=0; j<dims; ++j)
+		to[j] = coordinate (hi_key, j);
+
+	/* odometer over the coordinates of the overlapping cells */
+	for (;;) {
+		unsigned cell = 0;
+		for (int j=0; j<dims; ++j)
+			cell = cell * cells[j] + at[j];
+		ans.push_back (cell);
+
+		int j = dims - 1;
+		while ( j >= 0 && at[j] >= to[j] ) {
+			at[j] = from[j];
+			--j;
+		}
+		if ( j < 0 )
+			break;
+		++at[j];
+	}
 }
 
-template<class T> void Pool<T>::update ( T *key, char* val ) {
-	TreeNode<T>* ans = dtree.search( key );
+/* outer cells stretch out to infinity, as keys beyond the grid are clamped into them */
+template<class T> double ShardGrid<T>::sq_dist ( const T* key, unsigned cell ) const {
+	double sum = 0;
+	for (unsigned j=cells.size(); j-- > 0; ) {
+		unsigned c = cell % cells[j];
+		cell /= cells[j];
+		if ( cells[j] == 1 )
+			continue;
 
-	if ( ans == 0 )
-		return dtree.push ( key, val );
+		double width = ((double) hi[j] - lo[j]) / cells[j];
+		double low = lo[j] + c * width;
+		double high = low + width;
+		if ( c > 0 && key[j] < low )
+			sum += (low - key[j]) * (low - key[j]);
+		else if ( c + 1 < cells[j] && key[j] > high )
+			sum += (key[j] - high) * (key[j] - high);
+	}
+	return sum;
+}
 
-	delete[] ans->val;
-	ans->val = val;
+template<class T> void Pool<T>::init ( unsigned shards ) {
+	shard_count = shards < 1 ? 1 : shards;
+	this->shards = new Shard [shard_count];
+	for (unsigned i=0; i<shard_count; ++i) {
+		pthread_mutex_init (&this->shards[i].lock, 0);
+		this->shards[i].retirements = 0;
+	}
+	pthread_mutex_init (&grid_lock, 0);
+	grid = new ShardGrid<T> (dims, bucket, shard_count, lo, hi);
 }
 
-template<class T> void Pool<T>::concatenate (T *key, char* val) {
-	TreeNode<T>* ans = dtree.search ( key );
+template<class T> Pool<T>::~Pool () {
+	for (unsigned i=0; i<shard_count; ++i) {
+		reclaim (i, true);
+		pthread_mutex_destroy (&shards[i].lock);
+	}
+	reclaim_grids (true);
+	delete grid;
+	delete [] shards;
+	pthread_mutex_destroy (&grid_lock);
+	free(lo);
+	free(hi);
+}
 
-	if ( ans == 0 ) {
-		return dtree.push ( key, val );
-	}else{
-		char* buffer = (char*) malloc (strlen(ans->val)+strlen(val)+1);
+/* the grid cannot change while one of its shards is locked, as rebuilds lock them all */
+template<class T> unsigned Pool<T>::lock_shard ( const T* key, ShardGrid<T>*& g ) {
+	for (;;) {
+		g = current ();
+		unsigned shard = g->locate (key);
+		pthread_mutex_lock (&shards[shard].lock);
+		if ( current () == g )
+			return shard;
+		pthread_mutex_unlock (&shards[shard].lock);
+	}
+}
+
+template<class T> void Pool<T>::lock_all () {
+	for (unsigned i=0; i<shard_count; ++i)
+		pthread_mutex_lock (&shards[i].lock);
+}
+
+template<class T> void Pool<T>::unlock_all () {
+	for (unsigned i=shard_count; i-- > 0; )
+		pthread_mutex_unlock (&shards[i].lock);
+}
+
+template<class T> void Pool<T>::retire ( unsigned shard, Value* val ) {
+	if ( val == 0 )
+		return;
+
+	shards[shard].retired_values.push_back ( std::make_pair (epochs.advance(), val) );
+	if ( ++shards[shard].retirements % RECLAIM_PERIOD == 0 )
+		reclaim (shard);
+}
+
+/* tags grow along each list, so the reclaimable items form a prefix */
+template<class T> void Pool<T>::reclaim ( unsigned shard, bool all ) {
+	unsigned long long oldest = all ? ~0ull : epochs.oldest();
+	Shard& sh = shards[shard];
 
-		strcpy (buffer, ans->val);
-		strcat (buffer, val);
+	unsigned j = 0;
+	for (; j<sh.retired_values.size() && sh.retired_values[j].first < oldest; ++j)
+		ValueStore::release ( sh.retired_values[j].second );
+	sh.retired_values.erase ( sh.retired_values.begin(), sh.retired_values.begin() + j );
+
+	for (j=0; j<sh.retired_nodes.size() && sh.retired_nodes[j].first < oldest; ++j)
+		grid->trees[shard]->reclaim ( sh.retired_nodes[j].second );
+	sh.retired_nodes.erase ( sh.retired_nodes.begin(), sh.retired_nodes.begin() + j );
+}
 
-		free (ans->val);
-		free (val);
+/* values of a replaced grid have moved on with its tuples */
+template<class T> void Pool<T>::reclaim_grids ( bool all ) {
+	pthread_mutex_lock (&grid_lock);
+	unsigned long long oldest = all ? ~0ull : epochs.oldest();
 
-		ans->val = buffer;
+	unsigned j = 0;
+	for (; j<retired_grids.size() && retired_grids[j].first < oldest; ++j) {
+		for (unsigned i=0; i<retired_grids[j].second->trees.size(); ++i)
+			retired_grids[j].second->trees[i]->release ();
+		delete retired_grids[j].second;
 	}
+	retired_grids.erase ( retired_grids.begin(), retired_grids.begin() + j );
+	pthread_mutex_unlock (&grid_lock);
 }
 
-template<class T> T Pool<T>::get_median ( int dim ) const {
-	if ( dtree.get_size() == 0 ) {
-		return (get_hi()[dim]-get_lo()[dim])/2 + get_lo()[dim];
+template<class T> void Pool<T>::gather ( TupleArray<T>& data ) {
+	for (unsigned i=0; i<grid->trees.size(); ++i)
+		grid->trees[i]->scan (data);
+}
+
+/* tree-nodes retired out of the old grid go away along with it */
+template<class T> void Pool<T>::swap ( TupleArray<T>& data ) {
+	ShardGrid<T>* fresh = new ShardGrid<T> (dims, bucket, shard_count, lo, hi);
+
+	if ( fresh->trees.size() == 1 ) {
+		fresh->trees[0]->bulk_load (data);
 	}else{
-		std::vector<std::pair<T*,char*>*> &temp = dtree.order ( dim );
-		return temp.at( temp.size()>>1 ) -> first [dim];
+		std::vector<TupleArray<T> > cells ( fresh->trees.size(), TupleArray<T> (dims) );
+		for (unsigned i=0; i<data.size(); ++i)
+			cells [fresh->locate (data.key(i))] ( data.key(i), data.val(i) );
+		for (unsigned i=0; i<cells.size(); ++i)
+			fresh->trees[i]->bulk_load (cells[i]);
 	}
+
+	ShardGrid<T>* old = grid;
+	__atomic_store_n (&grid, fresh, __ATOMIC_RELEASE);
+
+	for (unsigned i=0; i<shard_count; ++i)
+		shards[i].retired_nodes.clear ();
+
+	pthread_mutex_lock (&grid_lock);
+	retired_grids.push_back ( std::make_pair (epochs.advance(), old) );
+	pthread_mutex_unlock (&grid_lock);
+	reclaim_grids ();
 }
 
-template<class T> std::vector<std::pair<T*,char*>*>* Pool<T>::split ( int splt_dim ) const {
-	std::vector<std::pair<T*,char*>*>* pool_pair = new std::vector<std::pair<T*,char*>*>[2];
+template<class T> void Pool<T>::push ( T *key , Value* val ) {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g;
+	unsigned shard = lock_shard (key, g);
+	g->trees[shard]->push( key, val );
+	pthread_mutex_unlock (&shards[shard].lock);
+}
 
-	unsigned target_sz = (dtree.get_size()>>1);
-	std::vector<std::pair<T*,char*>*> &temp = dtree.order ( splt_dim );
+template<class T> bool Pool<T>::erase ( T *key ) {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g;
+	unsigned shard = lock_shard (key, g);
+	Value* val = g->trees[shard]->erase (key);
+	retire (shard, val);
+	pthread_mutex_unlock (&shards[shard].lock);
+	return val != 0;
+}
+
+template<class T> void Pool<T>::compact ( double ratio ) {
+	for (unsigned i=0; i<shard_count; ++i) {
+		pthread_mutex_lock (&shards[i].lock);
+		if ( i < grid->trees.size() ) {
+			std::vector<unsigned> unlinked;
+			grid->trees[i]->compact (ratio, unlinked);
+
+			if ( ! unlinked.empty() ) {
+				unsigned long long tag = epochs.advance();
+				for (unsigned j=0; j<unlinked.size(); ++j)
+					shards[i].retired_nodes.push_back ( std::make_pair (tag, unlinked[j]) );
+			}
+		}
+		reclaim (i);
+		pthread_mutex_unlock (&shards[i].lock);
+	}
+	reclaim_grids ();
+}
+
+/* readers keep to the old grid while the new one is loaded aside */
+template<class T> void Pool<T>::bulk_load ( TupleArray<T>& data ) {
+	lock_all ();
+	gather (data);
+	swap (data);
+	unlock_all ();
+}
+
+template<class T> void Pool<T>::upsert ( ShardGrid<T>* g, unsigned shard, T *key, Value* val ) {
+	Value** ans = g->trees[shard]->insert( key, val );
+
+	if ( ans != 0 ) {
+		Value* old = *ans;
+		__atomic_store_n (ans, val, __ATOMIC_RELEASE);
+		retire (shard, old);
+	}
+}
+
+template<class T> void Pool<T>::update ( T *key, Value* val ) {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g;
+	unsigned shard = lock_shard (key, g);
+	upsert (g, shard, key, val);
+	pthread_mutex_unlock (&shards[shard].lock);
+}
+
+/* orders tuples by key, then by their position */
+template<class T> class tuple_order {
+	TupleArray<T>& data;
+	int dims;
+
+public:
+	tuple_order ( TupleArray<T>& d, int dms ) : data(d), dims(dms) {}
+
+	bool operator () ( unsigned a, unsigned b ) const {
+		int cmp = compare ( a, b );
+		return cmp != 0 ? cmp < 0 : a < b;
+	}
+
+	int compare ( unsigned a, unsigned b ) const {
+		const T* x = data.key (a);
+		const T* y = data.key (b);
+		for (int j=0; j<dims; ++j)
+			if ( x[j] != y[j] )
+				return x[j] < y[j] ? -1 : 1;
+		return 0;
+	}
+};
+
+template<class T> void Pool<T>::push_batch ( TupleArray<T>& data ) {
+	if ( data.size() == 0 )
+		return;
+
+	EpochGuard guard (epochs);
+
+	/* a batch as large as the pool is cheaper loaded along with it in one rebuild */
+	if ( data.size() >= get_size() ) {
+		lock_all ();
+		TupleArray<T> all (dims);
+		all.reserve ( get_size() + data.size() );
+		gather (all);
+		for (unsigned i=0; i<data.size(); ++i)
+			all ( data.key(i), data.val(i) );
+
+		std::vector<unsigned> order ( all.size() );
+		for (unsigned i=0; i<order.size(); ++i)
+			order[i] = i;
+		tuple_order<T> by_key ( all, dims );
+		std::sort ( order.begin(), order.end(), by_key );
+
+		/* indexed tuples were gathered first, so the batch overrides them */
+		TupleArray<T> fresh (dims);
+		fresh.reserve ( all.size() );
+		for (unsigned i=0; i<order.size(); ++i) {
+			if ( i+1 < order.size() && by_key.compare (order[i], order[i+1]) == 0 )
+				retire ( 0, all.val(order[i]) );
+			else
+				fresh ( all.key(order[i]), all.val(order[i]) );
+		}
+		swap (fresh);
+		unlock_all ();
+		return;
+	}
+
+	/* pairs are grouped by shard in their order, so the last one of a key still wins */
+	ShardGrid<T>* g = current ();
+	std::vector<unsigned> cells ( data.size() );
+	std::vector<unsigned> first ( g->trees.size() + 1, 0 );
+	for (unsigned i=0; i<data.size(); ++i) {
+		cells[i] = g->locate ( data.key(i) );
+		++first [cells[i] + 1];
+	}
+	for (unsigned c=1; c<first.size(); ++c)
+		first[c] += first[c-1];
+	std::vector<unsigned> order ( data.size() );
+	for (unsigned i=0; i<data.size(); ++i)
+		order [first[cells[i]]++] = i;
+
+	unsigned i = 0;
+	while ( i < order.size() ) {
+		unsigned shard = cells [order[i]];
+		pthread_mutex_lock (&shards[shard].lock);
+		if ( current () != g )
+			break;
+		for (; i<order.size() && cells[order[i]] == shard; ++i)
+			upsert ( g, shard, data.key(order[i]), data.val(order[i]) );
+		pthread_mutex_unlock (&shards[shard].lock);
+	}
+	if ( i == order.size() )
+		return;
 
-	pool_pair[1].assign (temp.begin(), temp.begin() + target_sz);
-	pool_pair[0].assign (temp.begin() + target_sz, temp.end());
+	/* a rebuild laid a new grid meanwhile, so the rest is routed one by one */
+	pthread_mutex_unlock (&shards[cells[order[i]]].lock);
+	for (; i<order.size(); ++i) {
+		unsigned shard = lock_shard ( data.key(order[i]), g );
+		upsert ( g, shard, data.key(order[i]), data.val(order[i]) );
+		pthread_mutex_unlock (&shards[shard].lock);
+	}
+}
+
+template<class T> void Pool<T>::append ( T *key, const char* str, size_t len ) {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g;
+	unsigned shard = lock_shard (key, g);
+	Value** ans = g->trees[shard]->search ( key );
+
+	if ( ans == 0 )
+		g->trees[shard]->push ( key, ValueStore::create (str, len) );
+	else
+		ValueStore::append (*ans, str, len);
+	pthread_mutex_unlock (&shards[shard].lock);
+}
+
+/* sends the tuples below a split point to one array and the rest to another */
+template<class T> class tuple_splitter {
+	int dim;
+	T median;
+
+	TupleArray<T>& lo_data;
+	TupleArray<T>& hi_data;
+
+public:
+	tuple_splitter ( int d, T m, TupleArray<T>& lo, TupleArray<T>& hi ) : dim(d), median(m), lo_data(lo), hi_data(hi) {}
+
+	/* tuples on the split point belong to the upper half */
+	void operator () ( const T* key, Value* val ) {
+		if ( key[dim] < median )
+			lo_data ( key, val );
+		else
+			hi_data ( key, val );
+	}
+};
+
+template<class T> void Pool<T>::split ( int dim, T median, Pool& hi_pool ) {
+	lock_all ();
+	TupleArray<T> lo_data (dims);
+	TupleArray<T> hi_data (dims);
+
+	tuple_splitter<T> splitter ( dim, median, lo_data, hi_data );
+	for (unsigned i=0; i<grid->trees.size(); ++i)
+		grid->trees[i]->scan (splitter);
+
+	hi_pool.bulk_load (hi_data);
+
+	/* the grid is laid anew over the lower half */
+	set_bound (dim, median, true);
+	swap (lo_data);
+	unlock_all ();
+}
+
+template<class T> void Pool<T>::split_lo ( int dim, T median, Pool& lo_pool ) {
+	lock_all ();
+	TupleArray<T> lo_data (dims);
+	TupleArray<T> hi_data (dims);
+
+	tuple_splitter<T> splitter ( dim, median, lo_data, hi_data );
+	for (unsigned i=0; i<grid->trees.size(); ++i)
+		grid->trees[i]->scan (splitter);
+
+	lo_pool.bulk_load (lo_data);
+
+	/* the grid is laid anew over the upper half */
+	set_bound (dim, median, false);
+	swap (hi_data);
+	unlock_all ();
+}
+
+/* the pool of lower address is locked first */
+template<class T> void Pool<T>::absorb ( Pool& other ) {
+	Pool* first = this < &other ? this : &other;
+	Pool* second = this < &other ? &other : this;
+	first->lock_all ();
+	second->lock_all ();
+
+	TupleArray<T> data (dims);
+	other.gather (data);
+	TupleArray<T> none (dims);
+	other.swap (none);
+
+	gather (data);
+	swap (data);
+
+	second->unlock_all ();
+	first->unlock_all ();
+}
+
+/*
+ * the value stays readable for the epoch, so it is coalesced into a copy
+ * published in its place when the slot still holds it
+ */
+template<class T> template<class V> bool Pool<T>::lookup ( T *key, V& visitor ) {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
+	unsigned shard = g->locate (key);
+	Value** ans = g->trees[shard]->search( key );
+	Value* val = ans != 0 ? __atomic_load_n (ans, __ATOMIC_ACQUIRE) : 0;
+	if ( val == 0 )
+		return false;
+
+	if ( ValueStore::fragmented (val) && pthread_mutex_trylock (&shards[shard].lock) == 0 ) {
+		Value** slot = current () == g ? g->trees[shard]->search( key ) : 0;
+		if ( slot != 0 && *slot == val ) {
+			Value* whole = ValueStore::coalesce (val);
+			__atomic_store_n (slot, whole, __ATOMIC_RELEASE);
+			retire (shard, val);
+			val = whole;
+		}
+		pthread_mutex_unlock (&shards[shard].lock);
+	}
+
+	visitor ( key, val );
+	return true;
+}
+
+template<class T> template<class V> void Pool<T>::range ( T *lo, T *hi, V& visitor ) const {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
+
+	std::vector<unsigned> cells;
+	g->overlap (lo, hi, cells);
+	for (unsigned i=0; i<cells.size(); ++i)
+		g->trees[cells[i]]->range (lo, hi, visitor);
+}
+
+template<class T> template<class V> void Pool<T>::scan ( V& visitor ) const {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
+	for (unsigned i=0; i<g->trees.size(); ++i)
+		g->trees[i]->scan (visitor);
+}
+
+/* keeps the K nearest neighbors met across shards, along with copies of their keys */
+template<class T> class neighbor_merger {
+	int dims;
+	unsigned K;
+
+	std::vector<T> keys;
+	std::vector<Value*> vals;
+
+	/* (distance, row) with the farthest on top */
+	std::vector<std::pair<double,unsigned> > heap;
+
+public:
+	neighbor_merger ( int d, unsigned k ) : dims(d), K(k) {}
+
+	void operator () ( double distance, const T* key, Value* val ) {
+		unsigned row = heap.size();
+		if ( heap.size() == K ) {
+			if ( distance >= heap.front().first )
+				return;
+			std::pop_heap ( heap.begin(), heap.end() );
+			row = heap.back().second;
+			heap.pop_back ();
+		}else{
+			keys.resize ( (size_t) (row+1) * dims );
+			vals.resize ( row+1 );
+		}
+
+		std::copy ( key, key + dims, keys.begin() + (size_t) row * dims );
+		vals[row] = val;
+		heap.push_back ( std::make_pair (distance, row) );
+		std::push_heap ( heap.begin(), heap.end() );
+	}
+
+	/* radius left to search in */
+	double bound ( double radius ) const {return heap.size() == K ? heap.front().first : radius;}
+
+	/* calls visitor for the neighbors kept, farthest first, and returns the farthest distance or radius */
+	template<class V> double emit ( double radius, V& visitor ) {
+		if ( heap.empty() )
+			return radius;
+
+		std::sort_heap ( heap.begin(), heap.end() );
+		for (unsigned i=heap.size(); i-- > 0; )
+			visitor ( heap[i].first, &keys [(size_t) heap[i].second * dims], vals [heap[i].second] );
+		return heap.back().first;
+	}
+};
+
+/* shards are searched nearest first, each within the K-th distance met so far */
+template<class T> template<class V> double Pool<T>::nearest ( T *key, int K, double radius, V& visitor ) const {
+	if ( radius < 0 || K <= 0 )
+		return radius;
+
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
+	if ( g->trees.size() == 1 )
+		return g->trees[0]->nearest (key, K, radius, visitor);
+
+	std::vector<std::pair<double,unsigned> > order;
+	for (unsigned i=0; i<g->trees.size(); ++i)
+		order.push_back ( std::make_pair (g->sq_dist (key, i), i) );
+	std::sort ( order.begin(), order.end() );
+
+	neighbor_merger<T> merger (dims, K);
+	for (unsigned i=0; i<order.size(); ++i) {
+		double bound = merger.bound (radius);
+		if ( order[i].first > bound * bound )
+			break;
+		g->trees[order[i].second]->nearest (key, K, bound, merger);
+	}
+	return merger.emit (radius, visitor);
+}
+
+/* shards contribute to the sample in proportion to their sizes */
+template<class T> void Pool<T>::sample ( int dim, bool exact, std::vector<T>& coords ) const {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
+
+	unsigned size = 0;
+	for (unsigned i=0; i<g->trees.size(); ++i)
+		size += g->trees[i]->get_size();
+
+	for (unsigned i=0; i<g->trees.size(); ++i) {
+		unsigned share = g->trees[i]->get_size();
+		if ( share == 0 )
+			continue;
+		if ( ! exact )
+			share = std::max (1u, (unsigned) ((unsigned long long) MEDIAN_SAMPLE * share / size));
+		g->trees[i]->sample ( dim, exact ? 0 : share, coords );
+	}
+}
+
+template<class T> T Pool<T>::get_quantile ( int dim, double q, bool exact ) const {
+	std::vector<T> coords;
+	sample ( dim, exact, coords );
+	if ( coords.empty() )
+		return (get_hi()[dim]-get_lo()[dim])/2 + get_lo()[dim];
+
+	return nth_quantile ( coords, q );
+}
+
+template<class T> unsigned Pool<T>::get_size () const {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
+
+	unsigned size = 0;
+	for (unsigned i=0; i<g->trees.size(); ++i)
+		size += g->trees[i]->get_size();
+	return size;
+}
 
-	assert ( pool_pair[0].size() == pool_pair[1].size() );
+template<class T> unsigned Pool<T>::get_tombstones () const {
+	EpochGuard guard (epochs);
+	ShardGrid<T>* g = current ();
 
-	return pool_pair;
+	unsigned tombstones = 0;
+	for (unsigned i=0; i<g->trees.size(); ++i)
+		tombstones += g->trees[i]->get_tombstones();
+	return tombstones;
 }
@@ -21,60 +21,157 @@
 #define POOL_H_
 
 #include "Dtree.h"
+#include "Epoch.h"
 
+/*
+ * The trees of a pool laid on a grid over its region, one for each cell.
+ * A grid is never altered but replaced as a whole when the pool is rebuilt.
+ */
+template<class T> struct ShardGrid {
+	std::vector<Dtree<T,MIDAS_DIMS>*> trees;
+
+	/* region of the grid and cells along each dimension */
+	std::vector<T> lo;
+	std::vector<T> hi;
+	std::vector<unsigned> cells;
+
+	ShardGrid ( int dims, unsigned bucket, unsigned shards, const T* lo_key, const T* hi_key );
+	~ShardGrid ();
+
+	/* returns the cell of key, clamped into the grid */
+	unsigned locate ( const T* key ) const;
+
+	/* appends the cells overlapping [lo_key,hi_key] */
+	void overlap ( const T* lo_key, const T* hi_key, std::vector<unsigned>& ans ) const;
+
+	/* returns the squared distance of key from cell */
+	double sq_dist ( const T* key, unsigned cell ) const;
+
+private:
+	unsigned coordinate ( const T* key, int dim ) const;
+};
+
+/*
+ * Readers run without locks on whatever grid they find. Writers lock the
+ * shard of their key, so writes to distinct shards run in parallel, while
+ * rebuilds of the whole pool lock every shard. What a writer unlinks
+ * (values, tree-nodes, or a whole grid replaced by a rebuilt one) is
+ * retired with an epoch tag and reclaimed once no reader can still be
+ * inside.
+ */
 template<class T> class Pool {
-	Dtree<T> dtree;
+	ShardGrid<T>* grid;
 
 	int dims;
+	unsigned bucket;
 
 	T* lo;
 	T* hi;
 
+	/* writer state of each shard, the same for every grid */
+	struct Shard {
+		pthread_mutex_t lock;
+		std::vector<std::pair<unsigned long long,Value*> > retired_values;
+		std::vector<std::pair<unsigned long long,unsigned> > retired_nodes;
+		unsigned retirements;
+	};
+	unsigned shard_count;
+	Shard* shards;
+
+	mutable Epochs epochs;
+
+	pthread_mutex_t grid_lock;
+	std::vector<std::pair<unsigned long long,ShardGrid<T>*> > retired_grids;
+
+	Pool (const Pool&);
+	Pool& operator = (const Pool&);
+
 public:
-	Pool (int dms) : dtree(dms), dims(dms) {lo=0; hi=0;}
+	Pool ( int dms, unsigned bkt=1, unsigned shards=1 ) : dims(dms), bucket(bkt) {
+		lo=0; hi=0;
+		init (shards);
+	}
 
-	Pool ( int dms, T const* lo_key, T const* hi_key ) : dtree(dms), dims(dms) {
+	Pool ( int dms, T const* lo_key, T const* hi_key, unsigned bkt=1, unsigned shards=1 ) : dims(dms), bucket(bkt) {
 		lo = (T*) calloc (dims, dims*sizeof(T));
 		hi = (T*) calloc (dims, dims*sizeof(T));
 		memcpy(lo, lo_key, dims*sizeof(T));
 		memcpy(hi, hi_key, dims*sizeof(T));
+		init (shards);
 	}
 
-	~Pool () {free(lo);free(hi);}
+	~Pool ();
 
+	/* the bounds are loaded with acquire, as set_bound may move one under a routing reader */
 	bool isRelevant ( T *key ) const {
 		for (int j=0; j<dims; ++j)
-			if ( key[j] < lo[j] || key[j] >= hi[j])
+			if ( key[j] < load (lo[j]) || key[j] >= load (hi[j]))
 				return false;
 		return true;
 	}
 
 	bool encloses ( T *lo_key, T *hi_key ) const {
 		for (int j=0; j<dims; ++j)
-			if (lo_key[j] < lo[j] || hi_key[j] > hi[j] )
+			if (lo_key[j] < load (lo[j]) || hi_key[j] > load (hi[j]) )
 				return false;
 		return true;
 	}
 
+	/*** writers ***/
+
 	/* indexes a (key, value) pair */
-	void push ( T *key , char* val );
+	void push ( T *key , Value* val );
 
-	/* removes and returns from index a (key, value) pair or NULL if non-existent */
-	char* pop ( T *key );
+	/* tombstones key in O(1) past its search, returns whether it was indexed */
+	bool erase ( T *key );
+
+	/* rebuilds the subtrees where tombstones exceed ratio of the tuples */
+	void compact ( double ratio );
+
+	/* indexes all passed pairs at once along with the already indexed ones */
+	void bulk_load ( TupleArray<T>& data );
 
 	/* updates the value of an already indexed key */
-	void update ( T *key , char* val );
+	void update ( T *key , Value* val );
+
+	/*
+	 * updates or indexes all passed pairs, the last one winning for a key
+	 * met twice; each shard is locked once for its pairs, and a batch as
+	 * large as the pool is bulk loaded along with it instead
+	 */
+	void push_batch ( TupleArray<T>& data );
+
+	/* appends str[0..len) to the value of key, indexing it if non-existent */
+	void append ( T *key , const char* str, size_t len );
 
-	/* concatenates the value of an already indexed key with the passed */
-	void concatenate ( T *key , char* val );
+	/* moves the tuples on or above median on dim into the empty hi_pool, whose region this pool leaves */
+	void split ( int dim, T median, Pool& hi_pool );
 
-	std::pair<T*,char*>& lookup ( T *key ) const;
+	/* moves the tuples below median on dim into the empty lo_pool, whose region this pool leaves */
+	void split_lo ( int dim, T median, Pool& lo_pool );
 
-	void range ( T *lo, T *hi, std::vector<std::pair<T*,char*>*>& ans ) const;
+	/* takes over all tuples of other */
+	void absorb ( Pool& other );
 
-	double nearest ( T *key, int K, double radius, std::vector<std::pair<double,std::pair<T*,char*>*>*> &ans ) const;
+	/*** readers ***/
 
-	std::vector<std::pair<T*,char*>*>* split ( int dim ) const;
+	/*
+	 * calls visitor (key, value) for key and returns whether it is indexed;
+	 * a fragmented value is coalesced on the way unless a writer is busy
+	 */
+	template<class V> bool lookup ( T *key, V& visitor );
+
+	/* calls visitor (key, value) for every pair within [lo,hi], or sums them up into an Aggregate */
+	template<class V> void range ( T *lo, T *hi, V& visitor ) const;
+
+	/* calls visitor (key, value) for every indexed pair */
+	template<class V> void scan ( V& visitor ) const;
+
+	/*
+	 * calls visitor (distance, key, value) for the K nearest pairs within
+	 * radius, farthest first, and returns the distance of the farthest
+	 */
+	template<class V> double nearest ( T *key, int K, double radius, V& visitor ) const;
 
 	void set_lo (T* lo_key) {
 		if (lo==0) lo=(T*)calloc(dims,dims*sizeof(T));
@@ -86,12 +183,58 @@ public:
 		memcpy(hi,hi_key,dims*sizeof(T));
 	}
 
+	/* moves the lower or the upper bound on dim to x, publishing it with release to concurrent readers */
+	void set_bound (int dim, T x, bool high) {
+		__atomic_store (high ? &hi[dim] : &lo[dim], &x, __ATOMIC_RELEASE);
+	}
+
 	T* get_lo () const {return lo;}
 	T* get_hi () const {return hi;}
 
-	T get_median ( int dim ) const;
+	/* returns the exact median on dim or an estimate out of a sample */
+	T get_median ( int dim, bool exact=true ) const {return get_quantile (dim, .5, exact);}
+
+	/* returns the coordinate on dim below which lies share q of the tuples, exact or estimated */
+	T get_quantile ( int dim, double q, bool exact=true ) const;
+
+	/* appends the coordinates on dim of every tuple, or of a sample of them */
+	void sample ( int dim, bool exact, std::vector<T>& coords ) const;
+
+	unsigned get_size () const;
+	unsigned get_tombstones () const;
+
+	unsigned get_shards () const {return shard_count;}
+
+private:
+	void init ( unsigned shards );
+
+	ShardGrid<T>* current () const {return __atomic_load_n (&grid, __ATOMIC_ACQUIRE);}
+
+	/* reads a bound that set_bound may move meanwhile */
+	static T load ( const T& x ) {T v; __atomic_load (&x, &v, __ATOMIC_ACQUIRE); return v;}
+
+	/* locks the shard of key in the current grid, returned along with the shard */
+	unsigned lock_shard ( const T* key, ShardGrid<T>*& g );
+
+	/* locks every shard, in order */
+	void lock_all ();
+	void unlock_all ();
+
+	/* scans every tree of the current grid into data */
+	void gather ( TupleArray<T>& data );
+
+	/* publishes a grid of data over the region in place of the current one and retires it */
+	void swap ( TupleArray<T>& data );
+
+	/* replaces the value of key in a locked shard of g or indexes it */
+	void upsert ( ShardGrid<T>* g, unsigned shard, T *key, Value* val );
+
+	/* tags val with the epoch it was unlinked in */
+	void retire ( unsigned shard, Value* val );
 
-	unsigned get_size () const {return dtree.get_size();}
+	/* frees what no reader can reach any longer in a shard, or everything */
+	void reclaim ( unsigned shard, bool all=false );
+	void reclaim_grids ( bool all=false );
 };
 
 #endif
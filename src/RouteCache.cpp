@@ -0,0 +1,188 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#include "RouteCache.h"
+
+template<class T> RouteCache<T>::RouteCache ( int dms, unsigned cap ) : dims(dms), capacity(cap), clock(0) {
+	pthread_mutex_init (&lock, 0);
+}
+
+template<class T> RouteCache<T>::~RouteCache () {
+	clear ();
+	pthread_mutex_destroy (&lock);
+}
+
+template<class T> typename RouteCache<T>::Route* RouteCache<T>::acquire ( const T* key, const std::string& prefix ) {
+	Route* found = 0;
+	std::vector<Route*> done;
+
+	pthread_mutex_lock (&lock);
+	for (unsigned i = 0; i < routes.size(); ) {
+		Route* route = routes[i];
+
+		/* the reader of a link notices first that its peer is gone */
+		if (route->link != 0 && !route->link->is_valid()) {
+			drop (i, done);
+			continue;
+		}
+
+		bool within = route->id.compare (0, prefix.size(), prefix) == 0;
+		for (int j = 0; within && j < dims; ++j)
+			within = route->lo[j] <= key[j] && key[j] < route->hi[j];
+
+		if (within) {
+			/* the others go the long way while the route is being connected */
+			if (route->link == 0 && route->connecting)
+				break;
+			if (route->link == 0)
+				route->connecting = true;
+			found = route;
+			++found->refs;
+			found->used = ++clock;
+			break;
+		}
+		++i;
+	}
+	pthread_mutex_unlock (&lock);
+	retire (done);
+	return found;
+}
+
+template<class T> void RouteCache<T>::release ( Route* route ) {
+	std::vector<Route*> done;
+	pthread_mutex_lock (&lock);
+	unref (route, done);
+	pthread_mutex_unlock (&lock);
+	retire (done);
+}
+
+template<class T> void RouteCache<T>::connect ( Route* route, Link* link ) {
+	std::vector<Route*> done;
+	pthread_mutex_lock (&lock);
+	route->link = link;
+	route->connecting = false;
+	if (link == 0) {
+		for (unsigned i = 0; i < routes.size(); ++i) {
+			if (routes[i] == route) {
+				drop (i, done);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock (&lock);
+	retire (done);
+}
+
+template<class T> void RouteCache<T>::learn ( const std::string& host, int port, const std::string& id, const T* lo, const T* hi ) {
+	if (capacity == 0)
+		return;
+
+	std::vector<Route*> done;
+	pthread_mutex_lock (&lock);
+	Route* known = 0;
+	for (unsigned i = 0; i < routes.size(); ) {
+		Route* route = routes[i];
+		bool live = route->link == 0 || route->link->is_valid();
+		if (route->host == host && route->port == port && live) {
+			known = route;
+			++i;
+		}else if (overlaps (route, lo, hi) || (route->host == host && route->port == port)) {
+			drop (i, done);
+		}else{
+			++i;
+		}
+	}
+
+	if (known != 0) {
+		known->id = id;
+		known->lo.assign (lo, lo+dims);
+		known->hi.assign (hi, hi+dims);
+		known->used = ++clock;
+	}else{
+		if (routes.size() >= capacity) {
+			unsigned oldest = 0;
+			for (unsigned i = 1; i < routes.size(); ++i)
+				if (routes[i]->used < routes[oldest]->used)
+					oldest = i;
+			drop (oldest, done);
+		}
+
+		Route* route = new Route;
+		route->host = host;
+		route->port = port;
+		route->id = id;
+		route->lo.assign (lo, lo+dims);
+		route->hi.assign (hi, hi+dims);
+		route->link = 0;
+		route->connecting = false;
+		route->refs = 1;
+		route->used = ++clock;
+		routes.push_back (route);
+	}
+	pthread_mutex_unlock (&lock);
+	retire (done);
+}
+
+template<class T> void RouteCache<T>::forget ( const std::string& host, int port ) {
+	std::vector<Route*> done;
+	pthread_mutex_lock (&lock);
+	for (unsigned i = 0; i < routes.size(); ) {
+		if (routes[i]->host == host && routes[i]->port == port)
+			drop (i, done);
+		else
+			++i;
+	}
+	pthread_mutex_unlock (&lock);
+	retire (done);
+}
+
+template<class T> void RouteCache<T>::clear () {
+	std::vector<Route*> done;
+	pthread_mutex_lock (&lock);
+	while (!routes.empty())
+		drop (routes.size()-1, done);
+	pthread_mutex_unlock (&lock);
+	retire (done);
+}
+
+template<class T> bool RouteCache<T>::overlaps ( const Route* route, const T* lo, const T* hi ) const {
+	for (int j = 0; j < dims; ++j)
+		if (hi[j] <= route->lo[j] || route->hi[j] <= lo[j])
+			return false;
+	return true;
+}
+
+template<class T> void RouteCache<T>::drop ( unsigned i, std::vector<Route*>& done ) {
+	Route* route = routes[i];
+	routes[i] = routes.back();
+	routes.pop_back();
+	unref (route, done);
+}
+
+template<class T> void RouteCache<T>::unref ( Route* route, std::vector<Route*>& done ) {
+	if (--route->refs == 0)
+		done.push_back (route);
+}
+
+template<class T> void RouteCache<T>::retire ( std::vector<Route*>& done ) {
+	for (unsigned i = 0; i < done.size(); ++i) {
+		delete done[i]->link;
+		delete done[i];
+	}
+}
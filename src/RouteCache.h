@@ -0,0 +1,108 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#ifndef ROUTECACHE_H_
+#define ROUTECACHE_H_
+
+#include "Link.h"
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/*
+ * Shortcuts to the owners of remote regions, learned from the replies of
+ * the requests a node forwards. A route names its owner by address and by
+ * its path in the split tree, and holds a link to it. The link is left to
+ * the first request to take the route, rather than to the reply that named
+ * the owner. The cache keeps the most recently used routes; a route is
+ * dropped once a region learned later overlaps it, since both can no
+ * longer be right, or once its link fails.
+ */
+template<class T> class RouteCache {
+public:
+	struct Route {
+		std::string host;
+		int port;
+		std::string id;
+
+		std::vector<T> lo;
+		std::vector<T> hi;
+
+		/* none until the request that took the route first has connected it */
+		Link* link;
+		bool connecting;
+
+		/* one for the cache while it holds the route, and one per request in flight over it */
+		unsigned refs;
+		unsigned long long used;
+	};
+
+private:
+	int dims;
+	unsigned capacity;
+
+	std::vector<Route*> routes;
+	unsigned long long clock;
+
+	pthread_mutex_t lock;
+
+	RouteCache (const RouteCache&);
+	RouteCache& operator = (const RouteCache&);
+
+public:
+	RouteCache ( int dms, unsigned cap );
+	~RouteCache ();
+
+	unsigned get_capacity () const {return capacity;}
+
+	/*
+	 * returns the route to a region holding key whose owner lies below
+	 * prefix, held until released, or 0; a route without a link is
+	 * returned to one request alone, which is to connect it
+	 */
+	Route* acquire ( const T* key, const std::string& prefix );
+	void release ( Route* route );
+
+	/* hands the link of a route acquired without one over to it, or drops the route if there is none */
+	void connect ( Route* route, Link* link );
+
+	/* caches the region of the owner at host:port in place of the routes it overlaps */
+	void learn ( const std::string& host, int port, const std::string& id, const T* lo, const T* hi );
+
+	/* drops the route to host:port */
+	void forget ( const std::string& host, int port );
+
+	/* drops every route */
+	void clear ();
+
+private:
+	bool overlaps ( const Route* route, const T* lo, const T* hi ) const;
+
+	/*
+	 * removes the route at i, the lock held; it goes into done once the
+	 * last request over it is done, to be retired after the lock is let go
+	 */
+	void drop ( unsigned i, std::vector<Route*>& done );
+	void unref ( Route* route, std::vector<Route*>& done );
+
+	/* deletes the routes done with, whose links wait for their readers to end */
+	static void retire ( std::vector<Route*>& done );
+};
+
+#endif
@@ -31,7 +31,7 @@ const ServerSocket& ServerSocket::operator << ( const std::string& s ) const {
 	//if ( ! Socket::send ( htonl( s.size() ) ) )
 	//	throw std::runtime_error ( "Could not write to socket." );
 
-	if ( ! Socket::send ( s ) )
+	if ( ! ( Socket::is_framed() ? Socket::send_frame ( s ) : Socket::send ( s ) ) )
 		throw std::runtime_error ( "Could not write to socket." );
 
 	return *this;
@@ -46,7 +46,7 @@ const ServerSocket& ServerSocket::operator >> ( std::string& s ) const {
 
 	printf ( "MESSAGE SIZE: %ld\n", size );
 	*/
-	if ( ! Socket::recv ( s ) )
+	if ( ! ( Socket::is_framed() ? Socket::recv_frame ( s ) : Socket::recv ( s ) ) )
 		throw std::runtime_error ( "Could not read from socket." );
 
 	//printf ( "MESSAGE: %s\n", s.c_str() );
@@ -55,5 +55,6 @@ const ServerSocket& ServerSocket::operator >> ( std::string& s ) const {
 }
 
 void ServerSocket::accept(ServerSocket &sock){
-	Socket::accept ( sock );
+	if ( ! Socket::accept ( sock ) )
+		throw std::runtime_error ( "Could not accept socket." );
 }
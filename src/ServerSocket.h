@@ -39,6 +39,12 @@ public:
 	void close () {return Socket::close();}
 
 	void accept ( ServerSocket& );
+
+	int drain ( std::string& s ) const {return Socket::drain(s);}
+	void set_non_blocking ( const bool b ) {Socket::set_non_blocking(b);}
+	int descriptor () const {return Socket::descriptor();}
+	void set_framed ( const bool b ) {Socket::set_framed(b);}
+	void set_timeout ( const int t ) {Socket::set_timeout(t);}
 };
 
 #endif
@@ -22,19 +22,22 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <iostream>
 
 extern bool ipv6;
 
 
-Socket::Socket () : m_sock (-1) {
+Socket::Socket () : m_sock (-1), m_framed (false), m_timeout (-1) {
 	memset ( &m_addr, 0, sizeof (m_addr) );
 	set_non_blocking (false);
 }
 
 Socket::Socket (const Socket& sock){
 	m_sock = sock.m_sock;
+	m_framed = sock.m_framed;
+	m_timeout = sock.m_timeout;
 	m_addr = sock.m_addr;
 	set_non_blocking (false);
 }
@@ -117,7 +120,7 @@ bool Socket::bind (int p,  const char* h = 0) {
 		return true;
 }
 
-bool Socket::connect (const char* h, const int p) {
+bool Socket::address (const char* h, const int p) {
 	if (!is_valid())
 		return false;
 
@@ -138,6 +141,12 @@ bool Socket::connect (const char* h, const int p) {
 			return false;
 		}
 	}
+	return true;
+}
+
+bool Socket::connect (const char* h, const int p) {
+	if (!address (h, p))
+		return false;
 
 	if (errno == EAFNOSUPPORT)
 		return false;
@@ -149,6 +158,36 @@ bool Socket::connect (const char* h, const int p) {
 		return true;
 }
 
+bool Socket::connect (const char* h, const int p, int timeout_ms) {
+	if (!address (h, p))
+		return false;
+
+	set_non_blocking (true);
+	bool connected = ::connect ( m_sock, (sockaddr*) &m_addr, sizeof (m_addr) ) == 0;
+
+	if (!connected && errno == EINPROGRESS) {
+		pollfd pfd;
+		pfd.fd = m_sock;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		int error = 0;
+		socklen_t length = sizeof (error);
+		connected = ::poll (&pfd, 1, timeout_ms) == 1
+			&& getsockopt (m_sock, SOL_SOCKET, SO_ERROR, &error, &length) == 0
+			&& error == 0;
+	}
+
+	set_non_blocking (false);
+	return connected;
+}
+
+bool Socket::is_alive () const {
+	char c;
+	int status = ::recv (m_sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return status > 0 || (status == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
 bool Socket::listen () const {
 	if (!is_valid())
 		return false;
@@ -176,19 +215,95 @@ bool Socket::accept (Socket& new_socket) const {
 		return true;
 }
 
-bool Socket::send (const std::string s) const {
-	int status = ::send (m_sock, s.c_str(), s.size(), 0);
-	if (status == -1)
+/* waits until a non-blocking socket turns readable or writable */
+static bool await ( int sock, short events, int timeout_ms=-1 ) {
+	pollfd pfd;
+	pfd.fd = sock;
+	pfd.events = events;
+	pfd.revents = 0;
+	int status = ::poll (&pfd, 1, timeout_ms);
+	return status > 0 || (status < 0 && errno == EINTR);
+}
+
+bool Socket::send_bytes (const char* buf, size_t len, int flags) const {
+	size_t sent = 0;
+	while (sent < len) {
+		int status = ::send (m_sock, buf+sent, len-sent, flags | MSG_NOSIGNAL);
+		if (status >= 0) {
+			sent += status;
+		}else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (!await (m_sock, POLLOUT))
+				return false;
+		}else if (errno != EINTR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Socket::recv_bytes (char* buf, size_t len) const {
+	size_t received = 0;
+	while (received < len) {
+		/* a read with a timeout waits for the peer first, whether the socket blocks or not */
+		if (m_timeout >= 0 && !await (m_sock, POLLIN, m_timeout))
+			return false;
+		int status = ::recv (m_sock, buf+received, len-received, 0);
+		if (status > 0) {
+			received += status;
+		}else if (status == 0) {
+			return false;
+		}else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (!await (m_sock, POLLIN, m_timeout))
+				return false;
+		}else if (errno != EINTR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Socket::send (const std::string& s) const {
+	return send_bytes (s.data(), s.size(), 0);
+}
+
+bool Socket::send_frame (const std::string& s) const {
+	if (s.size() > MAXFRAME)
 		return false;
-	else
-		return true;
+
+	char header [FRAME_HEADER];
+	header[0] = FRAME_MAGIC;
+	header[1] = s.empty() ? 0 : s[0];
+	header[2] = header[3] = 0;
+	header[4] = s.size() >> 24;
+	header[5] = s.size() >> 16;
+	header[6] = s.size() >> 8;
+	header[7] = s.size();
+
+	/* a small frame leaves in one segment, a large one is not copied */
+	if (s.size() <= (size_t) MAXRECV) {
+		std::string frame (header, FRAME_HEADER);
+		frame += s;
+		return send_bytes (frame.data(), frame.size(), 0);
+	}
+	return send_bytes (header, FRAME_HEADER, MSG_MORE) && send_bytes (s.data(), s.size(), 0);
 }
 
 int Socket::recv (std::string& s) const {
 	char buf [ MAXRECV + 1 ];
 	memset ( buf, '\0', MAXRECV + 1 );
 
-	int status = ::recv (m_sock, buf, MAXRECV , 0);
+	if (m_timeout >= 0 && !await (m_sock, POLLIN, m_timeout))
+		return 0;
+
+	int status;
+	while ((status = ::recv (m_sock, buf, MAXRECV , 0)) == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (!await (m_sock, POLLIN, m_timeout))
+				break;
+		}else if (errno != EINTR) {
+			break;
+		}
+	}
 
   	if (status == -1){
 		std::cout << "status == -1   errno == " << errno << "  in Socket::recv\n";
@@ -196,12 +311,48 @@ int Socket::recv (std::string& s) const {
 	}else if (status == 0){
 		return 0;
 	}else{
-		s.clear();
-		s = buf;
+		s.assign (buf, status);
     		return status;
   	}
 }
 
+int Socket::recv_frame (std::string& s) const {
+	char header [FRAME_HEADER];
+	if (!recv_bytes (header, FRAME_HEADER) || (unsigned char) header[0] != FRAME_MAGIC)
+		return 0;
+
+	size_t length = frame_length (header);
+	if (length > MAXFRAME)
+		return 0;
+
+	s.resize (length);
+	if (length > 0 && !recv_bytes (&s[0], length))
+		return 0;
+	return FRAME_HEADER + length;
+}
+
+int Socket::drain (std::string& s) const {
+	char buf [ 65536 ];
+	int total = 0;
+
+	while (true) {
+		int status = ::recv (m_sock, buf, sizeof (buf), 0);
+		if (status > 0) {
+			s.append (buf, status);
+			total += status;
+			/* a short read emptied the socket, whatever follows raises another event */
+			if (status < (int) sizeof (buf))
+				return total;
+		}else if (status == 0) {
+			return -1;
+		}else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return total;
+		}else if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
 bool Socket::open () {
 	if ( ! is_valid() )
 		return false;
@@ -218,6 +369,11 @@ void Socket::close () {
 		::close ( m_sock );
 }
 
+void Socket::shutdown () {
+	if ( is_valid() )
+		::shutdown ( m_sock, SHUT_RDWR );
+}
+
 void Socket::set_non_blocking (const bool b) {
 	int opts = fcntl ( m_sock, F_GETFL );
 
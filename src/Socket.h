@@ -30,16 +30,37 @@
 
 
 const int MAXHOSTNAME = 128;
-const int MAXCONNECTIONS = 8;
+const int MAXCONNECTIONS = SOMAXCONN;
 const int MAXRECV = 1023;
 
 const int RCVBUF = 1024;
 const int SNDBUF = 1024;
 
+/*
+ * A framed message is a header of a magic byte, the message type, two
+ * reserved bytes and the payload length in network order, followed by
+ * the payload. No text message starts with the magic byte.
+ */
+const unsigned char FRAME_MAGIC = 0xFF;
+const size_t FRAME_HEADER = 8;
+const size_t MAXFRAME = 1u << 30;
+
+/* returns the payload length of a frame header */
+inline size_t frame_length ( const char* header ) {
+	const unsigned char* h = (const unsigned char*) header;
+	return ((size_t) h[4] << 24) | ((size_t) h[5] << 16) | ((size_t) h[6] << 8) | (size_t) h[7];
+}
+
 
 class Socket {
 	int m_sock;
 
+	/* whether messages are exchanged in frames rather than as text */
+	bool m_framed;
+
+	/* milliseconds a read waits for the peer, or -1 for as long as it takes */
+	int m_timeout;
+
 	union m_addr_t {
 		sockaddr_in6 m_addr6;
 		sockaddr_in m_addr;
@@ -59,16 +80,47 @@ public:
 	// Client initialization
 	bool connect ( const char*, const int );
 
+	/* connects without blocking for longer than timeout_ms */
+	bool connect ( const char*, const int, int timeout_ms );
+
 	bool open ();
 	void close ();
 
+	/* ends both directions, waking up whoever blocks on the socket */
+	void shutdown ();
+
 	// Data Transmission
-	bool send ( const std::string ) const;
+	bool send ( const std::string& ) const;
 	int recv ( std::string& ) const;
 
+	/* sends s as the payload of a frame typed after its first byte */
+	bool send_frame ( const std::string& ) const;
+
+	/* receives exactly the payload of the next frame */
+	int recv_frame ( std::string& ) const;
+
+	/* appends what is readable without blocking, returns -1 once the peer has closed */
+	int drain ( std::string& ) const;
+
 	void set_non_blocking ( const bool );
 
+	int descriptor () const { return m_sock; }
+
+	void set_framed ( const bool b ) { m_framed = b; }
+
+	/* gives up reading once the peer has been silent for timeout_ms, or never if -1 */
+	void set_timeout ( const int timeout_ms ) { m_timeout = timeout_ms; }
+	bool is_framed () const { return m_framed; }
+
 	bool is_valid() const { return m_sock != -1; }
+
+	/* whether the peer has neither closed nor reset an idle connection */
+	bool is_alive () const;
+
+private:
+	bool address ( const char*, const int );
+	bool send_bytes ( const char*, size_t, int ) const;
+	bool recv_bytes ( char*, size_t ) const;
 };
 
 #endif
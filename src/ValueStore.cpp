@@ -0,0 +1,189 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#include "ValueStore.h"
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <stdexcept>
+
+/* blocks of class k hold (MIN_BLOCK<<k) bytes */
+#define MIN_BLOCK 32
+#define SIZE_CLASSES 12
+
+/* blocks are carved out of slabs of this many bytes */
+#define SLAB_SIZE (MIN_BLOCK<<(SIZE_CLASSES-1))
+
+struct SizeClass {
+	pthread_mutex_t lock;
+	void* free_list;
+};
+
+static SizeClass classes [SIZE_CLASSES];
+
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static void init_classes () {
+	for (int k=0; k<SIZE_CLASSES; ++k) {
+		pthread_mutex_init (&classes[k].lock, 0);
+		classes[k].free_list = 0;
+	}
+}
+
+/* returns the smallest class of blocks of size bytes or SIZE_CLASSES */
+static inline int size_class ( size_t size ) {
+	int k = 0;
+	while ( k < SIZE_CLASSES && ((size_t) MIN_BLOCK<<k) < size )
+		++k;
+	return k;
+}
+
+void* ValueStore::alloc ( size_t size ) {
+	int k = size_class (size);
+	if ( k == SIZE_CLASSES ) {
+		void* block = malloc (size);
+		if ( block == 0 )
+			throw std::runtime_error ("** CRITICAL ERROR - Unable to allocate value.");
+		return block;
+	}
+
+	pthread_once (&classes_once, init_classes);
+	SizeClass& cls = classes[k];
+
+	pthread_mutex_lock (&cls.lock);
+	if ( cls.free_list == 0 ) {
+		/* slabs are never returned, their blocks are recycled through the free list */
+		char* slab = (char*) malloc (SLAB_SIZE);
+		if ( slab == 0 ) {
+			pthread_mutex_unlock (&cls.lock);
+			throw std::runtime_error ("** CRITICAL ERROR - Unable to allocate value slab.");
+		}
+		for (size_t off = 0; off < SLAB_SIZE; off += (size_t) MIN_BLOCK<<k) {
+			*(void**) (slab + off) = cls.free_list;
+			cls.free_list = slab + off;
+		}
+	}
+	void* block = cls.free_list;
+	cls.free_list = *(void**) block;
+	pthread_mutex_unlock (&cls.lock);
+	return block;
+}
+
+void ValueStore::dealloc ( void* block, size_t size ) {
+	int k = size_class (size);
+	if ( k == SIZE_CLASSES ) {
+		free (block);
+		return;
+	}
+
+	SizeClass& cls = classes[k];
+	pthread_mutex_lock (&cls.lock);
+	*(void**) block = cls.free_list;
+	cls.free_list = block;
+	pthread_mutex_unlock (&cls.lock);
+}
+
+/* a segment takes its whole block, one byte is kept for the terminator */
+Segment* ValueStore::alloc_segment ( size_t capacity ) {
+	size_t size = sizeof(Segment) + capacity + 1;
+	int k = size_class (size);
+	if ( k < SIZE_CLASSES )
+		size = (size_t) MIN_BLOCK<<k;
+
+	Segment* seg = (Segment*) alloc (size);
+	seg->next = 0;
+	seg->length = 0;
+	seg->capacity = size - sizeof(Segment) - 1;
+	seg->data()[0] = '\0';
+	return seg;
+}
+
+void ValueStore::release_segment ( Segment* seg ) {
+	dealloc (seg, sizeof(Segment) + seg->capacity + 1);
+}
+
+Value* ValueStore::create ( const char* str, size_t len ) {
+	Value* val = (Value*) alloc (sizeof(Value));
+	val->head = val->tail = alloc_segment (len);
+	val->length = len;
+
+	memcpy (val->head->data(), str, len);
+	val->head->data()[len] = '\0';
+	val->head->length = len;
+	return val;
+}
+
+void ValueStore::append ( Value* val, const char* str, size_t len ) {
+	Segment* tail = val->tail;
+
+	size_t room = tail->capacity - tail->length;
+	if ( room > len )
+		room = len;
+	memcpy (tail->data() + tail->length, str, room);
+	tail->data()[tail->length + room] = '\0';
+	__atomic_store_n (&tail->length, tail->length + (unsigned) room, __ATOMIC_RELEASE);
+
+	/* segments grow geometrically with the value */
+	if ( room < len ) {
+		Segment* seg = alloc_segment (val->length + len);
+		memcpy (seg->data(), str + room, len - room);
+		seg->length = len - room;
+		seg->data()[seg->length] = '\0';
+
+		__atomic_store_n (&tail->next, seg, __ATOMIC_RELEASE);
+		__atomic_store_n (&val->tail, seg, __ATOMIC_RELEASE);
+	}
+	val->length += len;
+}
+
+bool ValueStore::fragmented ( const Value* val ) {
+	return val->head != __atomic_load_n (&val->tail, __ATOMIC_ACQUIRE);
+}
+
+Value* ValueStore::coalesce ( const Value* val ) {
+	Value* whole = (Value*) alloc (sizeof(Value));
+	whole->head = whole->tail = alloc_segment (val->length);
+	whole->length = val->length;
+
+	Segment* dest = whole->head;
+	for (const Segment* seg = val->head; seg != 0; seg = seg->next) {
+		memcpy (dest->data() + dest->length, seg->data(), seg->length);
+		dest->length += seg->length;
+	}
+	dest->data()[dest->length] = '\0';
+	return whole;
+}
+
+void ValueStore::release ( Value* val ) {
+	if ( val == 0 )
+		return;
+
+	for (Segment* seg = val->head; seg != 0; ) {
+		Segment* next = seg->next;
+		release_segment (seg);
+		seg = next;
+	}
+	dealloc (val, sizeof(Value));
+}
+
+std::ostream& operator << ( std::ostream& out, const Value& val ) {
+	for (const Segment* seg = val.head; seg != 0; seg = __atomic_load_n (&seg->next, __ATOMIC_ACQUIRE))
+		out.write (seg->data(), __atomic_load_n (&seg->length, __ATOMIC_ACQUIRE));
+	return out;
+}
@@ -0,0 +1,86 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#ifndef VALUESTORE_H_
+#define VALUESTORE_H_
+
+#include <cstddef>
+#include <ostream>
+
+/* a run of bytes of a value, followed by its data */
+struct Segment {
+	Segment* next;
+	unsigned length;
+	unsigned capacity;
+
+	char* data () {return reinterpret_cast<char*> (this + 1);}
+	const char* data () const {return reinterpret_cast<const char*> (this + 1);}
+};
+
+/* a value as a chain of segments */
+struct Value {
+	Segment* head;
+	Segment* tail;
+	size_t length;
+};
+
+/* writes a value without coalescing its segments */
+std::ostream& operator << ( std::ostream& out, const Value& val );
+
+/*
+ * Values are strings whose records and segments are carved out of slabs
+ * of size-classed blocks, with larger blocks left to malloc. Appending
+ * fills the last segment of a value or links a new one at least as large
+ * as the value so far, so an append costs O(1) amortized per byte.
+ *
+ * Readers may walk a value while one writer appends to it: the bytes of a
+ * segment are written before its length grows and a segment is filled
+ * before it is linked. Coalescing makes a copy, as readers may still be
+ * walking the fragmented value.
+ */
+class ValueStore {
+
+	ValueStore ();
+
+public:
+	/* returns a new value holding a copy of str[0..len) */
+	static Value* create ( const char* str, size_t len );
+
+	/* appends a copy of str[0..len) to val */
+	static void append ( Value* val, const char* str, size_t len );
+
+	/* returns whether val spans more than a segment */
+	static bool fragmented ( const Value* val );
+
+	/* returns a new value holding a copy of val in a single segment */
+	static Value* coalesce ( const Value* val );
+
+	/* releases val and all of its segments */
+	static void release ( Value* val );
+
+private:
+	static Segment* alloc_segment ( size_t capacity );
+	static void release_segment ( Segment* seg );
+
+	/* returns a block of at least size bytes out of its size class */
+	static void* alloc ( size_t size );
+	static void dealloc ( void* block, size_t size );
+};
+
+#endif
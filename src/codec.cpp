@@ -0,0 +1,178 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+
+/*
+ * Micro-benchmark of the key codecs: keys are encoded and decoded through
+ * iostream operators as they used to be, as text through to_chars and
+ * from_chars, and as raw binary coordinates, and the rate of each is
+ * reported in keys per second.
+ */
+
+#include "Codec.h"
+#include <getopt.h>
+#include <sys/time.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+typedef double index_t;
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* formats keys with the precision of the stream, as before */
+static void legacy_encode ( std::ostream& out, const index_t* key, int dims ) {
+	for (int j = 0; j < dims; ++j) {
+		out << key[j];
+		if (j < dims - 1)
+			out << ',';
+	}
+}
+
+static void legacy_decode ( std::istream& in, index_t* key, int dims ) {
+	for (int j = 0; j < dims; ++j) {
+		in >> key[j];
+		if (j < dims - 1) {
+			char symbol;
+			in >> symbol;
+		}
+	}
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-d --dims\n";
+	std::cerr << "\t\t-n --keys\n";
+}
+
+int main ( int argc, char** argv ) {
+	int dims = 3;
+	unsigned keys = 1000000;
+
+	static struct option long_options[] = {
+		{"dims",1,NULL,'d'},
+		{"keys",1,NULL,'n'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "d:n:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': keys = std::atoi (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( dims < 1 || (int) keys < 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	std::vector<index_t> data (keys * dims);
+	srand (1);
+	for (unsigned i=0; i<data.size(); ++i)
+		data[i] = rand () / (double) RAND_MAX;
+
+	std::vector<index_t> back (keys * dims);
+	double checksum = 0;
+
+	std::cout << "%% codec\tencoded/s\tdecoded/s\tbytes/key\n";
+
+	/* iostream text */
+	{
+		std::stringstream out;
+		double start = now ();
+		for (unsigned i=0; i<keys; ++i) {
+			legacy_encode (out, &data[i*dims], dims);
+			out << ' ';
+		}
+		double encoding = now () - start;
+
+		std::string text = out.str ();
+		std::stringstream in (text);
+		start = now ();
+		for (unsigned i=0; i<keys; ++i)
+			legacy_decode (in, &back[i*dims], dims);
+		double decoding = now () - start;
+
+		checksum += back[keys*dims-1];
+		std::cout << "iostream\t" << (unsigned long long) (keys / encoding) << "\t"
+			<< (unsigned long long) (keys / decoding) << "\t" << text.size() / (double) keys << std::endl;
+	}
+
+	/* to_chars and from_chars text */
+	{
+		std::stringstream out;
+		double start = now ();
+		for (unsigned i=0; i<keys; ++i) {
+			::vec2stream<index_t> (out, &data[i*dims], dims, ',');
+			out << ' ';
+		}
+		double encoding = now () - start;
+
+		std::string text = out.str ();
+		std::stringstream in (text);
+		start = now ();
+		for (unsigned i=0; i<keys; ++i)
+			::stream2vec<index_t> (in, &back[i*dims], dims, ',');
+		double decoding = now () - start;
+
+		for (unsigned i=0; i<data.size(); ++i)
+			if (back[i] != data[i]) {
+				std::cerr << "** ERROR - Text round trip changed a key.\n";
+				return 1;
+			}
+		std::cout << "charconv\t" << (unsigned long long) (keys / encoding) << "\t"
+			<< (unsigned long long) (keys / decoding) << "\t" << text.size() / (double) keys << std::endl;
+	}
+
+	/* binary */
+	{
+		std::string out;
+		double start = now ();
+		for (unsigned i=0; i<keys; ++i)
+			::put_key<index_t> (out, &data[i*dims], dims);
+		double encoding = now () - start;
+
+		size_t pos = 0;
+		start = now ();
+		for (unsigned i=0; i<keys; ++i)
+			::get_key<index_t> (out, pos, &back[i*dims], dims);
+		double decoding = now () - start;
+
+		for (unsigned i=0; i<data.size(); ++i)
+			if (back[i] != data[i]) {
+				std::cerr << "** ERROR - Binary round trip changed a key.\n";
+				return 1;
+			}
+		std::cout << "binary\t" << (unsigned long long) (keys / encoding) << "\t"
+			<< (unsigned long long) (keys / decoding) << "\t" << out.size() / (double) keys << std::endl;
+	}
+
+	/* keeps the iostream decoding from being optimized away */
+	return checksum < 0;
+}
@@ -30,9 +30,23 @@ template<class T> static void* serve (void* n) {
 	return 0;
 }
 
-template<class T> void* handle (void* args) {
-	std::pair<T*, ServerSocket*>* tuple = static_cast<std::pair<T*, ServerSocket*>*> (args);
-	tuple->first->handle ( *tuple->second );
+template<class T> void* compact (void* n) {
+	static_cast <T*> (n) -> compact();
+	return 0;
+}
+
+template<class T> void* rebalance (void* n) {
+	static_cast <T*> (n) -> rebalance();
+	return 0;
+}
+
+template<class T> void* work (void* n) {
+	static_cast <T*> (n) -> work();
+	return 0;
+}
+
+template<class T> void* receive (void* n) {
+	static_cast <T*> (n) -> receive();
 	return 0;
 }
 
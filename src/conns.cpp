@@ -0,0 +1,195 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+
+/*
+ * Connection-scaling benchmark of a running node: ever more clients stay
+ * connected at once while a few threads keep an update in flight on each
+ * of them, and the rates of connecting and of acknowledged updates are
+ * reported for each count of connections.
+ */
+
+#include "ClientSocket.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+bool ipv6 = false;
+
+struct ConnsTask {
+	std::vector<ClientSocket*> socks;
+	int dims;
+	unsigned seed;
+	bool* running;
+	unsigned long long ops;
+	unsigned long long failures;
+};
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static unsigned next ( unsigned& seed ) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+/* sends an update on every connection of the task, then awaits each acknowledgement */
+void* client ( void* args ) {
+	ConnsTask* task = static_cast<ConnsTask*> (args);
+
+	while ( __atomic_load_n (task->running, __ATOMIC_RELAXED) ) {
+		for (unsigned i=0; i<task->socks.size(); ++i) {
+			std::stringstream msg;
+			msg << "U(";
+			for (int j=0; j<task->dims; ++j)
+				msg << (j ? "," : "") << (next (task->seed) % 1000000) / 1e6;
+			msg << ")conns\n";
+			*task->socks[i] << msg.str();
+		}
+		for (unsigned i=0; i<task->socks.size(); ++i) {
+			std::string response;
+			*task->socks[i] >> response;
+			if (response.compare ("U OK\n") == 0)
+				++task->ops;
+			else
+				++task->failures;
+		}
+	}
+	return 0;
+}
+
+/* keeps connections open at once for a while, returns the rates of connecting and of updates */
+static void run ( std::string& host, int port, int dims, unsigned connections, int threads,
+		double seconds, double& connect_rate, double& update_rate, unsigned long long& failures ) {
+
+	bool running = true;
+	std::vector<ConnsTask> tasks (threads);
+	std::vector<pthread_t> handles (threads);
+
+	double start = now ();
+	for (unsigned i=0; i<connections; ++i)
+		tasks[i % threads].socks.push_back (new ClientSocket (host, port));
+	connect_rate = connections / (now () - start);
+
+	for (int i=0; i<threads; ++i) {
+		tasks[i].dims = dims;
+		tasks[i].seed = 7919 * (i+1);
+		tasks[i].running = &running;
+		tasks[i].ops = 0;
+		tasks[i].failures = 0;
+		if ( pthread_create ( &handles[i], 0, client, &tasks[i] ) != 0 )
+			throw std::runtime_error ("** ERROR - Unable to create a client thread.");
+	}
+
+	start = now ();
+	usleep ( (useconds_t) (seconds * 1e6) );
+	__atomic_store_n (&running, false, __ATOMIC_RELAXED);
+	for (int i=0; i<threads; ++i)
+		pthread_join ( handles[i], 0 );
+	double elapsed = now () - start;
+
+	update_rate = 0;
+	failures = 0;
+	for (int i=0; i<threads; ++i) {
+		update_rate += tasks[i].ops / elapsed;
+		failures += tasks[i].failures;
+		for (unsigned j=0; j<tasks[i].socks.size(); ++j)
+			delete tasks[i].socks[j];
+	}
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-h --host\n";
+	std::cerr << "\t\t-p --port\n";
+	std::cerr << "\t\t-d --dims\n";
+	std::cerr << "\t\t-c --connections\n";
+	std::cerr << "\t\t-t --threads\n";
+	std::cerr << "\t\t-s --seconds\n";
+}
+
+int main ( int argc, char** argv ) {
+	std::string host = "127.0.0.1";
+	int port = 0;
+	int dims = 2;
+	unsigned max_connections = 1000;
+	int threads = 4;
+	double seconds = 2;
+
+	static struct option long_options[] = {
+		{"host",1,NULL,'h'},
+		{"port",1,NULL,'p'},
+		{"dims",1,NULL,'d'},
+		{"connections",1,NULL,'c'},
+		{"threads",1,NULL,'t'},
+		{"seconds",1,NULL,'s'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "h:p:d:c:t:s:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'h': host = optarg; break;
+		case 'p': port = std::atoi (optarg); break;
+		case 'd': dims = std::atoi (optarg); break;
+		case 'c': max_connections = std::atoi (optarg); break;
+		case 't': threads = std::atoi (optarg); break;
+		case 's': seconds = std::atof (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( port <= 0 || dims < 1 || (int) max_connections < 1 || threads < 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	/* every connection takes a descriptor */
+	rlimit limit;
+	if ( getrlimit (RLIMIT_NOFILE, &limit) == 0 ) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+	}
+
+	std::cout << "%% connections\tconnects/s\tupdates/s\tfailures\n";
+	for (unsigned connections=1; connections<=max_connections; connections*=10) {
+		double connect_rate, update_rate;
+		unsigned long long failures;
+		run ( host, port, dims, connections, connections < (unsigned) threads ? connections : threads,
+				seconds, connect_rate, update_rate, failures );
+		std::cout << connections << "\t" << (unsigned long long) connect_rate << "\t"
+			<< (unsigned long long) update_rate << "\t" << failures << std::endl;
+
+		if ( connections < max_connections && 10*connections > max_connections )
+			connections = max_connections / 10;
+	}
+	return 0;
+}
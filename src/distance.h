@@ -0,0 +1,248 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+#ifndef DISTANCE_H_
+#define DISTANCE_H_
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+/*
+ * Squared euclidean distance kernels. Coordinates are widened to double
+ * before subtracting, so integer keys neither overflow nor wrap. Callers
+ * compare squared distances and take the root only when a distance is
+ * reported. The vector kernels keep two sums, so that an unrolled loop of
+ * a fixed dimensionality does not wait on a single chain of additions.
+ */
+template<class T> inline double sq_dist ( const T* a, const T* b, int n ) {
+	double sum = 0.0;
+	for (int j=0; j<n; ++j) {
+		double diff = (double) a[j] - (double) b[j];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+#ifdef __SSE2__
+inline double hsum ( __m128d acc ) {
+	return _mm_cvtsd_f64 ( _mm_add_sd ( acc, _mm_unpackhi_pd (acc, acc) ) );
+}
+#endif
+#ifdef __AVX__
+inline double hsum ( __m256d acc ) {
+	return hsum ( _mm_add_pd ( _mm256_castpd256_pd128 (acc), _mm256_extractf128_pd (acc, 1) ) );
+}
+#endif
+
+template<> inline double sq_dist<double> ( const double* a, const double* b, int n ) {
+	int j = 0;
+	double sum = 0.0;
+#if defined(__AVX__)
+	__m256d acc = _mm256_setzero_pd ();
+	__m256d odd = _mm256_setzero_pd ();
+	for (; j+8<=n; j+=8) {
+		__m256d diff = _mm256_sub_pd ( _mm256_loadu_pd (a+j), _mm256_loadu_pd (b+j) );
+		__m256d next = _mm256_sub_pd ( _mm256_loadu_pd (a+j+4), _mm256_loadu_pd (b+j+4) );
+		acc = _mm256_add_pd ( acc, _mm256_mul_pd (diff, diff) );
+		odd = _mm256_add_pd ( odd, _mm256_mul_pd (next, next) );
+	}
+	if (j+4<=n) {
+		__m256d diff = _mm256_sub_pd ( _mm256_loadu_pd (a+j), _mm256_loadu_pd (b+j) );
+		acc = _mm256_add_pd ( acc, _mm256_mul_pd (diff, diff) );
+		j += 4;
+	}
+	sum = hsum ( _mm256_add_pd (acc, odd) );
+#elif defined(__SSE2__)
+	__m128d acc = _mm_setzero_pd ();
+	__m128d odd = _mm_setzero_pd ();
+	for (; j+4<=n; j+=4) {
+		__m128d diff = _mm_sub_pd ( _mm_loadu_pd (a+j), _mm_loadu_pd (b+j) );
+		__m128d next = _mm_sub_pd ( _mm_loadu_pd (a+j+2), _mm_loadu_pd (b+j+2) );
+		acc = _mm_add_pd ( acc, _mm_mul_pd (diff, diff) );
+		odd = _mm_add_pd ( odd, _mm_mul_pd (next, next) );
+	}
+	if (j+2<=n) {
+		__m128d diff = _mm_sub_pd ( _mm_loadu_pd (a+j), _mm_loadu_pd (b+j) );
+		acc = _mm_add_pd ( acc, _mm_mul_pd (diff, diff) );
+		j += 2;
+	}
+	sum = hsum ( _mm_add_pd (acc, odd) );
+#endif
+	for (; j<n; ++j)
+		sum += (a[j] - b[j]) * (a[j] - b[j]);
+	return sum;
+}
+
+template<> inline double sq_dist<float> ( const float* a, const float* b, int n ) {
+	int j = 0;
+	double sum = 0.0;
+#if defined(__AVX__)
+	__m256d acc = _mm256_setzero_pd ();
+	__m256d odd = _mm256_setzero_pd ();
+	for (; j+8<=n; j+=8) {
+		__m256d diff = _mm256_sub_pd ( _mm256_cvtps_pd (_mm_loadu_ps (a+j)), _mm256_cvtps_pd (_mm_loadu_ps (b+j)) );
+		__m256d next = _mm256_sub_pd ( _mm256_cvtps_pd (_mm_loadu_ps (a+j+4)), _mm256_cvtps_pd (_mm_loadu_ps (b+j+4)) );
+		acc = _mm256_add_pd ( acc, _mm256_mul_pd (diff, diff) );
+		odd = _mm256_add_pd ( odd, _mm256_mul_pd (next, next) );
+	}
+	if (j+4<=n) {
+		__m256d diff = _mm256_sub_pd ( _mm256_cvtps_pd (_mm_loadu_ps (a+j)), _mm256_cvtps_pd (_mm_loadu_ps (b+j)) );
+		acc = _mm256_add_pd ( acc, _mm256_mul_pd (diff, diff) );
+		j += 4;
+	}
+	sum = hsum ( _mm256_add_pd (acc, odd) );
+#elif defined(__SSE2__)
+	__m128d acc = _mm_setzero_pd ();
+	__m128d odd = _mm_setzero_pd ();
+	for (; j+4<=n; j+=4) {
+		__m128d diff = _mm_sub_pd ( _mm_cvtps_pd ( _mm_castpd_ps (_mm_load_sd ((const double*) (a+j))) ),
+				_mm_cvtps_pd ( _mm_castpd_ps (_mm_load_sd ((const double*) (b+j))) ) );
+		__m128d next = _mm_sub_pd ( _mm_cvtps_pd ( _mm_castpd_ps (_mm_load_sd ((const double*) (a+j+2))) ),
+				_mm_cvtps_pd ( _mm_castpd_ps (_mm_load_sd ((const double*) (b+j+2))) ) );
+		acc = _mm_add_pd ( acc, _mm_mul_pd (diff, diff) );
+		odd = _mm_add_pd ( odd, _mm_mul_pd (next, next) );
+	}
+	if (j+2<=n) {
+		__m128d diff = _mm_sub_pd ( _mm_cvtps_pd ( _mm_castpd_ps (_mm_load_sd ((const double*) (a+j))) ),
+				_mm_cvtps_pd ( _mm_castpd_ps (_mm_load_sd ((const double*) (b+j))) ) );
+		acc = _mm_add_pd ( acc, _mm_mul_pd (diff, diff) );
+		j += 2;
+	}
+	sum = hsum ( _mm_add_pd (acc, odd) );
+#endif
+	for (; j<n; ++j) {
+		double diff = (double) a[j] - (double) b[j];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+template<> inline double sq_dist<int> ( const int* a, const int* b, int n ) {
+	int j = 0;
+	double sum = 0.0;
+#if defined(__AVX__)
+	__m256d acc = _mm256_setzero_pd ();
+	__m256d odd = _mm256_setzero_pd ();
+	for (; j+8<=n; j+=8) {
+		__m256d diff = _mm256_sub_pd ( _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i*) (a+j))),
+				_mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i*) (b+j))) );
+		__m256d next = _mm256_sub_pd ( _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i*) (a+j+4))),
+				_mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i*) (b+j+4))) );
+		acc = _mm256_add_pd ( acc, _mm256_mul_pd (diff, diff) );
+		odd = _mm256_add_pd ( odd, _mm256_mul_pd (next, next) );
+	}
+	if (j+4<=n) {
+		__m256d diff = _mm256_sub_pd ( _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i*) (a+j))),
+				_mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i*) (b+j))) );
+		acc = _mm256_add_pd ( acc, _mm256_mul_pd (diff, diff) );
+		j += 4;
+	}
+	sum = hsum ( _mm256_add_pd (acc, odd) );
+#elif defined(__SSE2__)
+	__m128d acc = _mm_setzero_pd ();
+	__m128d odd = _mm_setzero_pd ();
+	for (; j+4<=n; j+=4) {
+		__m128d diff = _mm_sub_pd ( _mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i*) (a+j))),
+				_mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i*) (b+j))) );
+		__m128d next = _mm_sub_pd ( _mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i*) (a+j+2))),
+				_mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i*) (b+j+2))) );
+		acc = _mm_add_pd ( acc, _mm_mul_pd (diff, diff) );
+		odd = _mm_add_pd ( odd, _mm_mul_pd (next, next) );
+	}
+	if (j+2<=n) {
+		__m128d diff = _mm_sub_pd ( _mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i*) (a+j))),
+				_mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i*) (b+j))) );
+		acc = _mm_add_pd ( acc, _mm_mul_pd (diff, diff) );
+		j += 2;
+	}
+	sum = hsum ( _mm_add_pd (acc, odd) );
+#endif
+	for (; j<n; ++j) {
+		double diff = (double) a[j] - (double) b[j];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+/*
+ * Column kernels over the n coordinates on one dimension of a bucket of
+ * keys: sq_dist_column adds the squared distances from c to acc, and
+ * in_range_column clears the hits falling outside [lo,hi].
+ */
+template<class T> inline void sq_dist_column ( const T* col, T c, double* acc, unsigned n ) {
+	for (unsigned s=0; s<n; ++s) {
+		double diff = (double) col[s] - (double) c;
+		acc[s] += diff * diff;
+	}
+}
+
+template<class T> inline void in_range_column ( const T* col, T lo, T hi, unsigned char* hit, unsigned n ) {
+	for (unsigned s=0; s<n; ++s)
+		hit[s] &= (col[s] >= lo) & (col[s] <= hi);
+}
+
+template<> inline void sq_dist_column<double> ( const double* col, double c, double* acc, unsigned n ) {
+	unsigned s = 0;
+#if defined(__AVX__)
+	__m256d center = _mm256_set1_pd (c);
+	for (; s+4<=n; s+=4) {
+		__m256d diff = _mm256_sub_pd ( _mm256_loadu_pd (col+s), center );
+		_mm256_storeu_pd ( acc+s, _mm256_add_pd ( _mm256_loadu_pd (acc+s), _mm256_mul_pd (diff, diff) ) );
+	}
+#elif defined(__SSE2__)
+	__m128d center = _mm_set1_pd (c);
+	for (; s+2<=n; s+=2) {
+		__m128d diff = _mm_sub_pd ( _mm_loadu_pd (col+s), center );
+		_mm_storeu_pd ( acc+s, _mm_add_pd ( _mm_loadu_pd (acc+s), _mm_mul_pd (diff, diff) ) );
+	}
+#endif
+	for (; s<n; ++s)
+		acc[s] += (col[s] - c) * (col[s] - c);
+}
+
+template<> inline void in_range_column<double> ( const double* col, double lo, double hi, unsigned char* hit, unsigned n ) {
+	unsigned s = 0;
+#if defined(__AVX__)
+	__m256d l = _mm256_set1_pd (lo);
+	__m256d h = _mm256_set1_pd (hi);
+	for (; s+4<=n; s+=4) {
+		__m256d v = _mm256_loadu_pd (col+s);
+		int m = _mm256_movemask_pd ( _mm256_and_pd ( _mm256_cmp_pd (v, l, _CMP_GE_OQ), _mm256_cmp_pd (v, h, _CMP_LE_OQ) ) );
+		for (int k=0; k<4; ++k)
+			hit[s+k] &= (m>>k) & 1;
+	}
+#elif defined(__SSE2__)
+	__m128d l = _mm_set1_pd (lo);
+	__m128d h = _mm_set1_pd (hi);
+	for (; s+2<=n; s+=2) {
+		__m128d v = _mm_loadu_pd (col+s);
+		int m = _mm_movemask_pd ( _mm_and_pd ( _mm_cmpge_pd (v, l), _mm_cmple_pd (v, h) ) );
+		hit[s] &= m & 1;
+		hit[s+1] &= (m>>1) & 1;
+	}
+#endif
+	for (; s<n; ++s)
+		hit[s] &= (col[s] >= lo) & (col[s] <= hi);
+}
+
+#endif
@@ -0,0 +1,280 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+/*
+ * Routing benchmark of a running overlay: random tuples are indexed
+ * through a node, then rounds of lookups and updates of stored keys,
+ * mostly out of a small hot set, enter at nodes picked at random. The
+ * hops of the lookups are reported for every round as a distribution,
+ * along with the mean time of an update, so that the first round is told
+ * from the ones after the nodes learned their routes.
+ */
+
+#include "ClientSocket.h"
+#include "ServerSocket.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+bool ipv6 = false;
+
+/* hops of the answers received so far, whatever the connection they came on */
+std::vector<int> hops;
+pthread_mutex_t hops_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned next ( unsigned& seed ) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* files the hops of every answer of a connection of a peer */
+void* receive ( void* args ) {
+	ServerSocket* sock = static_cast<ServerSocket*> (args);
+	std::string data;
+	try{
+		for (;;) {
+			std::string chunk;
+			*sock >> chunk;
+			data += chunk;
+
+			size_t end;
+			while ((end = data.find ("#END\n")) != std::string::npos) {
+				size_t pos = data.find ("#HOPS: ");
+				if (pos != std::string::npos && pos < end) {
+					pthread_mutex_lock (&hops_lock);
+					hops.push_back (std::atoi (data.c_str()+pos+7));
+					pthread_mutex_unlock (&hops_lock);
+				}
+				data.erase (0, end+5);
+			}
+		}
+	}catch (std::exception& e){
+	}
+	delete sock;
+	return 0;
+}
+
+void* accept_answers ( void* args ) {
+	ServerSocket* server = static_cast<ServerSocket*> (args);
+	for (;;) {
+		ServerSocket* sock = new ServerSocket;
+		server->accept (*sock);
+
+		pthread_t thread;
+		if ( pthread_create ( &thread, 0, receive, sock ) != 0 )
+			throw std::runtime_error ("** ERROR - Unable to create a receiver thread.");
+		pthread_detach (thread);
+	}
+	return 0;
+}
+
+static std::vector<int> parse_ports ( const std::string& list ) {
+	std::vector<int> ports;
+	std::stringstream in (list);
+	std::string port;
+	while (std::getline (in, port, ','))
+		ports.push_back (std::atoi (port.c_str()));
+	return ports;
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-h --host\n";
+	std::cerr << "\t\t-p --ports\n";
+	std::cerr << "\t\t-l --listen\n";
+	std::cerr << "\t\t-d --dims\n";
+	std::cerr << "\t\t-n --tuples\n";
+	std::cerr << "\t\t-q --queries\n";
+	std::cerr << "\t\t-r --rounds\n";
+	std::cerr << "\t\t-k --hot\n";
+	std::cerr << "\t\t-z --skew\n";
+}
+
+int main ( int argc, char** argv ) {
+	std::string host = "127.0.0.1";
+	std::vector<int> ports;
+	int listen_port = 50000;
+	int dims = 2;
+	unsigned tuples = 20000;
+	unsigned queries = 1000;
+	unsigned rounds = 5;
+	unsigned hot = 200;
+	double skew = .9;
+
+	static struct option long_options[] = {
+		{"host",1,NULL,'h'},
+		{"ports",1,NULL,'p'},
+		{"listen",1,NULL,'l'},
+		{"dims",1,NULL,'d'},
+		{"tuples",1,NULL,'n'},
+		{"queries",1,NULL,'q'},
+		{"rounds",1,NULL,'r'},
+		{"hot",1,NULL,'k'},
+		{"skew",1,NULL,'z'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "h:p:l:d:n:q:r:k:z:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'h': host = optarg; break;
+		case 'p': ports = parse_ports (optarg); break;
+		case 'l': listen_port = std::atoi (optarg); break;
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': tuples = std::atoi (optarg); break;
+		case 'q': queries = std::atoi (optarg); break;
+		case 'r': rounds = std::atoi (optarg); break;
+		case 'k': hot = std::atoi (optarg); break;
+		case 'z': skew = std::atof (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( ports.empty() || listen_port <= 0 || dims < 1 || tuples < 1 || hot < 1 || skew < 0 || skew > 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+	hot = std::min (hot, tuples);
+
+	ServerSocket server (host.c_str(), listen_port);
+	pthread_t listener;
+	if ( pthread_create ( &listener, 0, accept_answers, &server ) != 0 )
+		throw std::runtime_error ("** ERROR - Unable to create the listener thread.");
+	pthread_detach (listener);
+
+	std::vector<ClientSocket*> entries;
+	for (unsigned i=0; i<ports.size(); ++i)
+		entries.push_back (new ClientSocket (host, ports[i]));
+	unsigned seed = 7919;
+
+	/* the tuples go in batches, routed to their nodes by the overlay */
+	std::vector<std::string> keys;
+	for (unsigned i=0; i<tuples; ) {
+		std::stringstream batch;
+		batch << "B\n";
+		for (unsigned end = std::min (tuples, i+5000); i<end; ++i) {
+			std::stringstream key;
+			for (int j=0; j<dims; ++j)
+				key << (j ? "," : "") << (next (seed) % 1000000) / 1e6;
+			keys.push_back (key.str());
+			batch << "U(" << keys.back() << ")v" << i << "\n";
+		}
+		batch << "#END\n";
+		*entries[0] << batch.str();
+
+		std::string response;
+		*entries[0] >> response;
+		if (response.compare ("B OK\n") != 0)
+			std::cerr << "** batch ending at tuple " << i << " answered " << response;
+	}
+
+	std::vector<std::vector<unsigned> > spread (rounds);
+	std::vector<double> update_us (rounds);
+	std::vector<unsigned> failures (rounds);
+	unsigned max_hops = 0;
+
+	for (unsigned r=0; r<rounds; ++r) {
+		pthread_mutex_lock (&hops_lock);
+		hops.clear ();
+		pthread_mutex_unlock (&hops_lock);
+
+		double elapsed = 0;
+		for (unsigned q=0; q<queries; ++q) {
+			unsigned k = next (seed) % 1000 < skew * 1000 ? next (seed) % hot : next (seed) % tuples;
+			ClientSocket* entry = entries [next (seed) % entries.size()];
+
+			std::stringstream lookup;
+			lookup << "L(" << keys[k] << ") " << host << " " << listen_port << " 0\n";
+			std::string response;
+			*entry << lookup.str();
+			*entry >> response;
+			if (response.compare ("L OK\n") != 0)
+				++failures[r];
+
+			std::stringstream update;
+			update << "U(" << keys[k] << ")v" << k << "." << r << "\n";
+			double start = now ();
+			*entry << update.str();
+			*entry >> response;
+			elapsed += now () - start;
+			if (response.compare ("U OK\n") != 0)
+				++failures[r];
+		}
+		update_us[r] = elapsed / queries * 1e6;
+
+		/* every answer has left once its lookup is acknowledged, yet may still be on its way */
+		for (int wait=0; wait<100; ++wait) {
+			pthread_mutex_lock (&hops_lock);
+			bool done = hops.size() >= queries;
+			pthread_mutex_unlock (&hops_lock);
+			if (done)
+				break;
+			usleep (10000);
+		}
+
+		pthread_mutex_lock (&hops_lock);
+		for (unsigned i=0; i<hops.size(); ++i) {
+			unsigned h = std::max (hops[i], 0);
+			if (spread[r].size() <= h)
+				spread[r].resize (h+1);
+			++spread[r][h];
+			max_hops = std::max (max_hops, h);
+		}
+		pthread_mutex_unlock (&hops_lock);
+	}
+
+	std::cout << "%% round\tanswers\tmean hops\tupdate us\tfailures";
+	for (unsigned h=1; h<=max_hops; ++h)
+		std::cout << "\t" << h << " hops";
+	std::cout << "\n";
+
+	for (unsigned r=0; r<rounds; ++r) {
+		unsigned answers = 0, total = 0;
+		for (unsigned h=0; h<spread[r].size(); ++h) {
+			answers += spread[r][h];
+			total += h * spread[r][h];
+		}
+		spread[r].resize (max_hops+1);
+
+		std::cout << r+1 << "\t" << answers << "\t" << (answers ? (double) total / answers : 0)
+			<< "\t" << update_us[r] << "\t" << failures[r];
+		for (unsigned h=1; h<=max_hops; ++h)
+			std::cout << "\t" << spread[r][h];
+		std::cout << "\n";
+	}
+
+	for (unsigned i=0; i<entries.size(); ++i)
+		delete entries[i];
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+/*
+ * Micro-benchmark of the distance kernels: squared distances between keys
+ * are taken as Dtree used to, summing pow() per coordinate and taking the
+ * root, through the sq_dist kernel with the dimensionality known at run
+ * time, and through the kernel with it fixed at compile time as Dtree does
+ * when built with -DMIDAS_DIMS=<d>, and the time of each is reported in
+ * nanoseconds per distance. The kernel is SSE2 by default and AVX when
+ * built with CXXFLAGS="-g -O2 -march=native".
+ */
+
+#include "distance.h"
+#include <getopt.h>
+#include <sys/time.h>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+typedef double index_t;
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* the distance as Dtree computed it before the kernels */
+static double legacy_dist ( const index_t* a, const index_t* b, int dims ) {
+	double dist = 0.0;
+	for (int j=0; j<dims; ++j)
+		dist += pow (a[j] - b[j], 2);
+	return sqrt (dist);
+}
+
+/* times rounds over keys cycled against a center, the sum returned to keep them from being optimized away */
+template<int D> static double run ( const std::vector<index_t>& data, int dims, unsigned keys,
+		unsigned rounds, int kernel, double& sum ) {
+	const index_t* center = &data[0];
+	sum = 0;
+	double start = now ();
+	for (unsigned r=0; r<rounds; ++r)
+		for (unsigned i=0; i<keys; ++i) {
+			const index_t* key = &data[i*dims];
+			if (kernel == 0)
+				sum += legacy_dist (key, center, dims);
+			else if (D > 0)
+				sum += sq_dist<index_t> (key, center, D);
+			else
+				sum += sq_dist<index_t> (key, center, dims);
+		}
+	return (now () - start) * 1e9 / ((double) rounds * keys);
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-d --dims (2, 3, 4, 8, 16 or 32)\n";
+	std::cerr << "\t\t-n --keys\n";
+	std::cerr << "\t\t-r --rounds\n";
+}
+
+int main ( int argc, char** argv ) {
+	int dims = 0;
+	unsigned keys = 4096;
+	unsigned rounds = 2000;
+
+	static struct option long_options[] = {
+		{"dims",1,NULL,'d'},
+		{"keys",1,NULL,'n'},
+		{"rounds",1,NULL,'r'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "d:n:r:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': keys = std::atoi (optarg); break;
+		case 'r': rounds = std::atoi (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	const int all[] = {2, 3, 4, 8, 16, 32};
+	std::vector<int> sweep;
+	for (unsigned i=0; i<sizeof(all)/sizeof(all[0]); ++i)
+		if (dims == 0 || dims == all[i])
+			sweep.push_back (all[i]);
+
+	if ( sweep.empty() || (int) keys < 1 || (int) rounds < 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+#if defined(__AVX__)
+	const char* kernel = "AVX";
+#elif defined(__SSE2__)
+	const char* kernel = "SSE2";
+#else
+	const char* kernel = "scalar";
+#endif
+
+	double checksum = 0;
+	std::cout << "%% ns/distance\tkernel: " << kernel << "\n";
+	std::cout << "%% dims\tpow+sqrt\tkernel\tkernel fixed-d\n";
+	for (unsigned s=0; s<sweep.size(); ++s) {
+		int d = sweep[s];
+		std::vector<index_t> data (keys * d);
+		srand (1);
+		for (unsigned i=0; i<data.size(); ++i)
+			data[i] = rand () / (double) RAND_MAX;
+
+		double sum, legacy, runtime, fixed = 0;
+		legacy = run<0> (data, d, keys, rounds, 0, sum);
+		checksum += sum;
+		runtime = run<0> (data, d, keys, rounds, 1, sum);
+		checksum += sum;
+		switch (d) {
+		case 2: fixed = run<2> (data, d, keys, rounds, 1, sum); break;
+		case 3: fixed = run<3> (data, d, keys, rounds, 1, sum); break;
+		case 4: fixed = run<4> (data, d, keys, rounds, 1, sum); break;
+		case 8: fixed = run<8> (data, d, keys, rounds, 1, sum); break;
+		case 16: fixed = run<16> (data, d, keys, rounds, 1, sum); break;
+		case 32: fixed = run<32> (data, d, keys, rounds, 1, sum); break;
+		}
+		checksum += sum;
+
+		std::cout << d << "\t" << legacy << "\t" << runtime << "\t" << fixed << std::endl;
+	}
+
+	/* keeps the sums from being optimized away */
+	return checksum < 0;
+}
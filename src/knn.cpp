@@ -0,0 +1,274 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+/*
+ * Nearest neighbor benchmark of a running overlay: random tuples are
+ * indexed through a node, then kNN queries of random centers are asked
+ * one at a time. For each query the answers and tuples the requester gets
+ * are counted, along with the messages it took, and the K nearest merged
+ * out of the answers are checked against an exhaustive search.
+ */
+
+#include "ClientSocket.h"
+#include "ServerSocket.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+bool ipv6 = false;
+
+/* answers received so far, whatever the connection they came on */
+std::vector<std::string> answers;
+pthread_mutex_t answers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned next ( unsigned& seed ) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+/* files every answer of a connection of a peer */
+void* receive ( void* args ) {
+	ServerSocket* sock = static_cast<ServerSocket*> (args);
+	std::string data;
+	try{
+		for (;;) {
+			std::string chunk;
+			*sock >> chunk;
+			data += chunk;
+
+			size_t end;
+			while ((end = data.find ("#END\n")) != std::string::npos) {
+				pthread_mutex_lock (&answers_lock);
+				answers.push_back (data.substr (0, end+5));
+				pthread_mutex_unlock (&answers_lock);
+				data.erase (0, end+5);
+			}
+		}
+	}catch (std::exception& e){
+	}
+	delete sock;
+	return 0;
+}
+
+void* accept_answers ( void* args ) {
+	ServerSocket* server = static_cast<ServerSocket*> (args);
+	for (;;) {
+		ServerSocket* sock = new ServerSocket;
+		server->accept (*sock);
+
+		pthread_t thread;
+		if ( pthread_create ( &thread, 0, receive, sock ) != 0 )
+			throw std::runtime_error ("** ERROR - Unable to create a receiver thread.");
+		pthread_detach (thread);
+	}
+	return 0;
+}
+
+static double sq_dist ( const double* a, const double* b, int dims ) {
+	double sum = 0;
+	for (int j=0; j<dims; ++j)
+		sum += (a[j]-b[j]) * (a[j]-b[j]);
+	return sum;
+}
+
+/* adds up what the answers of a query hold, returns the recall of the K nearest of their tuples */
+static double score ( const std::vector<std::string>& got, const double* center, int K, int dims,
+		const std::vector<double>& keys, unsigned& tuples, unsigned& forwards ) {
+
+	std::vector<double> found;
+	int hops = 0;
+	for (unsigned i=0; i<got.size(); ++i) {
+		std::stringstream in (got[i]);
+		std::string line;
+		while (std::getline (in, line)) {
+			if (line.compare (0, 11, "#FORWARDS: ") == 0) {
+				forwards += std::atoi (line.c_str()+11);
+			}else if (line.compare (0, 7, "#HOPS: ") == 0) {
+				hops = std::max (hops, std::atoi (line.c_str()+7));
+			}else if (line.compare (0, 10, "(distance(") == 0) {
+				std::stringstream key (line.substr (line.find ("key(")+4));
+				std::vector<double> k (dims);
+				char comma;
+				for (int j=0; j<dims; ++j)
+					key >> k[j] >> comma;
+				found.push_back (sq_dist (&k[0], center, dims));
+				++tuples;
+			}
+		}
+	}
+
+	/* the hops of an answer count the peers that relayed the query to the one answering */
+	if (hops > 0)
+		forwards += hops-1;
+
+	std::vector<double> exact;
+	for (unsigned i=0; i<keys.size(); i+=dims)
+		exact.push_back (sq_dist (&keys[i], center, dims));
+	std::sort (exact.begin(), exact.end());
+	std::sort (found.begin(), found.end());
+
+	int k = std::min (K, (int) exact.size());
+	if (k == 0)
+		return 1;
+	double kth = exact[k-1];
+
+	int hits = 0;
+	for (int i=0; i<k && i<(int) found.size(); ++i)
+		if (found[i] <= kth)
+			++hits;
+	return (double) hits / k;
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-h --host\n";
+	std::cerr << "\t\t-p --port\n";
+	std::cerr << "\t\t-l --listen\n";
+	std::cerr << "\t\t-d --dims\n";
+	std::cerr << "\t\t-n --tuples\n";
+	std::cerr << "\t\t-q --queries\n";
+	std::cerr << "\t\t-k --neighbors\n";
+}
+
+int main ( int argc, char** argv ) {
+	std::string host = "127.0.0.1";
+	int port = 0;
+	int listen_port = 50000;
+	int dims = 2;
+	unsigned tuples = 20000;
+	unsigned queries = 100;
+	int K = 10;
+
+	static struct option long_options[] = {
+		{"host",1,NULL,'h'},
+		{"port",1,NULL,'p'},
+		{"listen",1,NULL,'l'},
+		{"dims",1,NULL,'d'},
+		{"tuples",1,NULL,'n'},
+		{"queries",1,NULL,'q'},
+		{"neighbors",1,NULL,'k'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "h:p:l:d:n:q:k:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'h': host = optarg; break;
+		case 'p': port = std::atoi (optarg); break;
+		case 'l': listen_port = std::atoi (optarg); break;
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': tuples = std::atoi (optarg); break;
+		case 'q': queries = std::atoi (optarg); break;
+		case 'k': K = std::atoi (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( port <= 0 || listen_port <= 0 || dims < 1 || K < 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	ServerSocket server (host.c_str(), listen_port);
+	pthread_t listener;
+	if ( pthread_create ( &listener, 0, accept_answers, &server ) != 0 )
+		throw std::runtime_error ("** ERROR - Unable to create the listener thread.");
+	pthread_detach (listener);
+
+	ClientSocket cs (host, port);
+	unsigned seed = 7919;
+
+	/* the tuples go in batches, routed to their nodes by the overlay */
+	std::vector<double> keys;
+	for (unsigned i=0; i<tuples; ) {
+		std::stringstream batch;
+		batch << "B\n";
+		for (unsigned end = std::min (tuples, i+5000); i<end; ++i) {
+			batch << "U(";
+			for (int j=0; j<dims; ++j) {
+				keys.push_back ((next (seed) % 1000000) / 1e6);
+				batch << (j ? "," : "") << keys.back();
+			}
+			batch << ")v" << i << "\n";
+		}
+		batch << "#END\n";
+		cs << batch.str();
+
+		std::string response;
+		cs >> response;
+		if (response.compare ("B OK\n") != 0)
+			std::cerr << "** batch ending at tuple " << i << " answered " << response;
+	}
+
+	unsigned total_answers = 0, total_tuples = 0, total_forwards = 0, failures = 0;
+	double total_recall = 0;
+	for (unsigned q=0; q<queries; ++q) {
+		std::vector<double> center (dims);
+		std::stringstream msg;
+		msg << "N((";
+		for (int j=0; j<dims; ++j) {
+			center[j] = (next (seed) % 1000000) / 1e6;
+			msg << (j ? "," : "") << center[j];
+		}
+		msg << ")," << K << ",-1) " << host << " " << listen_port << " 0\n";
+
+		cs << msg.str();
+		std::string response;
+		cs >> response;
+		if (response.compare ("N OK\n") != 0)
+			++failures;
+
+		/*
+		 * a forwarded query is acknowledged before its owner answers, which
+		 * sends the merged neighbors at once, so the first answer is awaited
+		 * for a second and any late one of a peer for a bit longer
+		 */
+		std::vector<std::string> got;
+		for (int waited = 0; waited < 1000 && got.empty(); ++waited) {
+			usleep (1000);
+			pthread_mutex_lock (&answers_lock);
+			got.swap (answers);
+			pthread_mutex_unlock (&answers_lock);
+		}
+		usleep (20000);
+		pthread_mutex_lock (&answers_lock);
+		got.insert (got.end(), answers.begin(), answers.end());
+		answers.clear ();
+		pthread_mutex_unlock (&answers_lock);
+
+		unsigned forwards = 0;
+		total_recall += score (got, &center[0], K, dims, keys, total_tuples, forwards);
+		total_answers += got.size();
+		total_forwards += forwards;
+	}
+
+	std::cout << "%% queries\tK\tanswers/query\ttuples/query\tmessages/query\trecall\tfailures\n";
+	std::cout << queries << "\t" << K << "\t" << (double) total_answers / queries << "\t"
+		<< (double) total_tuples / queries << "\t" << (double) (total_answers + total_forwards) / queries << "\t"
+		<< total_recall / queries << "\t" << failures << std::endl;
+	return 0;
+}
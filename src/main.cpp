@@ -21,6 +21,7 @@
 #include "common.h"
 #include <pthread.h>
 #include <getopt.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <iostream>
 #include <fstream>
@@ -30,6 +31,17 @@
 typedef double index_t;
 
 bool ipv6 = false;
+bool exact_median = false;
+unsigned bucket_size = 1;
+double compaction_ratio = .25;
+unsigned pool_shards = 1;
+unsigned server_workers = 16;
+bool framed_protocol = false;
+unsigned overload_tuples = 0;
+double overload_rate = 0;
+std::vector<std::pair<std::string,int> > spare_peers;
+SplitPolicy split_policy = ROUND_ROBIN_SPLIT;
+unsigned route_capacity = 64;
 Node<index_t> *local_node = 0;
 
 void build_overlay (std::string &host, int port, int dims, double lo, double hi , int splits);
@@ -47,6 +59,18 @@ void print_usage ( char*program ) {
 	std::cerr << "\t\t-r --remote\n";
 	std::cerr << "\t\t-a --at\n";
 	std::cerr << "\t\t-6 --ipv6\n";
+	std::cerr << "\t\t-e --exact\n";
+	std::cerr << "\t\t-b --bucket\n";
+	std::cerr << "\t\t-c --compact\n";
+	std::cerr << "\t\t-k --shards\n";
+	std::cerr << "\t\t-w --workers\n";
+	std::cerr << "\t\t-f --framed\n";
+	std::cerr << "\t\t-o --overload\n";
+	std::cerr << "\t\t-q --rate\n";
+	std::cerr << "\t\t-x --spare\n";
+	std::cerr << "\t\t-t --standby\n";
+	std::cerr << "\t\t-y --policy round|spread|balance|workload\n";
+	std::cerr << "\t\t-z --routes\n";
 }
 
 void signalDepart (int signum) {
@@ -65,7 +89,7 @@ int main ( int argc, char* argv[] ) {
 	sigaction (SIGINT,&action,NULL);
 
 	int next_option;
-	const char* const short_options="ud:l:g:h:p:r:a:6"; //s:
+	const char* const short_options="ud:l:g:h:p:r:a:6eb:c:k:w:fo:q:x:ty:z:"; //s:
 	const struct option long_options[]={
 		{"usage",0,NULL,'u'},
 		{"dims",1,NULL,'d'},
@@ -77,6 +101,18 @@ int main ( int argc, char* argv[] ) {
 		{"remote",1,NULL,'r'},
 		{"at",1,NULL,'a'},
 		{"ipv6",1,NULL,'6'},
+		{"exact",0,NULL,'e'},
+		{"bucket",1,NULL,'b'},
+		{"compact",1,NULL,'c'},
+		{"shards",1,NULL,'k'},
+		{"workers",1,NULL,'w'},
+		{"framed",0,NULL,'f'},
+		{"overload",1,NULL,'o'},
+		{"rate",1,NULL,'q'},
+		{"spare",1,NULL,'x'},
+		{"standby",0,NULL,'t'},
+		{"policy",1,NULL,'y'},
+		{"routes",1,NULL,'z'},
 		{NULL,0,NULL,0}
 	};
 
@@ -85,6 +121,7 @@ int main ( int argc, char* argv[] ) {
 	int local_port=0, remote_port=0;
 	std::string local_host, remote_host;
 	double low=0, high=1;
+	bool standby = false;
 
 	do{
 		next_option = getopt_long (argc,argv,short_options,long_options,NULL);
@@ -120,6 +157,62 @@ int main ( int argc, char* argv[] ) {
 		case '6':
 			ipv6 = true;
 			break;
+		case 'e':
+			exact_median = true;
+			break;
+		case 'b':
+			bucket_size = std::atoi (optarg);
+			break;
+		case 'c':
+			compaction_ratio = std::atof (optarg);
+			break;
+		case 'k':
+			pool_shards = std::atoi (optarg);
+			break;
+		case 'w':
+			server_workers = std::atoi (optarg);
+			break;
+		case 'f':
+			framed_protocol = true;
+			break;
+		case 'o':
+			overload_tuples = std::atoi (optarg);
+			break;
+		case 'q':
+			overload_rate = std::atof (optarg);
+			break;
+		case 'x': {
+			std::string spare = optarg;
+			size_t colon = spare.rfind (':');
+			if (colon == std::string::npos) {
+				std::cerr << "** ERROR - Spare peers are given as host:port.\n";
+				print_usage(argv[0]);
+				return -1;
+			}
+			spare_peers.push_back (std::make_pair (spare.substr (0, colon), std::atoi (spare.c_str()+colon+1)));
+			break;
+		}
+		case 't':
+			standby = true;
+			break;
+		case 'y':
+			if (strcmp (optarg, "round") == 0)
+				split_policy = ROUND_ROBIN_SPLIT;
+			else if (strcmp (optarg, "spread") == 0)
+				split_policy = MAX_SPREAD_SPLIT;
+			else if (strcmp (optarg, "balance") == 0)
+				split_policy = BALANCED_SPLIT;
+			else if (strcmp (optarg, "workload") == 0)
+				split_policy = WORKLOAD_SPLIT;
+			else {
+				std::cerr << "** ERROR - Unknown split policy " << optarg << ".\n";
+				print_usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'z':
+			route_capacity = std::atoi (optarg);
+			break;
 		case '?':
 			break;
 		case -1:
@@ -134,17 +227,84 @@ int main ( int argc, char* argv[] ) {
 		print_usage(argv[0]);
 		return -1;
 	}
+	if ( (int) bucket_size < 1 ) {
+		std::cerr << "** ERROR - Bucket capacity should be positive.\n";
+		print_usage(argv[0]);
+		return -1;
+	}
+	if ( compaction_ratio <= 0 || compaction_ratio > 1 ) {
+		std::cerr << "** ERROR - Compaction ratio should lie in (0,1].\n";
+		print_usage(argv[0]);
+		return -1;
+	}
+	if ( (int) pool_shards < 1 ) {
+		std::cerr << "** ERROR - Shards of a pool should be positive.\n";
+		print_usage(argv[0]);
+		return -1;
+	}
+	if ( (int) server_workers < 1 ) {
+		std::cerr << "** ERROR - Workers of a node should be positive.\n";
+		print_usage(argv[0]);
+		return -1;
+	}
+	if ( overload_rate < 0 ) {
+		std::cerr << "** ERROR - Overload rate should not be negative.\n";
+		print_usage(argv[0]);
+		return -1;
+	}
+	if ( standby && local_port <= 1024 ) {
+		std::cerr << "** ERROR - A peer in standby should listen on a port.\n";
+		print_usage(argv[0]);
+		return -1;
+	}
 	srand(time(0));
 
+	/* connections are bounded by descriptors rather than threads */
+	rlimit limit;
+	if ( getrlimit (RLIMIT_NOFILE, &limit) == 0 ) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+	}
+
+	/* a spare peer idles until an overloaded node tells it where to join */
+	if ( standby ) {
+		std::cerr << "** Standing by at " << local_host << ":" << local_port << ".\n";
+		ServerSocket ss (local_host.c_str(), local_port);
+		for (remote_port = 0; remote_port <= 1024; ) {
+			ServerSocket recruiter;
+			ss.accept (recruiter);
+
+			std::string request;
+			recruiter >> request;
+			std::stringstream in (request, std::stringstream::in);
+			char symbol = 0;
+			in >> symbol;
+			if (symbol != 'J')
+				continue;
+			in >> remote_host;
+			in >> remote_port;
+			recruiter << "J OK\n";
+		}
+		std::cerr << "** Joining at " << remote_host << ":" << remote_port << ".\n";
+	}
+
 	if ( local_port > 1024 && remote_port <= 1024) { // && splits >= 0
 		build_overlay (local_host, local_port, dims, low, high, 0); //splits
 	}else{
 		std::stringstream request;
 		request << "S " << local_host << " " << std::to_string(local_port) << "\n";
 		ClientSocket cs (remote_host,remote_port);
+		cs.set_framed (framed_protocol);
 		cs << request.str();
+		/* the migrated region spans many reads once it carries tuples, unless framed */
 		std::string response;
-		cs >> response;
+		size_t scanned = 0;
+		while (response.find ("#END\n", scanned) == std::string::npos) {
+			scanned = response.size() < 4 ? 0 : response.size()-4;
+			std::string temp;
+			cs >> temp;
+			response += temp;
+		}
 		local_node = new Node<index_t> (local_host,local_port,dims,response);
 		local_node->link();
 		cs << "S OK\n";
@@ -0,0 +1,259 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+/*
+ * Skewed-workload benchmark of a running overlay: tuples mostly falling
+ * into a small hot corner of the key space are indexed through a node,
+ * then client threads keep updating keys of the same skew through the
+ * given nodes. Acknowledged updates are reported for every second, so
+ * that the rates before and after the overlay rebalances are seen, along
+ * with the tuples each probed peer holds at the start and at the end.
+ */
+
+#include "ClientSocket.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+bool ipv6 = false;
+
+struct SkewTask {
+	std::string host;
+	int port;
+	int dims;
+	double skew;
+	double width;
+	unsigned seed;
+	bool* running;
+	unsigned long long ops;
+	unsigned long long failures;
+};
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static unsigned next ( unsigned& seed ) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+/* writes a key falling into the hot corner [0,width)^dims with probability skew */
+static void skewed_key ( std::ostream& out, int dims, double skew, double width, unsigned& seed ) {
+	bool hot = (next (seed) % 1000000) / 1e6 < skew;
+	for (int j=0; j<dims; ++j) {
+		double x = (next (seed) % 1000000) / 1e6;
+		out << (j ? "," : "") << (hot ? x * width : x);
+	}
+}
+
+/* keeps an update in flight on a connection of its own */
+void* client ( void* args ) {
+	SkewTask* task = static_cast<SkewTask*> (args);
+	ClientSocket cs (task->host, task->port);
+
+	while ( __atomic_load_n (task->running, __ATOMIC_RELAXED) ) {
+		std::stringstream msg;
+		msg << "U(";
+		skewed_key (msg, task->dims, task->skew, task->width, task->seed);
+		msg << ")skew\n";
+		cs << msg.str();
+
+		std::string response;
+		cs >> response;
+		if (response.compare ("U OK\n") == 0)
+			__atomic_add_fetch (&task->ops, 1, __ATOMIC_RELAXED);
+		else
+			++task->failures;
+	}
+	return 0;
+}
+
+/* prints the tuples and request rate a peer reports, if it is a node yet */
+static void probe ( std::string& host, int port ) {
+	std::cout << "%% " << port << "\t";
+	try{
+		ClientSocket cs (host, port);
+		cs << "I\n";
+		std::string response;
+		cs >> response;
+
+		std::stringstream in (response);
+		char symbol;
+		unsigned tuples;
+		double rate;
+		std::string id;
+		in >> symbol >> tuples >> rate >> id;
+		std::cout << (id.empty() ? "-" : id) << "\t" << tuples << "\t" << rate << "\n";
+	}catch (std::exception& e){
+		std::cout << "standby\n";
+	}
+}
+
+static std::vector<int> parse_ports ( const char* list ) {
+	std::vector<int> ports;
+	std::stringstream in (list);
+	std::string port;
+	while (std::getline (in, port, ','))
+		ports.push_back (std::atoi (port.c_str()));
+	return ports;
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-h --host\n";
+	std::cerr << "\t\t-p --ports\n";
+	std::cerr << "\t\t-i --probe\n";
+	std::cerr << "\t\t-d --dims\n";
+	std::cerr << "\t\t-n --tuples\n";
+	std::cerr << "\t\t-c --clients\n";
+	std::cerr << "\t\t-s --seconds\n";
+	std::cerr << "\t\t-z --skew\n";
+	std::cerr << "\t\t-w --width\n";
+}
+
+int main ( int argc, char** argv ) {
+	std::string host = "127.0.0.1";
+	std::vector<int> ports;
+	std::vector<int> probed;
+	int dims = 2;
+	unsigned tuples = 50000;
+	int clients = 8;
+	int seconds = 20;
+	double skew = .9;
+	double width = .1;
+
+	static struct option long_options[] = {
+		{"host",1,NULL,'h'},
+		{"ports",1,NULL,'p'},
+		{"probe",1,NULL,'i'},
+		{"dims",1,NULL,'d'},
+		{"tuples",1,NULL,'n'},
+		{"clients",1,NULL,'c'},
+		{"seconds",1,NULL,'s'},
+		{"skew",1,NULL,'z'},
+		{"width",1,NULL,'w'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "h:p:i:d:n:c:s:z:w:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'h': host = optarg; break;
+		case 'p': ports = parse_ports (optarg); break;
+		case 'i': probed = parse_ports (optarg); break;
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': tuples = std::atoi (optarg); break;
+		case 'c': clients = std::atoi (optarg); break;
+		case 's': seconds = std::atoi (optarg); break;
+		case 'z': skew = std::atof (optarg); break;
+		case 'w': width = std::atof (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( ports.empty() || dims < 1 || clients < 1 || seconds < 1 || skew < 0 || skew > 1 || width <= 0 || width > 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+	if ( probed.empty() )
+		probed = ports;
+
+	/* the tuples go in batches, routed to their nodes by the overlay */
+	unsigned seed = 7919;
+	{
+		ClientSocket cs (host, ports[0]);
+		for (unsigned i=0; i<tuples; ) {
+			std::stringstream batch;
+			batch << "B\n";
+			for (unsigned end = std::min (tuples, i+5000); i<end; ++i) {
+				batch << "U(";
+				skewed_key (batch, dims, skew, width, seed);
+				batch << ")v" << i << "\n";
+			}
+			batch << "#END\n";
+			cs << batch.str();
+
+			std::string response;
+			cs >> response;
+			if (response.compare ("B OK\n") != 0)
+				std::cerr << "** batch ending at tuple " << i << " answered " << response;
+		}
+	}
+
+	std::cout << "%% port\tid\ttuples\trequests/s\n";
+	for (unsigned i=0; i<probed.size(); ++i)
+		probe (host, probed[i]);
+
+	bool running = true;
+	std::vector<SkewTask> tasks (clients);
+	std::vector<pthread_t> handles (clients);
+	for (int i=0; i<clients; ++i) {
+		tasks[i].host = host;
+		tasks[i].port = ports[i % ports.size()];
+		tasks[i].dims = dims;
+		tasks[i].skew = skew;
+		tasks[i].width = width;
+		tasks[i].seed = 104729 * (i+1);
+		tasks[i].running = &running;
+		tasks[i].ops = 0;
+		tasks[i].failures = 0;
+		if ( pthread_create ( &handles[i], 0, client, &tasks[i] ) != 0 )
+			throw std::runtime_error ("** ERROR - Unable to create a client thread.");
+	}
+
+	std::cout << "%% second\tupdates/s\n";
+	double start = now ();
+	unsigned long long last = 0;
+	for (int t=1; t<=seconds; ++t) {
+		double wake = start + t - now ();
+		if (wake > 0)
+			usleep ( (useconds_t) (wake * 1e6) );
+		unsigned long long ops = 0;
+		for (int i=0; i<clients; ++i)
+			ops += __atomic_load_n (&tasks[i].ops, __ATOMIC_RELAXED);
+		std::cout << t << "\t" << ops - last << std::endl;
+		last = ops;
+	}
+	__atomic_store_n (&running, false, __ATOMIC_RELAXED);
+	double elapsed = now () - start;
+
+	unsigned long long failures = 0;
+	for (int i=0; i<clients; ++i) {
+		pthread_join ( handles[i], 0 );
+		failures += tasks[i].failures;
+	}
+
+	std::cout << "%% updates/s\tfailures\n" << last / elapsed << "\t" << failures << "\n";
+	std::cout << "%% port\tid\ttuples\trequests/s\n";
+	for (unsigned i=0; i<probed.size(); ++i)
+		probe (host, probed[i]);
+	return 0;
+}
@@ -0,0 +1,414 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+
+
+/*
+ * Multi-threaded stress benchmark of a pool: reader threads run a mix of
+ * lookups, range and nearest neighbor queries while writer threads keep
+ * inserting, appending, deleting and compacting, and throughput is
+ * reported for each count of reader threads, or of writer threads alone
+ * when ingesting. Verifying, the writers index fresh keys alone while the
+ * readers look up, range and search around keys already indexed, counting
+ * those they miss, which buckets spilling under them must never cause.
+ * Sweeping, a single thread pushes the keys one by one into a pool for
+ * each bucket size, then runs range and nearest neighbor queries over it,
+ * and the time each phase takes is reported.
+ */
+
+#include "Pool.cpp"
+#include <getopt.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+
+typedef double index_t;
+
+/* writes between compactions */
+#define COMPACTION_PERIOD 4096
+
+struct StressTask {
+	Pool<index_t>* pool;
+	int dims;
+	unsigned keys;
+	unsigned seed;
+	bool* running;
+	unsigned long long ops;
+
+	/* verifying, keys indexed by each writer so far, and misses of a reader */
+	unsigned* indexed;
+	int writers;
+	int index;
+	unsigned long long misses;
+};
+
+/* counts visited tuples, so that queries are not optimized away */
+class tuple_counter {
+public:
+	unsigned long long size;
+
+	tuple_counter () : size(0) {}
+
+	void operator () ( const index_t*, Value* val ) {size += val != 0;}
+	void operator () ( double, const index_t*, Value* val ) {size += val != 0;}
+};
+
+static double now () {
+	timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static unsigned next ( unsigned& seed ) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+/* the key of id is a hash of it, so that lookups and updates hit indexed keys */
+static void draw ( index_t* key, int dims, unsigned id ) {
+	unsigned h = id;
+	for (int j=0; j<dims; ++j) {
+		h = (h ^ (h >> 15)) * 2246822519u + 0x9e3779b9u;
+		h = (h ^ (h >> 13)) * 3266489917u;
+		key[j] = (h >> 12) / (double) (1u << 20);
+	}
+}
+
+void* reader ( void* args ) {
+	StressTask* task = static_cast<StressTask*> (args);
+	index_t key [task->dims];
+	index_t lo [task->dims];
+	index_t hi [task->dims];
+	tuple_counter counter;
+
+	while ( __atomic_load_n (task->running, __ATOMIC_RELAXED) ) {
+		draw ( key, task->dims, next (task->seed) % task->keys );
+		switch ( next (task->seed) % 3 ) {
+		case 0:
+			task->pool->lookup ( key, counter );
+			break;
+		case 1:
+			for (int j=0; j<task->dims; ++j) {
+				lo[j] = key[j] - .02;
+				hi[j] = key[j] + .02;
+			}
+			task->pool->range ( lo, hi, counter );
+			break;
+		default:
+			task->pool->nearest ( key, 10, 1, counter );
+		}
+		++task->ops;
+	}
+	return 0;
+}
+
+void* writer ( void* args ) {
+	StressTask* task = static_cast<StressTask*> (args);
+	index_t key [task->dims];
+
+	while ( __atomic_load_n (task->running, __ATOMIC_RELAXED) ) {
+		draw ( key, task->dims, next (task->seed) % task->keys );
+		switch ( next (task->seed) % 4 ) {
+		case 0:
+			task->pool->erase ( key );
+			break;
+		case 1:
+			task->pool->append ( key, "+", 1 );
+			break;
+		default:
+			task->pool->update ( key, ValueStore::create ("stress", 6) );
+		}
+
+		/* as the compactor of a node would do after deletions */
+		if ( ++task->ops % COMPACTION_PERIOD == 0 )
+			task->pool->compact (.25);
+	}
+	return 0;
+}
+
+/* writer w indexes keys w, w+writers, ... of the fresh ones past the loaded */
+void* indexer ( void* args ) {
+	StressTask* task = static_cast<StressTask*> (args);
+	index_t key [task->dims];
+	unsigned* indexed = &task->indexed[task->index];
+
+	for (unsigned n=0; __atomic_load_n (task->running, __ATOMIC_RELAXED); ++n) {
+		draw ( key, task->dims, task->keys + n*task->writers + task->index );
+		task->pool->update ( key, ValueStore::create ("stress", 6) );
+		__atomic_store_n (indexed, n+1, __ATOMIC_RELEASE);
+		++task->ops;
+	}
+	return 0;
+}
+
+/* counts the tuples at exactly a key */
+class key_finder {
+	const index_t* key;
+	int dims;
+public:
+	unsigned long long found;
+
+	key_finder ( const index_t* k, int d ) : key(k), dims(d), found(0) {}
+
+	void operator () ( const index_t* k, Value* val ) {
+		if ( val != 0 && memcmp (k, key, dims*sizeof(index_t)) == 0 )
+			++found;
+	}
+	void operator () ( double, const index_t* k, Value* val ) {operator () (k, val);}
+};
+
+/* looks up, ranges and searches around a key some writer has already indexed */
+void* verifier ( void* args ) {
+	StressTask* task = static_cast<StressTask*> (args);
+	index_t key [task->dims];
+	index_t lo [task->dims];
+	index_t hi [task->dims];
+
+	while ( __atomic_load_n (task->running, __ATOMIC_RELAXED) ) {
+		int w = next (task->seed) % task->writers;
+		unsigned indexed = __atomic_load_n (&task->indexed[w], __ATOMIC_ACQUIRE);
+		unsigned id = indexed > 0 && next (task->seed) % 2 ? task->keys + (next (task->seed) % indexed)*task->writers + w
+			: next (task->seed) % task->keys;
+		draw ( key, task->dims, id );
+
+		key_finder finder (key, task->dims);
+		switch ( next (task->seed) % 3 ) {
+		case 0:
+			task->pool->lookup ( key, finder );
+			break;
+		case 1:
+			for (int j=0; j<task->dims; ++j) {
+				lo[j] = key[j] - .01;
+				hi[j] = key[j] + .01;
+			}
+			task->pool->range ( lo, hi, finder );
+			break;
+		default:
+			task->pool->nearest ( key, 1, 1, finder );
+		}
+		if ( finder.found == 0 )
+			++task->misses;
+		++task->ops;
+	}
+	return 0;
+}
+
+/* runs readers and writers for a while, returns their throughputs and the misses of verifying readers */
+static void run ( Pool<index_t>& pool, int dims, unsigned keys, int readers, int writers,
+		double seconds, double& read_rate, double& write_rate, bool verify, unsigned long long& misses ) {
+
+	bool running = true;
+	std::vector<StressTask> tasks (readers + writers);
+	std::vector<pthread_t> threads (readers + writers);
+	std::vector<unsigned> indexed (writers+1, 0);
+
+	for (int i=0; i<readers+writers; ++i) {
+		tasks[i].pool = &pool;
+		tasks[i].dims = dims;
+		tasks[i].keys = keys;
+		tasks[i].seed = 7919 * (i+1);
+		tasks[i].running = &running;
+		tasks[i].ops = 0;
+		tasks[i].indexed = &indexed[0];
+		tasks[i].writers = writers;
+		tasks[i].index = i - readers;
+		tasks[i].misses = 0;
+
+		void* (*routine) (void*) = i < readers ? (verify ? verifier : reader) : (verify ? indexer : writer);
+		if ( pthread_create ( &threads[i], 0, routine, &tasks[i] ) != 0 )
+			throw std::runtime_error ("** ERROR - Unable to create a stress thread.");
+	}
+
+	double start = now ();
+	usleep ( (useconds_t) (seconds * 1e6) );
+	__atomic_store_n (&running, false, __ATOMIC_RELAXED);
+	for (int i=0; i<readers+writers; ++i)
+		pthread_join ( threads[i], 0 );
+	double elapsed = now () - start;
+
+	read_rate = write_rate = 0;
+	misses = 0;
+	for (int i=0; i<readers+writers; ++i) {
+		(i < readers ? read_rate : write_rate) += tasks[i].ops / elapsed;
+		misses += tasks[i].misses;
+	}
+}
+
+/* milliseconds to push the keys one by one and to run the queries over them, for each bucket size */
+static void sweep ( int dims, unsigned tuples, unsigned shards ) {
+	const unsigned buckets[] = {1, 4, 16, 32, 64};
+	const unsigned queries = 2000;
+
+	index_t lo [dims];
+	index_t hi [dims];
+	for (int j=0; j<dims; ++j) {
+		lo[j] = 0;
+		hi[j] = 1;
+	}
+
+	std::cout << "%% bucket\tpush ms\trange ms\thits/range\tknn ms\n";
+	for (unsigned b=0; b<sizeof(buckets)/sizeof(buckets[0]); ++b) {
+		Pool<index_t> pool (dims, lo, hi, buckets[b], shards);
+		index_t key [dims];
+
+		double start = now ();
+		for (unsigned i=0; i<tuples; ++i) {
+			draw ( key, dims, i );
+			pool.push ( key, ValueStore::create ("stress", 6) );
+		}
+		double push = now () - start;
+
+		unsigned seed = 7919;
+		index_t qlo [dims];
+		index_t qhi [dims];
+		tuple_counter hits;
+		start = now ();
+		for (unsigned q=0; q<queries; ++q) {
+			draw ( key, dims, next (seed) );
+			for (int j=0; j<dims; ++j) {
+				qlo[j] = key[j] - .02;
+				qhi[j] = key[j] + .02;
+			}
+			pool.range ( qlo, qhi, hits );
+		}
+		double range = now () - start;
+
+		tuple_counter found;
+		start = now ();
+		for (unsigned q=0; q<queries; ++q) {
+			draw ( key, dims, next (seed) );
+			pool.nearest ( key, 10, 1, found );
+		}
+		double knn = now () - start;
+
+		std::cout << buckets[b] << "\t" << push * 1e3 << "\t" << range * 1e3 << "\t"
+			<< (double) hits.size / queries << "\t" << knn * 1e3 << std::endl;
+	}
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-d --dims\n";
+	std::cerr << "\t\t-n --tuples\n";
+	std::cerr << "\t\t-t --threads\n";
+	std::cerr << "\t\t-w --writers\n";
+	std::cerr << "\t\t-s --seconds\n";
+	std::cerr << "\t\t-b --bucket\n";
+	std::cerr << "\t\t-k --shards\n";
+	std::cerr << "\t\t-i --ingest\n";
+	std::cerr << "\t\t-v --verify\n";
+	std::cerr << "\t\t-B --sweep\n";
+}
+
+int main ( int argc, char** argv ) {
+	int dims = 3;
+	unsigned tuples = 100000;
+	int max_threads = sysconf (_SC_NPROCESSORS_ONLN);
+	int writers = 1;
+	double seconds = 2;
+	unsigned bucket = 16;
+	unsigned shards = 1;
+	bool ingest = false;
+	bool verify = false;
+	bool buckets = false;
+
+	static struct option long_options[] = {
+		{"dims",1,NULL,'d'},
+		{"tuples",1,NULL,'n'},
+		{"threads",1,NULL,'t'},
+		{"writers",1,NULL,'w'},
+		{"seconds",1,NULL,'s'},
+		{"bucket",1,NULL,'b'},
+		{"shards",1,NULL,'k'},
+		{"ingest",0,NULL,'i'},
+		{"verify",0,NULL,'v'},
+		{"sweep",0,NULL,'B'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "d:n:t:w:s:b:k:ivB", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': tuples = std::atoi (optarg); break;
+		case 't': max_threads = std::atoi (optarg); break;
+		case 'w': writers = std::atoi (optarg); break;
+		case 's': seconds = std::atof (optarg); break;
+		case 'b': bucket = std::atoi (optarg); break;
+		case 'k': shards = std::atoi (optarg); break;
+		case 'i': ingest = true; break;
+		case 'v': verify = true; break;
+		case 'B': buckets = true; break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( dims < 1 || dims > MAXDIMS || tuples < 1 || max_threads < 1 || writers < 0 || bucket < 1 || shards < 1
+			|| (verify && writers < 1) ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	/* sweeping takes the bucket sizes in turn and ignores the thread counts */
+	if ( buckets ) {
+		sweep ( dims, tuples, shards );
+		return 0;
+	}
+
+	index_t lo [dims];
+	index_t hi [dims];
+	for (int j=0; j<dims; ++j) {
+		lo[j] = 0;
+		hi[j] = 1;
+	}
+
+	std::cout << "%% threads\treads/s\twrites/s" << (verify ? "\tmissing" : "") << "\n";
+	for (int threads=1; threads<=max_threads; threads*=2) {
+		Pool<index_t> pool (dims, lo, hi, bucket, shards);
+
+		TupleArray<index_t> data (dims);
+		index_t key [dims];
+		for (unsigned i=0; i<tuples; ++i) {
+			draw ( key, dims, i );
+			data ( key, ValueStore::create ("stress", 6) );
+		}
+		pool.bulk_load (data);
+
+		double read_rate, write_rate;
+		unsigned long long misses;
+		/* ingest sweeps writer threads without readers, verifying indexes past the loaded keys */
+		if ( ingest )
+			run ( pool, dims, 2*tuples, 0, threads, seconds, read_rate, write_rate, false, misses );
+		else if ( verify )
+			run ( pool, dims, tuples, threads, writers, seconds, read_rate, write_rate, true, misses );
+		else
+			run ( pool, dims, 2*tuples, threads, writers, seconds, read_rate, write_rate, false, misses );
+		std::cout << threads << "\t" << (unsigned long long) read_rate << "\t"
+			<< (unsigned long long) write_rate;
+		if ( verify )
+			std::cout << "\t" << misses;
+		std::cout << std::endl;
+
+		if ( threads < max_threads && 2*threads > max_threads )
+			threads = max_threads / 2;
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*********************************************************************
+ * Copyright (C) George C. Tsatsanifos 2008 <gtsatsanifos@gmail.com>
+ *
+ * This file is part of MIDAS.
+ *
+ * MIDAS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MIDAS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MIDAS.  If not, see <http://www.gnu.org/licenses/>.
+ *********************************************************************/
+/*
+ * Benchmark of the nearest neighbor search of a pool: uniform keys are
+ * indexed and uniform queries asked, and the tree-nodes the search expands
+ * are reported per query, along with the recall of its answers against a
+ * scan of every key. An exhaustive search expands every tree-node, about
+ * as many as there are keys over the bucket size.
+ */
+
+#define __VISITS__
+#include "Pool.cpp"
+#include <getopt.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+typedef double index_t;
+
+unsigned long long nearest_visits = 0;
+
+/* collects the distances of the neighbors found */
+class distance_collector {
+public:
+	std::vector<double> found;
+
+	void operator () ( double dist, const index_t*, Value* ) {found.push_back (dist);}
+};
+
+static unsigned next ( unsigned& seed ) {
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+void print_usage ( char* program ) {
+	std::cerr << "%% Usage:\n\t" << program << " option parameter\n";
+	std::cerr << "\t\t-d --dims (all of 2, 4, 8 and 16 unless given)\n";
+	std::cerr << "\t\t-n --tuples\n";
+	std::cerr << "\t\t-q --queries\n";
+	std::cerr << "\t\t-k --neighbors\n";
+	std::cerr << "\t\t-b --bucket\n";
+}
+
+int main ( int argc, char** argv ) {
+	int dims = 0;
+	unsigned tuples = 200000;
+	unsigned queries = 200;
+	unsigned K = 10;
+	unsigned bucket = 1;
+
+	static struct option long_options[] = {
+		{"dims",1,NULL,'d'},
+		{"tuples",1,NULL,'n'},
+		{"queries",1,NULL,'q'},
+		{"neighbors",1,NULL,'k'},
+		{"bucket",1,NULL,'b'},
+		{NULL,0,NULL,0}
+	};
+
+	int option;
+	while ( (option = getopt_long (argc, argv, "d:n:q:k:b:", long_options, NULL)) != -1 ) {
+		switch (option) {
+		case 'd': dims = std::atoi (optarg); break;
+		case 'n': tuples = std::atoi (optarg); break;
+		case 'q': queries = std::atoi (optarg); break;
+		case 'k': K = std::atoi (optarg); break;
+		case 'b': bucket = std::atoi (optarg); break;
+		default:
+			print_usage (argv[0]);
+			return 1;
+		}
+	}
+
+	if ( dims < 0 || dims > MAXDIMS || (int) tuples < 1 || (int) queries < 1 || (int) K < 1 || (int) bucket < 1 ) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	std::vector<int> sweep;
+	if ( dims > 0 )
+		sweep.push_back (dims);
+	else
+		for (int d=2; d<=16; d*=2)
+			sweep.push_back (d);
+
+	std::cout << "%% dims\ttuples\tK\tbucket\tvisits/query\trecall\n";
+	for (unsigned s=0; s<sweep.size(); ++s) {
+		int d = sweep[s];
+		index_t lo [d];
+		index_t hi [d];
+		for (int j=0; j<d; ++j) {
+			lo[j] = 0;
+			hi[j] = 1;
+		}
+
+		unsigned seed = 7919;
+		Pool<index_t> pool (d, lo, hi, bucket);
+		std::vector<index_t> keys (tuples * d);
+		for (unsigned i=0; i<tuples; ++i) {
+			for (int j=0; j<d; ++j)
+				keys[i*d+j] = (next (seed) % 1000000) / 1e6;
+			pool.push ( &keys[i*d], ValueStore::create ("visits", 6) );
+		}
+
+		unsigned long long visits = 0;
+		double recall = 0;
+		std::vector<double> exact (tuples);
+		index_t center [d];
+		for (unsigned q=0; q<queries; ++q) {
+			for (int j=0; j<d; ++j)
+				center[j] = (next (seed) % 1000000) / 1e6;
+
+			distance_collector collector;
+			nearest_visits = 0;
+			pool.nearest ( center, K, DBL_MAX, collector );
+			visits += nearest_visits;
+
+			for (unsigned i=0; i<tuples; ++i)
+				exact[i] = sqrt ( ::sq_dist<index_t> (&keys[i*d], center, d) );
+			unsigned k = std::min (K, tuples);
+			std::nth_element (exact.begin(), exact.begin() + (k-1), exact.end());
+			/* buckets sum the coordinates in another order, so a distance may differ in its last bits */
+			unsigned hits = 0;
+			for (unsigned i=0; i<collector.found.size(); ++i)
+				hits += collector.found[i] <= exact[k-1] * (1 + 1e-12);
+			recall += (double) std::min (hits, k) / k;
+		}
+
+		std::cout << d << "\t" << tuples << "\t" << K << "\t" << bucket << "\t"
+			<< (double) visits / queries << "\t" << recall / queries << std::endl;
+	}
+	return 0;
+}